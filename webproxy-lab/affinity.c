@@ -0,0 +1,159 @@
+/*
+ * affinity.c - 워커 스레드 CPU 고정과 NUMA 노드 배치
+ *
+ * 고정하지 않은 워커는 소켓 사이를 떠돌고, 메모리는 처음 쓴 스레드가 그때
+ * 있던 노드에 놓이므로 (커널의 first-touch 정책) 두 소켓 호스트에서는 hit 의
+ * 절반쯤이 원격 메모리를 읽는다. aff_pin 은 워커를 CPU 하나에 고정하고 그 CPU 의
+ * 노드를 스레드마다 기억해 둔다. 워커가 직접 할당하고 처음 쓰는 메모리 (Rio
+ * 버퍼, 릴레이 창, 코루틴 스택, 캐시에 넣을 응답) 는 그래서 그 노드에 놓인다.
+ *
+ * CPU 는 노드를 번갈아 가며 늘어놓으므로 워커 수가 CPU 수보다 적어도 노드마다
+ * 고르게 나뉜다. 토폴로지는 libnuma 없이 /sys/devices/system/node 에서 읽고,
+ * 그 디렉터리가 없으면 노드 하나로 본다.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include "csapp.h"
+#include "affinity.h"
+
+static int ncpus;                  /* 고정에 쓸 CPU 수 */
+static int cpus[CPU_SETSIZE];      /* 노드를 번갈아 가며 늘어놓은 CPU 번호 */
+static int cpu_node[CPU_SETSIZE];  /* CPU 번호 -> 노드 (0..nnodes-1) */
+static int os_node[AFF_MAXNODES];  /* 노드 -> 커널의 노드 번호 */
+static int nnodes = 1;
+static __thread int my_node = -1;
+
+/* "0-3,8,10-11" 꼴의 목록을 set 에 더한다. 형식이 틀리면 -1 */
+static int parse_list(const char *s, cpu_set_t *set) {
+    char *end;
+    long lo, hi;
+
+    while (*s && *s != '\n') {
+        lo = hi = strtol(s, &end, 10);
+        if (end == s || lo < 0)
+            return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo)
+                return -1;
+        }
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++)
+            CPU_SET(c, set);
+        s = end;
+        if (*s == ',')
+            s++;
+        else if (*s && *s != '\n')
+            return -1;
+    }
+    return 0;
+}
+
+/* sysfs 의 목록 파일 하나를 읽는다. 없으면 -1 */
+static int read_list(const char *path, cpu_set_t *set) {
+    char buf[MAXLINE];
+    FILE *fp;
+    int rc;
+
+    CPU_ZERO(set);
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+    rc = fgets(buf, sizeof(buf), fp) ? parse_list(buf, set) : -1;
+    fclose(fp);
+    return rc;
+}
+
+/*
+ * aff_init - 고정에 쓸 CPU 를 정한다. cpulist 가 NULL 이면 이 프로세스가 쓸 수
+ *     있는 CPU 전부, 아니면 그중 목록에 있는 것만. 남는 CPU 가 없거나 목록
+ *     형식이 틀리면 -1.
+ */
+int aff_init(const char *cpulist) {
+    static int lists[AFF_MAXNODES][CPU_SETSIZE];
+    int len[AFF_MAXNODES] = {0}, k;
+    cpu_set_t want, allowed, online, set;
+    char path[64];
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        unix_error("sched_getaffinity error");
+    want = allowed;
+    if (cpulist) {
+        CPU_ZERO(&want);
+        if (parse_list(cpulist, &want) < 0)
+            return -1;
+        CPU_AND(&want, &want, &allowed);
+    }
+    if (CPU_COUNT(&want) == 0)
+        return -1;
+
+    /* 노드별로 나눈다 - AFF_MAXNODES 를 넘는 노드는 마지막 노드에 합친다 */
+    nnodes = 0;
+    read_list("/sys/devices/system/node/online", &online);
+    for (int n = 0; n < CPU_SETSIZE; n++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        if (!CPU_ISSET(n, &online) || read_list(path, &set) < 0)
+            continue;
+        CPU_AND(&set, &set, &want);
+        if (CPU_COUNT(&set) == 0)
+            continue;
+        if (nnodes < AFF_MAXNODES)
+            os_node[nnodes++] = n;
+        k = nnodes - 1;
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (!CPU_ISSET(c, &set))
+                continue;
+            lists[k][len[k]++] = c;
+            cpu_node[c] = k;
+            CPU_CLR(c, &want);
+        }
+    }
+
+    /* 어느 노드에도 없는 CPU (sysfs 가 없을 때) 는 첫 노드로 */
+    if (nnodes == 0)
+        os_node[nnodes++] = 0;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &want)) {
+            lists[0][len[0]++] = c;
+            cpu_node[c] = 0;
+        }
+    }
+
+    /* 노드를 번갈아 가며 늘어놓는다 */
+    ncpus = 0;
+    for (int i = 0, more = 1; more; i++) {
+        more = 0;
+        for (k = 0; k < nnodes; k++) {
+            if (i < len[k]) {
+                cpus[ncpus++] = lists[k][i];
+                more = 1;
+            }
+        }
+    }
+    return nnodes;
+}
+
+/* 부르는 스레드를 idx 번째 CPU 에 고정하고 그 노드를 돌려준다 */
+int aff_pin(int idx) {
+    cpu_set_t set;
+    int cpu = cpus[idx % ncpus];
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+        unix_error("pthread_setaffinity_np error");
+    return my_node = cpu_node[cpu];
+}
+
+/* 이 스레드가 고정된 노드 (0..aff_nodes()-1). 고정되지 않았으면 -1 */
+int aff_node(void) {
+    return my_node;
+}
+
+/* 노드 수 - aff_init 전이면 1 */
+int aff_nodes(void) {
+    return nnodes;
+}
+
+int aff_os_node(int node) {
+    return os_node[node];
+}
@@ -0,0 +1,15 @@
+/*
+ * affinity.h - 워커 스레드 CPU 고정과 NUMA 노드 배치
+ */
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+#define AFF_MAXNODES 8             /* 이보다 뒤의 노드는 마지막 노드로 친다 */
+
+int aff_init(const char *cpulist);
+int aff_pin(int idx);
+int aff_node(void);
+int aff_nodes(void);
+int aff_os_node(int node);
+
+#endif /* __AFFINITY_H__ */
@@ -0,0 +1,174 @@
+/*
+ * bench.c - 프록시 부하 측정 도구
+ *
+ *   bench -o <port> <size> [delay_ms]
+ *       origin 모드: 어떤 요청이든 delay_ms 만큼 기다린 뒤 size 바이트 본문으로
+ *       응답한다 (연결당 스레드). tiny 는 한 번에 하나씩만 처리하므로 릴레이
+ *       성능을 재기에는 느리다.
+ *
+ *   bench <proxy_port> <url> [-c conns] [-n requests]
+ *       conns 개의 스레드가 프록시에 요청을 나눠 보내고 처리량과 지연 시간을 출력한다.
+ */
+#define _GNU_SOURCE   /* strcasestr */
+#include "csapp.h"
+#include <time.h>
+
+static char *proxy_port, *url;
+static int nconns = 8, nreqs = 1000;
+static long origin_size;
+static int origin_delay_ms;
+
+static double *lat;            /* 요청별 지연 (ms) */
+static long total_bytes;
+static int failures;
+static pthread_mutex_t stat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static char *origin_body;
+
+/*
+ * origin 모드 - 요청 헤더를 읽고 size 바이트로 응답한다. HTTP/1.1 요청이고
+ * Connection: close 가 없으면 같은 연결에서 다음 요청을 기다린다 (keep-alive).
+ */
+static void *origin_thread(void *vargp) {
+    int fd = *(int *)vargp;
+    char buf[MAXLINE];
+    rio_t rio;
+    int n, keepalive = 1;
+
+    Free(vargp);
+    Pthread_detach(pthread_self());
+    rio_readinitb(&rio, fd);
+    while (keepalive && (n = rio_readlineb(&rio, buf, MAXLINE)) > 0) {
+        keepalive = !strstr(buf, "HTTP/1.0");
+        while ((n = rio_readlineb(&rio, buf, MAXLINE)) > 0 && strcmp(buf, "\r\n"))
+            if (!strncasecmp(buf, "Connection:", 11) && strcasestr(buf, "close"))
+                keepalive = 0;
+        if (n <= 0)
+            break;
+        if (origin_delay_ms)
+            usleep(origin_delay_ms * 1000);
+        n = sprintf(buf, "HTTP/1.1 200 OK\r\nContent-length: %ld\r\n"
+                    "Content-type: application/octet-stream\r\n%s\r\n", origin_size,
+                    keepalive ? "" : "Connection: close\r\n");
+        if (rio_writen(fd, buf, n) < 0 || rio_writen(fd, origin_body, origin_size) < 0)
+            break;
+    }
+    close(fd);
+    return NULL;
+}
+
+static void run_origin(char *port) {
+    int listenfd = Open_listenfd(port), *fdp;
+    pthread_t tid;
+
+    Signal(SIGPIPE, SIG_IGN);
+    origin_body = Malloc(origin_size);
+    memset(origin_body, 'x', origin_size);
+    while (1) {
+        fdp = Malloc(sizeof(int));
+        *fdp = Accept(listenfd, NULL, NULL);
+        Pthread_create(&tid, NULL, origin_thread, fdp);
+    }
+}
+
+static void *client_thread(void *vargp) {
+    long id = (long)vargp;
+    char req[MAXLINE], buf[65536];
+    int fd, len;
+    ssize_t n;
+    long bytes;
+    double t0;
+
+    len = snprintf(req, sizeof(req), "GET %s HTTP/1.0\r\n\r\n", url);
+    for (int i = id; i < nreqs; i += nconns) {
+        t0 = now_ms();
+        bytes = 0;
+        if ((fd = open_clientfd("localhost", proxy_port)) < 0) {
+            pthread_mutex_lock(&stat_lock);
+            failures++;
+            pthread_mutex_unlock(&stat_lock);
+            lat[i] = -1;
+            continue;
+        }
+        rio_writen(fd, req, len);
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            bytes += n;
+        close(fd);
+        lat[i] = now_ms() - t0;
+
+        pthread_mutex_lock(&stat_lock);
+        if (n < 0 || bytes == 0)
+            failures++;
+        total_bytes += bytes;
+        pthread_mutex_unlock(&stat_lock);
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    pthread_t *tids;
+    double t0, elapsed;
+    int opt, ok;
+
+    if ((argc == 4 || argc == 5) && !strcmp(argv[1], "-o")) {
+        origin_size = atol(argv[3]);
+        origin_delay_ms = (argc == 5) ? atoi(argv[4]) : 0;
+        run_origin(argv[2]);
+    }
+
+    while ((opt = getopt(argc, argv, "c:n:")) != -1) {
+        switch (opt) {
+        case 'c':
+            nconns = atoi(optarg);
+            break;
+        case 'n':
+            nreqs = atoi(optarg);
+            break;
+        default:
+            optind = argc + 1;
+        }
+    }
+    if (optind != argc - 2 || nconns <= 0 || nreqs <= 0) {
+        fprintf(stderr, "usage: %s <proxy_port> <url> [-c conns] [-n requests]\n"
+                        "       %s -o <port> <size> [delay_ms]\n", argv[0], argv[0]);
+        exit(1);
+    }
+    proxy_port = argv[optind];
+    url = argv[optind + 1];
+
+    Signal(SIGPIPE, SIG_IGN);
+    lat = Calloc(nreqs, sizeof(double));
+    tids = Malloc(nconns * sizeof(pthread_t));
+    t0 = now_ms();
+    for (long i = 0; i < nconns; i++)
+        Pthread_create(&tids[i], NULL, client_thread, (void *)i);
+    for (int i = 0; i < nconns; i++)
+        Pthread_join(tids[i], NULL);
+    elapsed = now_ms() - t0;
+
+    /* 실패한 요청(-1)은 정렬하면 앞으로 모인다 */
+    qsort(lat, nreqs, sizeof(double), cmp_double);
+    ok = 0;
+    while (ok < nreqs && lat[ok] < 0)
+        ok++;
+    printf("requests %d  failed %d  elapsed %.1f ms\n", nreqs, failures, elapsed);
+    printf("throughput %.1f req/s  %.1f MB/s\n",
+           nreqs * 1000.0 / elapsed, total_bytes / elapsed / 1000.0);
+    if (ok < nreqs)
+        printf("latency p50 %.2f ms  p99 %.2f ms  max %.2f ms\n",
+               lat[ok + (nreqs - ok) / 2], lat[ok + (int)((nreqs - ok) * 0.99)],
+               lat[nreqs - 1]);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# bench.sh - proxy_cache 의 릴레이 방식 비교
+#     blocking 워커 스레드 / -z (splice) / -m coro / -e epoll / -e uring 을 같은 부하로 돌리고
+#     처리량, 지연, 프록시 프로세스의 CPU 시간(user+sys)을 출력한다.
+#     응답 크기 기본값은 MAX_OBJECT_SIZE 보다 커서 매번 캐시 miss 릴레이가 된다.
+#     delay_ms 를 주면 origin 이 그만큼 늦게 응답한다 (느린 origin 흉내).
+#
+#     usage: ./bench.sh [size] [conns] [requests] [delay_ms]
+#
+
+SIZE=${1:-1048576}
+CONNS=${2:-32}
+REQS=${3:-2000}
+DELAY=${4:-0}
+
+make -s proxy_cache bench || exit 1
+
+OPORT=`./free-port.sh`
+./bench -o ${OPORT} ${SIZE} ${DELAY} &
+OPID=$!
+trap "kill ${OPID} 2>/dev/null" EXIT
+sleep 0.3
+
+# /proc/<pid>/stat 의 utime+stime (clock tick) 을 ms 로
+function cpu_ms {
+    local ticks=`awk '{print $14 + $15}' /proc/$1/stat`
+    echo $(( ticks * 1000 / $(getconf CLK_TCK) ))
+}
+
+echo "size ${SIZE} bytes, origin delay ${DELAY} ms, ${CONNS} connections, ${REQS} requests"
+for MODE in "" "-z" "-m coro" "-e epoll" "-e uring"; do
+    PPORT=`./free-port.sh`
+    ./proxy_cache ${PPORT} ${MODE} > /dev/null 2>&1 &
+    PPID_=$!
+    sleep 0.3
+    echo "== proxy_cache ${MODE:-(blocking threads)}"
+    ./bench ${PPORT} http://localhost:${OPORT}/bench -c ${CONNS} -n ${REQS}
+    echo "proxy cpu $(cpu_ms ${PPID_}) ms"
+    kill ${PPID_}
+    wait ${PPID_} 2>/dev/null
+done
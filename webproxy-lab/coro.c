@@ -0,0 +1,391 @@
+/*
+ * coro.c - ucontext 기반 코루틴과 epoll 스케줄러
+ *
+ * 스케줄러는 스레드에 묶여 있고 코루틴은 자기를 만든 스케줄러 스레드에서만
+ * 돈다 (스레드 간 이동 없음). 다른 스레드는 coro_post() 로 새 코루틴을
+ * 만들어 달라고 부탁만 할 수 있다.
+ *
+ * 스택은 mmap 으로 잡고 맨 아래 페이지를 PROT_NONE 가드로 막아서 스택
+ * 오버플로가 다른 메모리를 조용히 덮지 않고 바로 SIGSEGV 가 나게 한다.
+ * 끝난 코루틴의 스택은 스레드별 풀에 모아 두었다가 재사용한다.
+ *
+ * CORO_STACK_CHECK 로 빌드하면 스택을 무늬로 채워 두었다가 코루틴이 끝날 때
+ * 무늬가 어디까지 덮였는지 재어 가장 깊었던 사용량을 남긴다 (시험용 - 스택
+ * 페이지를 모두 건드리므로 MAP_NORESERVE 의 이득이 사라진다).
+ */
+#define _GNU_SOURCE
+#include <ucontext.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stddef.h>
+#include "csapp.h"
+#include "coro.h"
+#include "twheel.h"
+
+#define STACK_POOL_MAX 1024   /* 스케줄러마다 재사용을 위해 남겨 둘 코루틴 수 */
+#define MAX_EVENTS 256
+
+typedef struct coro {
+    ucontext_t ctx;
+    coro_fn *fn;
+    void *arg;
+    char *map;                /* mmap 영역 (가드 페이지 포함) */
+    int done;
+    struct coro *next;        /* 실행 큐 / 재사용 목록 */
+    long long limit;          /* coro_deadline 으로 건 대기 마감 시각 (ms), 없으면 -1 */
+    tw_timer_t timer;         /* 마감이 있는 대기 중에만 휠에 걸린다 */
+    int wait_fd;
+    int timed_out;
+} coro_t;
+
+typedef struct post {
+    coro_fn *fn;
+    void *arg;
+    struct post *next;
+} post_t;
+
+struct coro_sched {
+    int epfd;
+    int wakefd;
+    ucontext_t main_ctx;      /* 스케줄러 자신의 문맥 */
+    coro_t *current;
+    coro_t *runq_head, *runq_tail;
+    twheel_t wheel;           /* 마감이 있는 대기들 */
+    coro_t *pool;             /* 끝난 코루틴 (스택 재사용) */
+    int npool;
+    pthread_mutex_t lock;     /* 아래 posts 보호 */
+    post_t *posts_head, *posts_tail;
+};
+
+static __thread coro_sched_t *self;
+static size_t pagesz;
+
+#ifdef CORO_STACK_CHECK
+#define STACK_FILL 0xa5
+static size_t stack_peak;     /* 모든 스케줄러를 통틀어 가장 깊었던 사용량 */
+
+/* 무늬가 덮인 만큼을 재어 최댓값에 반영하고, 다음 사용을 위해 다시 채운다 */
+static void stack_measure(coro_t *c) {
+    unsigned char *lo = (unsigned char *)c->map + pagesz, *p = lo;
+    size_t used, peak;
+
+    while (p < lo + CORO_STACK_SIZE && *p == STACK_FILL)
+        p++;
+    used = lo + CORO_STACK_SIZE - p;
+    peak = __atomic_load_n(&stack_peak, __ATOMIC_RELAXED);
+    while (used > peak &&
+           !__atomic_compare_exchange_n(&stack_peak, &peak, used, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    memset(lo, STACK_FILL, CORO_STACK_SIZE);
+}
+
+/* 지금까지 끝난 코루틴이 쓴 가장 깊은 스택 (바이트) */
+size_t coro_stack_peak(void) {
+    return __atomic_load_n(&stack_peak, __ATOMIC_RELAXED);
+}
+#endif
+
+static void runq_push(coro_sched_t *s, coro_t *c);
+
+/* 마감이 지난 대기를 깨운다 - fd 등록을 지워서 늦게 온 이벤트가 엉뚱한 대기를 깨우지 않게 */
+static void timer_fire(tw_timer_t *t) {
+    coro_t *c = (coro_t *)((char *)t - offsetof(coro_t, timer));
+
+    epoll_ctl(self->epfd, EPOLL_CTL_DEL, c->wait_fd, NULL);
+    c->timed_out = 1;
+    runq_push(self, c);
+}
+
+static void runq_push(coro_sched_t *s, coro_t *c) {
+    c->next = NULL;
+    if (s->runq_tail)
+        s->runq_tail->next = c;
+    else
+        s->runq_head = c;
+    s->runq_tail = c;
+}
+
+/* 현재 코루틴에서 스케줄러로 돌아간다 */
+static void switch_to_sched(void) {
+    coro_sched_t *s = self;
+
+    if (swapcontext(&s->current->ctx, &s->main_ctx) < 0)
+        unix_error("swapcontext error");
+}
+
+static void trampoline(void) {
+    coro_t *c = self->current;
+
+    c->fn(c->arg);
+    c->done = 1;
+    switch_to_sched();        /* 다시 돌아오지 않는다 */
+}
+
+static coro_t *coro_alloc(coro_sched_t *s) {
+    coro_t *c;
+
+    if (s->pool) {
+        c = s->pool;
+        s->pool = c->next;
+        s->npool--;
+        return c;
+    }
+    c = Malloc(sizeof(coro_t));
+    c->map = mmap(NULL, CORO_STACK_SIZE + pagesz, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (c->map == MAP_FAILED)
+        unix_error("coro stack mmap error");
+    if (mprotect(c->map, pagesz, PROT_NONE) < 0)   /* 스택은 아래로 자란다 */
+        unix_error("coro guard mprotect error");
+#ifdef CORO_STACK_CHECK
+    memset(c->map + pagesz, STACK_FILL, CORO_STACK_SIZE);
+#endif
+    return c;
+}
+
+static void coro_free(coro_sched_t *s, coro_t *c) {
+#ifdef CORO_STACK_CHECK
+    stack_measure(c);
+#endif
+    if (s->npool < STACK_POOL_MAX) {
+        c->next = s->pool;
+        s->pool = c;
+        s->npool++;
+        return;
+    }
+    Munmap(c->map, CORO_STACK_SIZE + pagesz);
+    Free(c);
+}
+
+/* 현재 스레드의 스케줄러에 코루틴을 하나 만든다 */
+void coro_spawn(coro_fn *fn, void *arg) {
+    coro_sched_t *s = self;
+    coro_t *c = coro_alloc(s);
+
+    c->fn = fn;
+    c->arg = arg;
+    c->done = 0;
+    c->limit = -1;
+    c->timer.armed = 0;
+    if (getcontext(&c->ctx) < 0)
+        unix_error("getcontext error");
+    c->ctx.uc_stack.ss_sp = c->map + pagesz;
+    c->ctx.uc_stack.ss_size = CORO_STACK_SIZE;
+    c->ctx.uc_link = NULL;
+    makecontext(&c->ctx, trampoline, 0);
+    runq_push(s, c);
+}
+
+coro_sched_t *coro_sched_create(void) {
+    coro_sched_t *s = Calloc(1, sizeof(coro_sched_t));
+    struct epoll_event ev;
+
+    if (!pagesz)
+        pagesz = sysconf(_SC_PAGESIZE);
+    if ((s->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        unix_error("epoll_create1 error");
+    if ((s->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+        unix_error("eventfd error");
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;       /* NULL = 다른 스레드가 보낸 post */
+    if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->wakefd, &ev) < 0)
+        unix_error("epoll_ctl error");
+    pthread_mutex_init(&s->lock, NULL);
+    tw_init(&s->wheel, tw_now());
+    return s;
+}
+
+/*
+ * coro_post - 아무 스레드에서나 호출. s 의 스레드에서 args[i] 마다
+ *     fn(args[i]) 코루틴을 하나씩 만든다. 깨우기는 묶음당 한 번.
+ */
+void coro_post(coro_sched_t *s, coro_fn *fn, void **args, int n) {
+    post_t *head = NULL, *tail = NULL, *p;
+    uint64_t one = 1;
+
+    if (n <= 0)
+        return;
+    for (int i = 0; i < n; i++) {
+        p = Malloc(sizeof(post_t));
+        p->fn = fn;
+        p->arg = args[i];
+        p->next = NULL;
+        if (tail)
+            tail->next = p;
+        else
+            head = p;
+        tail = p;
+    }
+    pthread_mutex_lock(&s->lock);
+    if (s->posts_tail)
+        s->posts_tail->next = head;
+    else
+        s->posts_head = head;
+    s->posts_tail = tail;
+    pthread_mutex_unlock(&s->lock);
+
+    if (write(s->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        unix_error("eventfd write error");
+}
+
+static void take_posts(coro_sched_t *s) {
+    post_t *p, *next;
+    uint64_t cnt;
+
+    if (read(s->wakefd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        unix_error("eventfd read error");
+    pthread_mutex_lock(&s->lock);
+    p = s->posts_head;
+    s->posts_head = s->posts_tail = NULL;
+    pthread_mutex_unlock(&s->lock);
+
+    for (; p; p = next) {
+        next = p->next;
+        coro_spawn(p->fn, p->arg);
+        Free(p);
+    }
+}
+
+/* 지금 실행 큐에 있는 코루틴들을 한 바퀴 돌린다 */
+static void run_ready(coro_sched_t *s) {
+    coro_t *c = s->runq_head;
+
+    s->runq_head = s->runq_tail = NULL;   /* 도는 중에 yield 한 것은 다음 바퀴로 */
+    while (c) {
+        coro_t *next = c->next;
+        s->current = c;
+        if (swapcontext(&s->main_ctx, &c->ctx) < 0)
+            unix_error("swapcontext error");
+        s->current = NULL;
+        if (c->done)
+            coro_free(s, c);
+        c = next;
+    }
+}
+
+/* 현재 스레드에서 스케줄러를 돌린다 (리턴하지 않는다) */
+void coro_sched_run(coro_sched_t *s) {
+    struct epoll_event evs[MAX_EVENTS];
+    int n, timeout;
+    long long left;
+
+    self = s;
+    rio_wait_hook = coro_wait_fd;   /* 이 스레드의 Rio 는 EAGAIN 에서 양보한다 */
+    while (1) {
+        run_ready(s);
+        timeout = -1;
+        if (s->runq_head)
+            timeout = 0;
+        else if ((left = tw_timeout(&s->wheel, tw_now())) >= 0)
+            timeout = (int)left;
+        n = epoll_wait(s->epfd, evs, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+        for (int i = 0; i < n; i++) {
+            coro_t *c = evs[i].data.ptr;
+
+            if (c == NULL) {
+                take_posts(s);
+            } else {
+                tw_cancel(&s->wheel, &c->timer);
+                runq_push(s, c);
+            }
+        }
+        if (s->wheel.count)
+            tw_expire(&s->wheel, tw_now(), timer_fire);
+    }
+}
+
+/* 실행 큐 맨 뒤로 가서 다른 코루틴에게 차례를 넘긴다 */
+void coro_yield(void) {
+    coro_sched_t *s = self;
+
+    if (!s || !s->current)
+        return;
+    runq_push(s, s->current);
+    switch_to_sched();
+}
+
+/*
+ * coro_wait_fd - fd 가 events(POLLIN/POLLOUT) 상태가 될 때까지 현재 코루틴을
+ *     재운다. rio_wait_hook 으로 쓰인다. 코루틴 밖에서 부르면 -1 (errno 그대로).
+ *     coro_deadline 으로 건 마감이 지나면 -1 (errno = ETIMEDOUT).
+ *     등록은 EPOLLONESHOT 이라 한 번 깨우면 꺼지고, 다음 대기 때 MOD 로 다시 켠다.
+ *     fd 가 닫히면 커널이 등록을 지우므로 같은 번호의 새 fd 는 ADD 로 들어간다.
+ */
+int coro_wait_fd(int fd, int events) {
+    coro_sched_t *s = self;
+    struct epoll_event ev;
+    coro_t *c;
+
+    if (!s || !s->current)
+        return -1;
+    c = s->current;
+    if (c->limit >= 0 && c->limit <= tw_now()) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    ev.events = EPOLLONESHOT;
+    if (events & POLLIN)
+        ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (events & POLLOUT)
+        ev.events |= EPOLLOUT;
+    ev.data.ptr = c;
+    if (epoll_ctl(s->epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        if (errno != ENOENT || epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            return -1;
+    }
+    c->timed_out = 0;
+    if (c->limit >= 0) {
+        c->wait_fd = fd;
+        tw_arm(&s->wheel, &c->timer, c->limit);
+    }
+    switch_to_sched();
+    if (c->timed_out) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * coro_wait_fd_timeout - coro_wait_fd 와 같되 ms 안에 준비되지 않으면
+ *     -1 (errno = ETIMEDOUT).
+ */
+int coro_wait_fd_timeout(int fd, int events, int ms) {
+    coro_sched_t *s = self;
+    coro_t *c;
+    long long saved, at = tw_now() + ms;
+    int rc;
+
+    if (!s || !s->current)
+        return -1;
+    c = s->current;
+    saved = c->limit;
+    if (saved < 0 || at < saved)
+        c->limit = at;
+    rc = coro_wait_fd(fd, events);
+    c->limit = saved;
+    return rc;
+}
+
+/*
+ * coro_deadline - 지금부터 ms 뒤를 현재 코루틴의 대기 마감으로 건다 (ms < 0 이면
+ *     푼다). 그 뒤로 마감을 넘기는 coro_wait_fd 는 ETIMEDOUT 으로 끝나므로
+ *     rio_wait_hook 을 거치는 Rio 호출도 -1 을 돌려준다.
+ */
+void coro_deadline(int ms) {
+    coro_sched_t *s = self;
+
+    if (s && s->current)
+        s->current->limit = ms < 0 ? -1 : tw_now() + ms;
+}
+
+/* 지금 코루틴 안에서 실행 중인가 */
+int coro_active(void) {
+    return self && self->current;
+}
@@ -0,0 +1,38 @@
+/*
+ * coro.h - 스레드당 스케줄러 하나를 두는 코루틴(green thread) 런타임
+ *
+ * 코루틴 안에서는 논블로킹 fd 에 대한 Rio 함수와 open_clientfd 가 EAGAIN 을
+ * 만나면 rio_wait_hook 을 통해 coro_wait_fd() 로 들어와 스케줄러에 양보한다.
+ * 그래서 doit() 처럼 위에서 아래로 읽히는 블로킹 스타일 코드를 그대로
+ * 수천~수만 개 동시에 돌릴 수 있다.
+ */
+#ifndef __CORO_H__
+#define __CORO_H__
+
+/*
+ * 코루틴 스택 크기 (가드 페이지 별도). MAP_NORESERVE 로 잡으므로 실제로
+ * 닿은 페이지만 메모리를 쓴다. 요청은 힙의 request_t 에, Rio 버퍼는 rbuf
+ * 목록에 있지만 fetch_origin 의 line/head (8 KB 씩) 와 copy_body 의 buf 가
+ * 스택에 있어서, 재어 보면 (tests/corostack.py) 가장 깊은 경로인 요청 본문
+ * 흘려 보내기 (doit -> fetch_origin -> send_body -> copy_body) 가 38 KB,
+ * 보통 miss 가 34 KB 쯤이다. 이 크기는 그 위로 여유를 둔 것.
+ */
+#define CORO_STACK_SIZE (64 * 1024)
+
+typedef void coro_fn(void *arg);
+typedef struct coro_sched coro_sched_t;
+
+coro_sched_t *coro_sched_create(void);
+void coro_sched_run(coro_sched_t *s);
+void coro_post(coro_sched_t *s, coro_fn *fn, void **args, int n);
+void coro_spawn(coro_fn *fn, void *arg);
+void coro_yield(void);
+int coro_wait_fd(int fd, int events);
+int coro_wait_fd_timeout(int fd, int events, int ms);
+void coro_deadline(int ms);
+int coro_active(void);
+#ifdef CORO_STACK_CHECK
+size_t coro_stack_peak(void);
+#endif
+
+#endif /* __CORO_H__ */
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
@@ -28,6 +29,8 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <sys/uio.h>
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
 /* $begin createmasks */
@@ -47,7 +50,10 @@ typedef struct {
     int rio_fd;                /* Descriptor for this internal buf */
     int rio_cnt;               /* Unread bytes in internal buf */
     char *rio_bufptr;          /* Next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+    char *rio_buf;             /* Internal buffer (rio_ibuf or caller's) */
+    size_t rio_size;           /* Size of rio_buf */
+    char rio_ibuf[RIO_BUFSIZE]; /* Default buffer - last, so a heap rio_t can
+                                  carry a caller-sized buffer in its place */
 } rio_t;
 /* $end rio_t */
 
@@ -61,6 +67,8 @@ extern char **environ; /* Defined by libc */
 #define LISTENQ  1024  /* Second argument to listen() */
 
 /* Our own error-handling functions */
+/* glibc declares an unrelated gai_error() (getaddrinfo_a) under _GNU_SOURCE */
+#define gai_error csapp_gai_error
 void unix_error(char *msg);
 void posix_error(int code, char *msg);
 void dns_error(char *msg);
@@ -173,12 +181,28 @@ void P(sem_t *sem);
 void V(sem_t *sem);
 
 /* Rio (Robust I/O) package */
+
+/*
+ * Optional per-thread hook called when a non-blocking descriptor would
+ * block (EAGAIN). events is POLLIN or POLLOUT. Return 0 once the descriptor
+ * may be ready (the operation is retried), or -1 to fail it.
+ */
+typedef int rio_wait_fn(int fd, int events);
+extern __thread rio_wait_fn *rio_wait_hook;
+
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt, int flags);
 void rio_readinitb(rio_t *rp, int fd); 
+void rio_readinitb_buf(rio_t *rp, int fd, char *buf, size_t size);
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 
+/* Non-blocking Rio: never waits or exits, resumes from *done after EAGAIN */
+ssize_t rio_writen_nb(int fd, void *usrbuf, size_t n, size_t *done);
+ssize_t rio_readnb_nb(rio_t *rp, void *usrbuf, size_t n, size_t *done);
+ssize_t rio_readlineb_nb(rio_t *rp, void *usrbuf, size_t maxlen, size_t *done);
+
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
 void Rio_writen(int fd, void *usrbuf, size_t n);
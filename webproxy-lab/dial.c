@@ -0,0 +1,313 @@
+/*
+ * dial.c - origin 연결
+ *
+ * open_clientfd 는 주소를 하나씩 블로킹 connect 로 시도하므로 응답 없는
+ * IPv6 주소 하나가 커널 SYN 재전송이 끝날 때까지 (수 분) 워커를 붙잡는다.
+ * 여기서는 RFC 8305 (Happy Eyeballs v2) 처럼 주소를 IPv6/IPv4 번갈아 늘어놓고
+ * 논블로킹 connect 를 DIAL_STAGGER_MS 간격으로 겹쳐 걸어서 먼저 붙는 소켓을
+ * 쓴다. 시도마다 시간 제한 (기본 DIAL_ATTEMPT_MS) 이 있고, 시도가 실패하면 다음 주소는
+ * 기다리지 않고 바로 건다.
+ *
+ * 진행 중인 시도들은 dial 한 번마다 만드는 epoll 에 모아 두고 그 epoll fd 하나만
+ * 기다린다. 워커 스레드는 poll 로, 코루틴은 coro_wait_fd_timeout 으로.
+ */
+#define _GNU_SOURCE
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "csapp.h"
+#include "coro.h"
+#include "dns.h"
+#include "dial.h"
+
+#define STATS_BUCKETS 256
+#define STATS_MAX 1024         /* 이보다 많은 origin 은 통계를 남기지 않는다 */
+
+typedef struct {
+    int fd;
+    int idx;                   /* order[] 에서 몇 번째 주소인가 */
+    long long deadline;
+} attempt_t;
+
+typedef struct ostats {
+    char *key;                 /* "host:port" */
+    unsigned hash;
+    dial_stats_t st;
+    struct ostats *next;
+} ostats_t;
+
+static ostats_t *buckets[STATS_BUCKETS];
+static int nstats;
+static int attempt_ms = DIAL_ATTEMPT_MS;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static unsigned key_hash(const char *key) {
+    unsigned h = 5381;
+
+    while (*key)
+        h = h * 33 + tolower((unsigned char)*key++);
+    return h;
+}
+
+/* lock 안에서 호출. create 면 없을 때 만든다 (한도를 넘으면 NULL) */
+static ostats_t *stats_find(const char *host, const char *port, int create) {
+    char key[MAXLINE];
+    unsigned h;
+    ostats_t *os;
+
+    snprintf(key, sizeof(key), "%s:%s", host, port);
+    h = key_hash(key);
+    for (os = buckets[h % STATS_BUCKETS]; os; os = os->next)
+        if (os->hash == h && !strcasecmp(os->key, key))
+            return os;
+    if (!create || nstats >= STATS_MAX)
+        return NULL;
+
+    os = Calloc(1, sizeof(ostats_t));
+    os->key = Malloc(strlen(key) + 1);
+    strcpy(os->key, key);
+    os->hash = h;
+    os->next = buckets[h % STATS_BUCKETS];
+    buckets[h % STATS_BUCKETS] = os;
+    nstats++;
+    return os;
+}
+
+/* ms < 0 이면 실패 */
+static void stats_record(const char *host, const char *port, long long ms, int timeouts,
+                         int fallback) {
+    ostats_t *os;
+
+    pthread_mutex_lock(&lock);
+    if ((os = stats_find(host, port, 1)) != NULL) {
+        os->st.timeouts += timeouts;
+        if (ms < 0) {
+            os->st.fail++;
+        } else {
+            os->st.ok++;
+            os->st.fallbacks += fallback;
+            os->st.total_ms += ms;
+            os->st.last_ms = ms;
+            if (ms > os->st.max_ms)
+                os->st.max_ms = ms;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * 첫 주소의 주소족부터 시작해서 두 주소족을 번갈아 늘어놓는다 (RFC 8305 4절).
+ * 같은 주소족 안에서는 getaddrinfo (RFC 6724) 순서를 지킨다.
+ */
+static int interleave(const dns_result_t *res, int *order) {
+    int first[DNS_MAXADDR], other[DNS_MAXADDR], nf = 0, no = 0, n = 0;
+
+    for (int i = 0; i < res->naddrs; i++) {
+        if (res->addrs[i].ss_family == res->addrs[0].ss_family)
+            first[nf++] = i;
+        else
+            other[no++] = i;
+    }
+    for (int i = 0; i < nf || i < no; i++) {
+        if (i < nf)
+            order[n++] = first[i];
+        if (i < no)
+            order[n++] = other[i];
+    }
+    return n;
+}
+
+/* 논블로킹 connect 를 건다. 바로 붙으면 1, 진행 중이면 0, 실패하면 -1 */
+static int start_connect(const dns_result_t *res, int i, int *fdp) {
+    int fd;
+
+    if ((fd = socket(res->addrs[i].ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    *fdp = fd;
+    if (connect(fd, (struct sockaddr *)&res->addrs[i], res->addrlens[i]) == 0)
+        return 1;
+    if (errno == EINPROGRESS)
+        return 0;
+    Close(fd);
+    return -1;
+}
+
+/* epfd 가 준비되거나 ms 가 지날 때까지 */
+static void wait_ready(int epfd, long long ms) {
+    struct pollfd pfd;
+
+    if (coro_active()) {
+        coro_wait_fd_timeout(epfd, POLLIN, (int)ms);
+        return;
+    }
+    pfd.fd = epfd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, (int)ms);
+}
+
+/* 주소 하나에 대한 connect 시간 제한을 바꾼다 */
+void dial_init(int ms) {
+    attempt_ms = ms;
+}
+
+/*
+ * dial - host:port 에 연결한 소켓을 돌려준다. 실패하면 -1.
+ *     코루틴 안에서는 논블로킹 소켓을, 워커 스레드에서는 블로킹 소켓을 준다
+ *     (open_clientfd 와 같은 규칙).
+ */
+int dial(const char *host, const char *port) {
+    dns_result_t res;
+    attempt_t act[DNS_MAXADDR];
+    struct epoll_event ev, evs[DNS_MAXADDR];
+    int order[DNS_MAXADDR], n, next = 0, nact = 0, won = -1, timeouts = 0;
+    int epfd, fd = -1, rc, nev, err;
+    long long start = now_ms(), now, next_at, wait;
+    socklen_t len;
+
+    if (dns_resolve(host, port, &res) < 0) {
+        stats_record(host, port, -1, 0, 0);
+        return -1;
+    }
+    n = interleave(&res, order);
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        /* fd 가 모자라면 (EMFILE 등) 연결 실패와 같게 이 요청만 실패한다 */
+        stats_record(host, port, -1, 0, 0);
+        return -1;
+    }
+
+    next_at = start;
+    while (won < 0 && (next < n || nact > 0)) {
+        now = now_ms();
+
+        /* 다음 주소 차례 - 진행 중인 시도가 없으면 기다리지 않고 바로 */
+        if (next < n && (now >= next_at || nact == 0)) {
+            rc = start_connect(&res, order[next], &fd);
+            if (rc > 0) {
+                won = next;
+                break;
+            }
+            if (rc == 0) {
+                ev.events = EPOLLOUT;
+                ev.data.fd = fd;
+                if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                    Close(fd);               /* 기다릴 수 없으니 이 주소는 실패 */
+                } else {
+                    act[nact].fd = fd;
+                    act[nact].idx = next;
+                    act[nact++].deadline = now + attempt_ms;
+                }
+            }
+            fd = -1;
+            next++;
+            next_at = now + DIAL_STAGGER_MS;
+            continue;
+        }
+
+        /* 다음 주소 차례와 가장 이른 시도 만료 중 빠른 쪽까지 기다린다 */
+        wait = (next < n) ? next_at - now : attempt_ms;
+        for (int i = 0; i < nact; i++)
+            if (act[i].deadline - now < wait)
+                wait = act[i].deadline - now;
+        if (wait > 0)
+            wait_ready(epfd, wait);
+
+        nev = epoll_wait(epfd, evs, DNS_MAXADDR, 0);
+        now = now_ms();
+        for (int i = 0; i < nact; i++) {
+            int ready = 0;
+
+            for (int j = 0; j < nev; j++)
+                ready |= (evs[j].data.fd == act[i].fd);
+            if (ready) {
+                len = sizeof(err);
+                if (getsockopt(act[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+                    fd = act[i].fd;
+                    won = act[i].idx;
+                } else {
+                    next_at = now;           /* 실패했으니 다음 주소를 바로 */
+                    Close(act[i].fd);
+                }
+            } else if (act[i].deadline <= now) {
+                timeouts++;
+                next_at = now;
+                Close(act[i].fd);
+            } else {
+                continue;
+            }
+            act[i--] = act[--nact];
+            if (won >= 0)
+                break;
+        }
+    }
+
+    /* 진 시도들을 정리한다 */
+    for (int i = 0; i < nact; i++)
+        Close(act[i].fd);
+    Close(epfd);
+
+    if (won < 0) {
+        stats_record(host, port, -1, timeouts, 0);
+        return -1;
+    }
+    if (!coro_active())
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    stats_record(host, port, now_ms() - start, timeouts, won > 0);
+    return fd;
+}
+
+/* 응답 첫 줄까지 걸린 시간을 남긴다 (최근 값에 1/8 무게) */
+void dial_record_ttfb(const char *host, const char *port, long long ms) {
+    ostats_t *os;
+
+    pthread_mutex_lock(&lock);
+    if ((os = stats_find(host, port, 1)) != NULL)
+        os->st.ttfb_ms = os->st.ttfb_ms ? (os->st.ttfb_ms * 7 + ms) / 8 : ms;
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * dial_slow - 느린 origin 인가. 평균 연결 지연이나 첫 바이트 지연이 ms 를
+ *     넘으면 1. 기록이 없으면 0 (처음 보는 origin 은 느리다고 보지 않는다).
+ */
+int dial_slow(const char *host, const char *port, long long ms) {
+    dial_stats_t st;
+
+    if (dial_stats(host, port, &st) < 0)
+        return 0;
+    return st.ttfb_ms > ms || (st.ok && st.total_ms / (long long)st.ok > ms) ||
+           (!st.ok && st.timeouts);
+}
+
+/* host:port 의 연결 통계를 out 에 복사한다. 기록이 없으면 -1 */
+int dial_stats(const char *host, const char *port, dial_stats_t *out) {
+    ostats_t *os;
+
+    pthread_mutex_lock(&lock);
+    if ((os = stats_find(host, port, 0)) != NULL)
+        *out = os->st;
+    pthread_mutex_unlock(&lock);
+    return os ? 0 : -1;
+}
+
+/* origin 별 연결 통계를 한 줄씩 출력한다 */
+void dial_stats_dump(FILE *fp) {
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        for (ostats_t *os = buckets[i]; os; os = os->next) {
+            fprintf(fp, "connect %s ok=%lu fail=%lu timeouts=%lu fallbacks=%lu "
+                    "avg=%lldms max=%lldms last=%lldms ttfb=%lldms\n",
+                    os->key, os->st.ok, os->st.fail, os->st.timeouts, os->st.fallbacks,
+                    os->st.ok ? os->st.total_ms / (long long)os->st.ok : 0,
+                    os->st.max_ms, os->st.last_ms, os->st.ttfb_ms);
+        }
+    }
+    fflush(fp);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,31 @@
+/*
+ * dial.h - origin 연결 (Happy Eyeballs 주소 경주, 시도별 시간 제한)과
+ *     origin 별 연결 지연 통계
+ */
+#ifndef __DIAL_H__
+#define __DIAL_H__
+
+#include <stdio.h>
+
+#define DIAL_ATTEMPT_MS 3000   /* 주소 하나에 대한 connect 시간 제한 */
+#define DIAL_STAGGER_MS 250    /* 다음 주소를 시도하기 전 기다리는 시간 (RFC 8305) */
+
+typedef struct {
+    unsigned long ok;          /* 연결 성공 */
+    unsigned long fail;        /* 모든 주소가 실패 */
+    unsigned long timeouts;    /* 시간 제한에 걸린 시도 */
+    unsigned long fallbacks;   /* 첫 주소가 아닌 주소로 연결된 횟수 */
+    long long total_ms;        /* 성공한 연결의 지연 합 (평균 = total_ms / ok) */
+    long long max_ms;
+    long long last_ms;
+    long long ttfb_ms;         /* 요청부터 응답 첫 줄까지 (지수 이동 평균, 0 = 기록 없음) */
+} dial_stats_t;
+
+void dial_init(int attempt_ms);
+int dial(const char *host, const char *port);
+int dial_stats(const char *host, const char *port, dial_stats_t *out);
+void dial_record_ttfb(const char *host, const char *port, long long ms);
+int dial_slow(const char *host, const char *port, long long ms);
+void dial_stats_dump(FILE *fp);
+
+#endif /* __DIAL_H__ */
@@ -0,0 +1,390 @@
+/*
+ * dns.c - TTL 을 지키는 resolver 캐시
+ *
+ * 이름 풀이는 resolver 스레드 풀이 한다. 주소 목록은 getaddrinfo 로 얻고
+ * (/etc/hosts, nsswitch 설정을 그대로 따른다), getaddrinfo 는 TTL 을 알려 주지
+ * 않으므로 처음 풀 때는 일단 DNS_DEFAULT_TTL 로 결과를 내놓고 기다리던 쪽을
+ * 깨운 다음, 같은 이름의 A (없으면 AAAA) 질의 응답에 실린 TTL 중 가장 작은
+ * 값으로 만료 시각을 고쳐 두고 그 TTL 을 항목에 기억한다. 만료된 항목은 지우지
+ * 않고 다시 풀며, 주소가 전과 같으면 기억한 TTL 을 그대로 써서 TTL 질의를 또
+ * 보내지 않는다 - 이름 하나에 getaddrinfo 만 TTL 마다 한 번. 주소가 바뀌었으면
+ * (옮기는 중일 수 있으니) TTL 을 다시 묻는다. DNS 에서 TTL 을 못 얻는 이름
+ * (/etc/hosts 등) 은 기본값 그대로. 실패한 이름도 DNS_NEG_TTL 동안 기억해서 같은
+ * 실패를 반복해 묻지 않는다.
+ *
+ * 같은 이름을 동시에 찾으면 질의는 한 번만 나가고 나머지는 기다린다. 기다리는
+ * 쪽은 각자 eventfd 를 하나 만들어 걸어 두고, 결과가 나오면 resolver 스레드가
+ * 결과를 복사해 준 뒤 eventfd 를 울린다. 그래서 워커 스레드는 poll 로,
+ * 코루틴은 스케줄러를 막지 않고 기다릴 수 있다. resolver 가 DNS_WAIT_MS 안에
+ * 답하지 않으면 기다리던 쪽은 목록에서 빠져 그 요청만 실패한다.
+ */
+#include "dns.h"
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+#include "coro.h"
+
+#define DNS_BUCKETS 256
+#define DNS_CACHE_MAX 1024     /* 이보다 많아지면 만료된 것부터 지운다 */
+#define DNS_DEFAULT_TTL 60     /* TTL 을 알기 전, 또는 알 수 없을 때 (초) */
+#define DNS_MIN_TTL 1
+#define DNS_MAX_TTL 3600
+#define DNS_NEG_TTL 5          /* 실패한 이름을 기억하는 시간 (초) */
+#define DNS_WAIT_MS 10000      /* 결과를 기다리는 최대 시간 (glibc 기본 5초 x 2번) */
+
+#define DNS_PENDING 0
+#define DNS_OK      1
+#define DNS_FAIL    2
+
+typedef struct dns_waiter {
+    int efd;
+    int status;
+    dns_result_t *res;
+    struct dns_waiter *next;
+} dns_waiter_t;
+
+typedef struct dns_entry {
+    char *host;
+    unsigned hash;
+    int state;
+    long long expires;         /* ms, CLOCK_MONOTONIC */
+    int ttl;                   /* DNS 가 알려 준 TTL (초), 모르면 0 */
+    dns_result_t res;
+    dns_waiter_t *waiters;     /* DNS_PENDING 동안 기다리는 쪽 */
+    struct dns_entry *next;    /* 해시 버킷 체인 */
+    struct dns_entry *qnext;   /* resolver 작업 큐 */
+} dns_entry_t;
+
+static dns_entry_t *buckets[DNS_BUCKETS];
+static int nentries;
+static dns_entry_t *queue_head, *queue_tail;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static long long now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static unsigned name_hash(const char *s) {
+    unsigned h = 5381;
+
+    while (*s)
+        h = h * 33 + tolower((unsigned char)*s++);
+    return h;
+}
+
+static dns_entry_t *entry_find(const char *host, unsigned h) {
+    dns_entry_t *e;
+
+    for (e = buckets[h % DNS_BUCKETS]; e; e = e->next)
+        if (e->hash == h && !strcasecmp(e->host, host))
+            return e;
+    return NULL;
+}
+
+static void entry_remove(dns_entry_t *e) {
+    dns_entry_t **pp = &buckets[e->hash % DNS_BUCKETS];
+
+    while (*pp != e)
+        pp = &(*pp)->next;
+    *pp = e->next;
+    nentries--;
+    Free(e->host);
+    Free(e);
+}
+
+/* 캐시가 넘치면 만료된 것을, 그래도 넘치면 아무 완료된 항목이나 지운다 */
+static void cache_trim(long long now) {
+    for (int pass = 0; pass < 2 && nentries >= DNS_CACHE_MAX; pass++) {
+        for (int i = 0; i < DNS_BUCKETS; i++) {
+            dns_entry_t *e = buckets[i], *next;
+
+            for (; e; e = next) {
+                next = e->next;
+                if (e->state != DNS_PENDING && (pass == 1 || e->expires <= now))
+                    entry_remove(e);
+            }
+        }
+    }
+}
+
+/* 응답의 answer 레코드 TTL 중 최솟값 (CNAME 포함), 실패면 -1 */
+static int query_ttl(res_state rs, const char *host, int type) {
+    unsigned char ans[NS_PACKETSZ * 4];
+    ns_msg msg;
+    ns_rr rr;
+    int len, ttl = -1;
+
+    if ((len = res_nquery(rs, host, ns_c_in, type, ans, sizeof(ans))) < 0)
+        return -1;
+    if (ns_initparse(ans, len, &msg) < 0)
+        return -1;
+    for (int i = 0; i < ns_msg_count(msg, ns_s_an); i++) {
+        if (ns_parserr(&msg, ns_s_an, i, &rr) < 0)
+            break;
+        if (ttl < 0 || (int)ns_rr_ttl(rr) < ttl)
+            ttl = ns_rr_ttl(rr);
+    }
+    return ttl;
+}
+
+/* 이름 하나를 풀어 res 에 채운다 (lock 밖에서). DNS_OK 또는 DNS_FAIL */
+static int resolve(const char *host, dns_result_t *res) {
+    struct addrinfo hints, *listp, *p;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    res->naddrs = 0;
+    if (getaddrinfo(host, NULL, &hints, &listp) != 0)
+        return DNS_FAIL;
+    for (p = listp; p && res->naddrs < DNS_MAXADDR; p = p->ai_next) {
+        memcpy(&res->addrs[res->naddrs], p->ai_addr, p->ai_addrlen);
+        res->addrlens[res->naddrs++] = p->ai_addrlen;
+    }
+    freeaddrinfo(listp);
+    return DNS_OK;
+}
+
+/* 두 결과의 주소 목록이 (순서까지) 같은가 */
+static int same_addrs(const dns_result_t *a, const dns_result_t *b) {
+    if (a->naddrs != b->naddrs)
+        return 0;
+    for (int i = 0; i < a->naddrs; i++)
+        if (a->addrlens[i] != b->addrlens[i] || memcmp(&a->addrs[i], &b->addrs[i], a->addrlens[i]))
+            return 0;
+    return 1;
+}
+
+/* 풀린 이름의 만료 시각을 DNS 가 알려 준 TTL 로 고친다 (lock 밖에서) */
+static void refresh_ttl(res_state rs, const char *host, const dns_result_t *res) {
+    dns_entry_t *e;
+    int ttl, has4 = 0;
+
+    for (int i = 0; i < res->naddrs; i++)
+        has4 |= (res->addrs[i].ss_family == AF_INET);
+    if ((ttl = query_ttl(rs, host, has4 ? ns_t_a : ns_t_aaaa)) < 0)
+        return;
+    if (ttl < DNS_MIN_TTL)
+        ttl = DNS_MIN_TTL;
+    if (ttl > DNS_MAX_TTL)
+        ttl = DNS_MAX_TTL;
+
+    /* 그 사이 항목이 지워졌거나 새로 묻는 중일 수 있으니 다시 찾는다 */
+    pthread_mutex_lock(&lock);
+    if ((e = entry_find(host, name_hash(host))) && e->state == DNS_OK) {
+        e->ttl = ttl;
+        e->expires = now_ms() + ttl * 1000LL;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* resolver 스레드 - 큐에서 이름을 꺼내 풀고 기다리던 쪽을 모두 깨운다 */
+static void *resolver_thread(void *vargp) {
+    struct __res_state rs;
+    dns_entry_t *e;
+    dns_waiter_t *w, *next;
+    dns_result_t res;
+    char host[MAXLINE];
+    int state, ttl, known;
+    uint64_t one = 1;
+
+    Pthread_detach(pthread_self());
+    memset(&rs, 0, sizeof(rs));
+    res_ninit(&rs);
+    while (1) {
+        pthread_mutex_lock(&lock);
+        while (!queue_head)
+            pthread_cond_wait(&queue_cond, &lock);
+        e = queue_head;
+        if (!(queue_head = e->qnext))
+            queue_tail = NULL;
+        snprintf(host, sizeof(host), "%s", e->host);
+        pthread_mutex_unlock(&lock);
+
+        state = resolve(host, &res);
+
+        pthread_mutex_lock(&lock);
+        /* 주소가 전과 같으면 기억한 TTL 로 충분하다 */
+        if (state == DNS_OK && !(e->ttl > 0 && same_addrs(&e->res, &res)))
+            e->ttl = 0;
+        e->res = res;
+        e->state = state;
+        if (state != DNS_OK)
+            ttl = DNS_NEG_TTL;
+        else
+            ttl = e->ttl > 0 ? e->ttl : DNS_DEFAULT_TTL;
+        e->expires = now_ms() + ttl * 1000LL;
+        known = (state == DNS_OK && e->ttl > 0);
+        w = e->waiters;
+        e->waiters = NULL;
+        for (; w; w = next) {
+            next = w->next;       /* 깨우고 나면 w 는 기다리던 쪽 스택에서 사라진다 */
+            w->status = state;
+            *w->res = res;
+            if (write(w->efd, &one, sizeof(one)) < 0)
+                unix_error("eventfd write error");
+        }
+        pthread_mutex_unlock(&lock);
+
+        if (state == DNS_OK && !known)
+            refresh_ttl(&rs, host, &res);
+    }
+    return NULL;
+}
+
+void dns_init(int nthreads) {
+    pthread_t tid;
+
+    for (int i = 0; i < nthreads; i++)
+        Pthread_create(&tid, NULL, resolver_thread, NULL);
+}
+
+/* resolver 작업 큐 끝에 넣는다 (lock 안에서) */
+static void enqueue(dns_entry_t *e) {
+    e->qnext = NULL;
+    if (queue_tail)
+        queue_tail->qnext = e;
+    else
+        queue_head = e;
+    queue_tail = e;
+    pthread_cond_signal(&queue_cond);
+}
+
+/*
+ * efd 가 울릴 때까지 - 코루틴이면 스케줄러에 양보하고 아니면 poll. 울렸으면 0,
+ *     ms 안에 울리지 않으면 -1.
+ */
+static int wait_efd(int efd, int ms) {
+    struct pollfd pfd;
+    uint64_t cnt;
+    long long left, until = now_ms() + ms;
+
+    while (read(efd, &cnt, sizeof(cnt)) < 0) {
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN || (left = until - now_ms()) <= 0)
+            return -1;
+        if (coro_active()) {
+            coro_wait_fd_timeout(efd, POLLIN, (int)left);
+            continue;
+        }
+        pfd.fd = efd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, (int)left);
+    }
+    return 0;
+}
+
+/*
+ * 결과를 기다리지 않기로 한 쪽을 목록에서 뺀다. 그 사이 결과를 받았으면 0 -
+ *     그때는 e 가 이미 지워졌을 수도 있으니 건드리지 않는다 (받지 못한 동안은
+ *     e 가 DNS_PENDING 이라 지워지지 않는다).
+ */
+static int waiter_cancel(dns_entry_t *e, dns_waiter_t *w) {
+    dns_waiter_t **pp;
+    int rc = 0;
+
+    pthread_mutex_lock(&lock);
+    if (w->status == DNS_PENDING) {
+        for (pp = &e->waiters; *pp != w; pp = &(*pp)->next)
+            ;
+        *pp = w->next;
+        rc = -1;
+    }
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+/* 결과의 모든 주소에 포트를 채운다 */
+static void set_port(dns_result_t *res, const char *port) {
+    unsigned short nport = htons(atoi(port));
+
+    for (int i = 0; i < res->naddrs; i++) {
+        if (res->addrs[i].ss_family == AF_INET)
+            ((struct sockaddr_in *)&res->addrs[i])->sin_port = nport;
+        else if (res->addrs[i].ss_family == AF_INET6)
+            ((struct sockaddr_in6 *)&res->addrs[i])->sin6_port = nport;
+    }
+}
+
+/*
+ * dns_resolve - host 의 주소 목록을 port 를 채워 res 에 돌려준다. 숫자 주소는
+ *     바로, 이름은 캐시에서 (없거나 만료됐으면 resolver 스레드가 풀 때까지
+ *     DNS_WAIT_MS 까지 기다린다). 성공 0, 풀 수 없는 이름이거나 시간 안에
+ *     답을 못 얻으면 -1.
+ */
+int dns_resolve(const char *host, const char *port, dns_result_t *res) {
+    struct addrinfo hints, *ai;
+    dns_entry_t *e;
+    dns_waiter_t w;
+    unsigned h;
+    long long now;
+    int status;
+
+    /* 숫자 주소는 캐시를 거치지 않는다 */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo(host, NULL, &hints, &ai) == 0) {
+        memcpy(&res->addrs[0], ai->ai_addr, ai->ai_addrlen);
+        res->addrlens[0] = ai->ai_addrlen;
+        res->naddrs = 1;
+        freeaddrinfo(ai);
+        set_port(res, port);
+        return 0;
+    }
+
+    h = name_hash(host);
+    now = now_ms();
+    pthread_mutex_lock(&lock);
+    e = entry_find(host, h);
+    if (!e) {
+        if (nentries >= DNS_CACHE_MAX)
+            cache_trim(now);
+        e = Calloc(1, sizeof(dns_entry_t));
+        e->host = Malloc(strlen(host) + 1);
+        strcpy(e->host, host);
+        e->hash = h;
+        e->state = DNS_PENDING;
+        e->next = buckets[h % DNS_BUCKETS];
+        buckets[h % DNS_BUCKETS] = e;
+        nentries++;
+        enqueue(e);
+    } else if (e->state != DNS_PENDING && e->expires <= now) {
+        /* 만료 - 지우지 않고 다시 푼다 (전의 주소와 TTL 은 비교용으로 남긴다) */
+        e->state = DNS_PENDING;
+        enqueue(e);
+    }
+
+    if (e->state == DNS_PENDING) {
+        /* 이미 누가 묻고 있으면 같은 질의를 또 보내지 않고 결과를 기다린다 */
+        if ((w.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+            pthread_mutex_unlock(&lock);
+            return -1;             /* fd 가 모자라면 (EMFILE 등) 이 요청만 실패 */
+        }
+        w.status = DNS_PENDING;
+        w.res = res;
+        w.next = e->waiters;
+        e->waiters = &w;
+        pthread_mutex_unlock(&lock);
+        if (wait_efd(w.efd, DNS_WAIT_MS) < 0 && waiter_cancel(e, &w) < 0)
+            w.status = DNS_FAIL;   /* resolver 가 답하지 않았다 */
+        Close(w.efd);
+        status = w.status;
+    } else {
+        *res = e->res;
+        status = e->state;
+        pthread_mutex_unlock(&lock);
+    }
+
+    if (status != DNS_OK || res->naddrs == 0)
+        return -1;
+    set_port(res, port);
+    return 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * dns.h - TTL 을 지키는 호스트 이름 캐시와 resolver 스레드 풀
+ */
+#ifndef __DNS_H__
+#define __DNS_H__
+
+#include "csapp.h"
+
+#define DNS_MAXADDR 8
+
+typedef struct {
+    int naddrs;
+    struct sockaddr_storage addrs[DNS_MAXADDR];
+    socklen_t addrlens[DNS_MAXADDR];
+} dns_result_t;
+
+void dns_init(int nthreads);
+int dns_resolve(const char *host, const char *port, dns_result_t *res);
+
+#endif /* __DNS_H__ */
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+#
+# hdrgen.py - hdrname.h 의 HDR_LIST 로 완전 해시 표 hdrtab.h 를 만든다
+#
+#     ./hdrgen.py > hdrtab.h
+#
+# 해시는 gperf 처럼 이름 길이와 세 자리 (첫 두 글자, 마지막 글자) 의
+# 글자값 (asso) 을 더한 것이다. 대소문자를 가리지 않도록 글자는 0x20 을
+# OR 해서 (영문자는 소문자로) 본다. 겹치는 것이 없을 때까지 asso 를 고른다.
+import random
+import re
+import sys
+
+SLOTS = 64                      # 2 의 거듭제곱 - & 로 자른다
+
+src = open(sys.argv[1] if len(sys.argv) > 1 else "hdrname.h").read()
+names = re.findall(r'X\((\w+),\s*"([^"]+)"', src)
+
+
+def keys(name):
+    return [ord(c) | 0x20 for c in (name[0], name[1], name[-1])]
+
+
+def place(asso):
+    slots = {}
+    for i, (_, name) in enumerate(names, 1):
+        h = (len(name) + sum(asso[k] for k in keys(name))) & (SLOTS - 1)
+        if h in slots:
+            return None
+        slots[h] = i
+    return slots
+
+
+rng = random.Random(15213)      # 같은 입력이면 같은 표
+used = sorted({k for _, name in names for k in keys(name)})
+while True:
+    asso = [0] * 256
+    for k in used:
+        asso[k] = rng.randrange(SLOTS)
+    slots = place(asso)
+    if slots:
+        break
+
+print("/* hdrtab.h - hdrgen.py 가 만든 것 (고치지 말 것) */")
+print("#define HDRTAB_SLOTS %d" % SLOTS)
+print("#define HDRTAB_MINLEN %d" % min(len(n) for _, n in names))
+print("#define HDRTAB_MAXLEN %d" % max(len(n) for _, n in names))
+print()
+print("static const unsigned char hdrtab_asso[256] = {")
+for r in range(0, 256, 16):
+    print("    " + ", ".join("%2d" % v for v in asso[r:r + 16]) + ",")
+print("};")
+print()
+print("static const unsigned char hdrtab_slot[HDRTAB_SLOTS] = {")
+for h in sorted(slots):
+    print("    [%d] = HDR_%s," % (h, names[slots[h] - 1][0]))
+print("};")
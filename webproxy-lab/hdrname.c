@@ -0,0 +1,49 @@
+/*
+ * hdrname.c - 헤더 이름 찾기 (완전 해시)
+ *
+ * 이름 길이와 세 글자 (첫 두 글자, 마지막 글자) 로 hdrtab.h 의 자리 하나를
+ * 골라 그 자리의 이름과 한 번만 비교한다. 아는 이름끼리는 자리가 겹치지
+ * 않으므로 (hdrgen.py 가 그렇게 고른다) 다른 자리를 더 볼 일이 없다.
+ * 글자값은 0x20 을 OR 한 글자로 찾으므로 대소문자를 가리지 않는다.
+ */
+#include <string.h>
+#include <strings.h>
+#include "hdrname.h"
+#include "hdrtab.h"
+
+#define HDR_NAME(id, name, flags) [HDR_##id] = name,
+#define HDR_LEN(id, name, flags) [HDR_##id] = sizeof(name) - 1,
+#define HDR_FLAGS(id, name, flags) [HDR_##id] = flags,
+static const char *const names[HDR_COUNT] = { HDR_LIST(HDR_NAME) };
+static const unsigned char lens[HDR_COUNT] = { HDR_LIST(HDR_LEN) };
+static const unsigned char flags[HDR_COUNT] = { HDR_LIST(HDR_FLAGS) };
+
+/* name[0..len) 의 번호 (대소문자 무시), 모르는 이름이면 HDR_OTHER */
+hdr_id_t hdr_lookup(const char *name, size_t len) {
+    const unsigned char *p = (const unsigned char *)name;
+    hdr_id_t id;
+
+    if (len < HDRTAB_MINLEN || len > HDRTAB_MAXLEN)
+        return HDR_OTHER;
+    id = hdrtab_slot[(len + hdrtab_asso[p[0] | 0x20] + hdrtab_asso[p[1] | 0x20] +
+                      hdrtab_asso[p[len - 1] | 0x20]) & (HDRTAB_SLOTS - 1)];
+    if (id != HDR_OTHER && lens[id] == len && !strncasecmp(name, names[id], len))
+        return id;
+    return HDR_OTHER;
+}
+
+/* "Name: value" 줄의 이름 번호 - ':' 가 없으면 HDR_OTHER */
+hdr_id_t hdr_line(const char *line) {
+    size_t n = strcspn(line, ":\r\n");
+
+    return line[n] == ':' ? hdr_lookup(line, n) : HDR_OTHER;
+}
+
+int hdr_flags(hdr_id_t id) {
+    return flags[id];
+}
+
+/* 번호의 정식 이름 (HDR_OTHER 면 NULL) */
+const char *hdr_name(hdr_id_t id) {
+    return names[id];
+}
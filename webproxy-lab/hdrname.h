@@ -0,0 +1,66 @@
+/*
+ * hdrname.h - 아는 헤더 이름을 번호 (hdr_id_t) 로 (httpreq, http, proxy,
+ *     proxy_cache, tiny 가 같이 쓴다)
+ *
+ * 헤더 줄마다 이름을 한 번 찾아 번호를 매겨 두면 그 뒤로는 이름을 다시
+ * 비교하지 않고 번호로 switch 한다. 찾기는 완전 해시 (hdrtab.h) 한 번과
+ * 이름 비교 한 번이다.
+ */
+#ifndef __HDRNAME_H__
+#define __HDRNAME_H__
+
+#include <stddef.h>
+
+/* 성질 - 한 헤더가 여럿을 가질 수 있다 */
+#define HDRF_HOP   1       /* 이 연결에만 해당 - 다음 홉으로 넘기지 않는다 (RFC 9110 7.6.1) */
+#define HDRF_CACHE 2       /* 캐시 저장/신선도 */
+#define HDRF_COND  4       /* 조건부 요청 */
+
+/*
+ * 아는 헤더 - X(번호 이름, 헤더 이름, 성질). 바꾸면 hdrgen.py 로 hdrtab.h 를
+ * 다시 만든다 (./hdrgen.py > hdrtab.h).
+ */
+#define HDR_LIST(X) \
+    X(HOST,                "Host",                0) \
+    X(USER_AGENT,          "User-Agent",          0) \
+    X(CONTENT_LENGTH,      "Content-Length",      0) \
+    X(CONTENT_TYPE,        "Content-Type",        0) \
+    X(EXPECT,              "Expect",              0) \
+    X(CONNECTION,          "Connection",          HDRF_HOP) \
+    X(PROXY_CONNECTION,    "Proxy-Connection",    HDRF_HOP) \
+    X(KEEP_ALIVE,          "Keep-Alive",          HDRF_HOP) \
+    X(TE,                  "TE",                  HDRF_HOP) \
+    X(TRAILER,             "Trailer",             0) \
+    X(TRANSFER_ENCODING,   "Transfer-Encoding",   HDRF_HOP) \
+    X(UPGRADE,             "Upgrade",             HDRF_HOP) \
+    X(PROXY_AUTHORIZATION, "Proxy-Authorization", HDRF_HOP) \
+    X(PROXY_AUTHENTICATE,  "Proxy-Authenticate",  HDRF_HOP) \
+    X(CACHE_CONTROL,       "Cache-Control",       HDRF_CACHE) \
+    X(PRAGMA,              "Pragma",              HDRF_CACHE) \
+    X(EXPIRES,             "Expires",             HDRF_CACHE) \
+    X(AGE,                 "Age",                 HDRF_CACHE) \
+    X(ETAG,                "ETag",                HDRF_CACHE) \
+    X(LAST_MODIFIED,       "Last-Modified",       HDRF_CACHE) \
+    X(VARY,                "Vary",                HDRF_CACHE) \
+    X(AUTHORIZATION,       "Authorization",       HDRF_CACHE) \
+    X(IF_MATCH,            "If-Match",            HDRF_COND) \
+    X(IF_NONE_MATCH,       "If-None-Match",       HDRF_COND) \
+    X(IF_MODIFIED_SINCE,   "If-Modified-Since",   HDRF_COND) \
+    X(IF_UNMODIFIED_SINCE, "If-Unmodified-Since", HDRF_COND) \
+    X(IF_RANGE,            "If-Range",            HDRF_COND) \
+    X(RANGE,               "Range",               HDRF_COND)
+
+#define HDR_ENUM(id, name, flags) HDR_##id,
+typedef enum {
+    HDR_OTHER = 0,                 /* 모르는 헤더 */
+    HDR_LIST(HDR_ENUM)
+    HDR_COUNT
+} hdr_id_t;
+#undef HDR_ENUM
+
+hdr_id_t hdr_lookup(const char *name, size_t len);
+hdr_id_t hdr_line(const char *line);
+int hdr_flags(hdr_id_t id);
+const char *hdr_name(hdr_id_t id);
+
+#endif /* __HDRNAME_H__ */
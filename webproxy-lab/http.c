@@ -0,0 +1,222 @@
+/*
+ * http.c - origin 응답 헤더 파싱
+ *
+ * 응답 한 줄씩 넘겨받아 http_resp_t 를 채운다. 줄을 버퍼에 모으거나 다시
+ * 쓰지 않으므로 호출한 쪽은 읽은 줄을 그대로 클라이언트에 릴레이하면 된다.
+ */
+#include "csapp.h"
+#include "http.h"
+#include "hdrname.h"
+
+/* 헤더 줄의 값의 시작 (':' 뒤 공백 건너뜀) - hdr_line 이 이름을 알아본 줄만 */
+static const char *header_value(const char *line) {
+    line = strchr(line, ':') + 1;
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return line;
+}
+
+/* 쉼표로 나뉜 토큰 목록 value 안에 token 이 있는가 (대소문자 무시) */
+static int has_token(const char *value, const char *token) {
+    size_t len = strlen(token);
+
+    while (*value) {
+        while (*value == ' ' || *value == '\t' || *value == ',')
+            value++;
+        if (!strncasecmp(value, token, len) &&
+            (value[len] == '\0' || value[len] == ',' || value[len] == ' ' ||
+             value[len] == '\t' || value[len] == '\r' || value[len] == '\n'))
+            return 1;
+        while (*value && *value != ',')
+            value++;
+    }
+    return 0;
+}
+
+/*
+ * content_length - Content-Length 값 (숫자만, 뒤에 공백과 줄 끝). 부호, 다른
+ *     글자, 18 자리를 넘는 값 (넘침) 은 -1 - 요청 쪽 (proxy_cache 의 rq_length)
+ *     과 같은 규칙.
+ */
+static long long content_length(const char *v) {
+    long long len = 0;
+    int n = 0;
+
+    for (; isdigit((unsigned char)*v); v++, n++) {
+        if (n == 18)
+            return -1;
+        len = len * 10 + (*v - '0');
+    }
+    while (*v == ' ' || *v == '\t')
+        v++;
+    if (n == 0 || (*v != '\0' && strcmp(v, "\r\n") && strcmp(v, "\n")))
+        return -1;
+    return len;
+}
+
+/*
+ * http_parse_status_line - "HTTP/1.x SSS ..." 를 읽고 resp 를 초기화한다.
+ *     이유 문구는 line 안의 자리로 남긴다. 형식이 틀리면 -1.
+ */
+int http_parse_status_line(const char *line, http_resp_t *resp) {
+    int major, minor, status, end = 0;
+
+    if (sscanf(line, "HTTP/%d.%d %d%n", &major, &minor, &status, &end) != 3 || major != 1)
+        return -1;
+    resp->version = (minor >= 1) ? 11 : 10;
+    resp->status = status;
+    while (line[end] == ' ' || line[end] == '\t')
+        end++;
+    resp->reason = end;
+    resp->reason_len = strcspn(line + end, "\r\n");
+    resp->content_length = -1;
+    resp->chunked = 0;
+    resp->close = (resp->version == 10);   /* 1.0 은 keep-alive 를 밝혀야 유지 */
+    resp->no_store = 0;
+    resp->bad = 0;
+    resp->content_type[0] = '\0';
+    return 0;
+}
+
+/* 헤더 한 줄 ("Name: value\r\n") 을 반영한다. 모르는 헤더는 무시 */
+void http_parse_resp_header(const char *line, http_resp_t *resp) {
+    hdr_id_t id = hdr_line(line);
+    const char *v;
+    long long len;
+    size_t n;
+
+    if (id == HDR_OTHER)
+        return;
+    v = header_value(line);
+    switch (id) {
+    case HDR_CONTENT_LENGTH:
+        /* 틀린 값이나 서로 다른 중복은 응답 밀반입/캐시 오염의 통로 - 응답을 버린다 */
+        len = content_length(v);
+        if (len < 0 || (resp->content_length >= 0 && len != resp->content_length)) {
+            resp->bad = 1;
+            resp->close = 1;
+        } else {
+            resp->content_length = len;
+        }
+        break;
+    case HDR_TRANSFER_ENCODING:
+        if (has_token(v, "chunked"))
+            resp->chunked = 1;
+        break;
+    case HDR_CONNECTION:
+        if (has_token(v, "close"))
+            resp->close = 1;
+        else if (has_token(v, "keep-alive"))
+            resp->close = 0;
+        break;
+    case HDR_CONTENT_TYPE:
+        n = strcspn(v, "\r\n");
+        if (n >= sizeof(resp->content_type))
+            n = sizeof(resp->content_type) - 1;
+        memcpy(resp->content_type, v, n);
+        resp->content_type[n] = '\0';
+        break;
+    case HDR_CACHE_CONTROL:
+        /* 재검증 없이 내주는 캐시라 no-cache 와 max-age=0 도 저장하지 않는다 */
+        if (has_token(v, "no-store") || has_token(v, "private") ||
+            has_token(v, "no-cache") || has_token(v, "max-age=0"))
+            resp->no_store = 1;
+        break;
+    case HDR_PRAGMA:
+        if (has_token(v, "no-cache"))
+            resp->no_store = 1;
+        break;
+    default:
+        break;
+    }
+}
+
+/* 헤더를 다 읽은 뒤 - 본문 길이 규칙 (RFC 7230 3.3.3) 을 적용한다 */
+void http_resp_finish(http_resp_t *resp) {
+    if (resp->status == 204 || resp->status == 304 ||
+        (resp->status >= 100 && resp->status < 200)) {
+        resp->content_length = 0;   /* 본문 없는 응답 */
+        resp->chunked = 0;
+    } else if (resp->chunked) {
+        resp->content_length = -1;  /* chunked 가 Content-Length 보다 우선 */
+    } else if (resp->content_length < 0) {
+        resp->close = 1;            /* EOF 까지가 본문 - 재사용 불가 */
+    }
+}
+
+/* 본문을 끝까지 읽고 나면 연결을 다시 쓸 수 있는 응답인가 */
+int http_resp_reusable(const http_resp_t *resp) {
+    return !resp->close && (resp->chunked || resp->content_length >= 0);
+}
+
+/*
+ * http_parse_head - buf 에 통째로 있는 응답 머리 (상태 줄부터 빈 줄까지) 를
+ *     해석하고 http_resp_finish 까지 한다. 머리 길이, 머리가 끝나지 않았거나
+ *     상태 줄을 알아볼 수 없으면 -1.
+ */
+ssize_t http_parse_head(const char *buf, size_t len, http_resp_t *resp) {
+    char line[MAXLINE];
+    const char *p = buf, *end = buf + len, *nl;
+    size_t n;
+
+    while ((nl = memchr(p, '\n', end - p)) != NULL) {
+        n = nl - p + 1;
+        if (n >= MAXLINE)
+            return -1;
+        memcpy(line, p, n);      /* http_* 는 NUL 로 끝나는 줄을 본다 */
+        line[n] = '\0';
+        if (p == buf) {
+            if (http_parse_status_line(line, resp) < 0)
+                return -1;
+        } else if (!strcmp(line, "\r\n")) {
+            http_resp_finish(resp);
+            return nl + 1 - buf;
+        } else {
+            http_parse_resp_header(line, resp);
+        }
+        p = nl + 1;
+    }
+    return -1;
+}
+
+/*
+ * http_resp_cacheable - 헤더를 다 읽은 응답을 캐시에 넣어도 되는가. 200 이고
+ *     캐시 지시자가 막지 않고, 길이를 알면 머리 (head 바이트) 와 본문을 합쳐
+ *     limit 안이어야 한다. 길이를 모르면 일단 모으고 넘치면 그때 버린다.
+ */
+int http_resp_cacheable(const http_resp_t *resp, size_t head, size_t limit) {
+    if (resp->status != 200 || resp->no_store || resp->bad)
+        return 0;
+    return resp->content_length < 0 || head + resp->content_length <= limit;
+}
+
+/*
+ * http_hop_header - 이 연결에만 해당하는 헤더 (Connection 계열, Upgrade 등) 인가.
+ *     프록시는 이런 헤더를 다음 홉으로 넘기지 않고 자기 것을 새로 붙인다.
+ *     Transfer-Encoding 은 본문을 어떻게 넘기느냐에 달려 있어 따로 본다.
+ */
+int http_hop_header(const char *line) {
+    hdr_id_t id = hdr_line(line);
+
+    return (hdr_flags(id) & HDRF_HOP) && id != HDR_TRANSFER_ENCODING;
+}
+
+/* Transfer-Encoding 줄인가 - 본문을 풀거나 다시 감쌀 때 프록시가 새로 정한다 */
+int http_te_header(const char *line) {
+    return hdr_line(line) == HDR_TRANSFER_ENCODING;
+}
+
+/* Connection/Proxy-Connection 헤더면 keep-alive 1, close 0, 그 밖의 줄은 -1 */
+int http_conn_token(const char *line) {
+    hdr_id_t id = hdr_line(line);
+    const char *v;
+
+    if (id != HDR_CONNECTION && id != HDR_PROXY_CONNECTION)
+        return -1;
+    v = header_value(line);
+    if (has_token(v, "close"))
+        return 0;
+    if (has_token(v, "keep-alive"))
+        return 1;
+    return -1;
+}
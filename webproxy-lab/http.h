@@ -0,0 +1,34 @@
+/*
+ * http.h - origin 응답 헤더에서 프레이밍 정보(상태, 본문 길이, chunked,
+ *     연결 유지 여부)와 캐시 판단에 쓰는 정보(Content-Type, 캐시 지시자)를
+ *     뽑아내는 도우미
+ */
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct {
+    int version;                /* 10 = HTTP/1.0, 11 = HTTP/1.1 */
+    int status;
+    int reason, reason_len;     /* 상태 줄 안에서 이유 문구의 자리와 길이 (줄 끝 제외) */
+    long long content_length;   /* -1: 길이 모름 (chunked 이거나 EOF 까지) */
+    int chunked;
+    int close;                  /* 응답 뒤 origin 이 연결을 닫는다 */
+    int no_store;               /* no-store, private, no-cache, max-age=0 - 캐시하지 않는다 */
+    int bad;                    /* Content-Length 가 숫자가 아니거나 서로 다르다 - 경계를 믿을 수 없다 */
+    char content_type[64];      /* 없으면 "" (길면 잘린다 - 기록용) */
+} http_resp_t;
+
+int http_parse_status_line(const char *line, http_resp_t *resp);
+void http_parse_resp_header(const char *line, http_resp_t *resp);
+void http_resp_finish(http_resp_t *resp);
+ssize_t http_parse_head(const char *buf, size_t len, http_resp_t *resp);
+int http_resp_reusable(const http_resp_t *resp);
+int http_resp_cacheable(const http_resp_t *resp, size_t head, size_t limit);
+int http_hop_header(const char *line);
+int http_te_header(const char *line);
+int http_conn_token(const char *line);
+
+#endif /* __HTTP_H__ */
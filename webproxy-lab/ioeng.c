@@ -0,0 +1,977 @@
+/*
+ * ioeng.c - 프록시 릴레이용 단일 스레드 I/O 엔진 (io_uring / epoll)
+ *
+ * 워커 스레드는 요청을 파싱하고 origin 주소까지만 구한 뒤 릴레이 작업을
+ * ioeng_submit() 으로 넘긴다. 그 다음 connect, 요청 전송, 응답 수신,
+ * 클라이언트로의 전송은 모두 엔진 스레드 하나가 처리한다.
+ *
+ * io_uring 백엔드는 liburing 없이 시스템 콜을 직접 쓴다.
+ *   - accept : multishot accept SQE 하나로 계속 받는다
+ *   - recv   : recv + 커널에 등록한 버퍼 링(provided buffers)
+ *   - send / connect : 일반 SQE
+ * 버퍼 링은 모든 릴레이가 같이 쓰므로 릴레이 하나가 큐에 잡아 둘 수 있는
+ * 버퍼를 RELAY_QMAX 개로 제한한다. 그래서 recv 는 multishot 이 아닌 한 번짜리로
+ * 걸고, 큐가 RELAY_QMAX 아래일 때만 다시 건다 (multishot 은 취소가 처리되기
+ * 전에 링을 다 채울 수 있다). 닿은 릴레이는 클라이언트로 보내서 큐가 줄 때
+ * 다시 건다. 느린 클라이언트 하나가 링 전체를 붙잡아 다른 릴레이가 멈추는
+ * 일은 없고, 그래도 링이 바닥나면 recv 가 -ENOBUFS 로 끝나고 버퍼가 반납될
+ * 때 다시 건다.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "csapp.h"
+#include "ioeng.h"
+
+#define URING_ENTRIES 256
+#define NBUFS 256              /* 버퍼 링 크기 (2의 거듭제곱) */
+#define BUFSZ 16384            /* 버퍼 하나 크기 */
+#define BGID 0                 /* 버퍼 그룹 id */
+#define RELAY_QMAX (NBUFS / 8) /* 릴레이 하나가 큐에 잡아 둘 수 있는 버퍼 수 */
+#define EPOLL_BUFSZ 16384      /* epoll 백엔드의 릴레이당 버퍼 */
+#define ACCEPT_PENDING_MAX 64  /* 워커에 못 넘긴 fd 가 이만큼 쌓이면 accept 를 멈춘다 */
+#define RETRY_MS 5             /* 못 넘긴 fd 재시도 간격 */
+
+/* user_data 하위 3비트 태그 (relay_t 는 8바이트 정렬) */
+enum { T_NONE = 0, T_CONNECT, T_SENDREQ, T_RECV, T_SENDCLI, T_ACCEPT, T_WAKE, T_TIMEOUT };
+#define UD(p, t) ((uint64_t)(uintptr_t)(p) | (t))
+#define UD_PTR(u) ((relay_t *)(uintptr_t)((u) & ~(uint64_t)7))
+#define UD_TAG(u) ((int)((u) & 7))
+
+/* epoll 릴레이 상태 */
+enum { ST_CONNECT, ST_SENDREQ, ST_STATUS, ST_RELAY };
+
+struct relay;
+typedef struct {
+    struct relay *r;
+    int side;                  /* 아래 SIDE_* */
+} epref_t;
+enum { SIDE_LISTEN, SIDE_WAKE, SIDE_SERVER, SIDE_CLIENT };
+
+typedef struct {
+    unsigned short bid;
+    unsigned len;
+    unsigned off;
+} sendq_t;
+
+typedef struct relay {
+    ioeng_job_t job;
+    int serverfd;
+    int ai;                    /* 지금 시도 중인 주소 인덱스 */
+    size_t reqoff;             /* 요청 중 보낸 바이트 */
+    char *cap;                 /* 캐시용 캡처 (capture_max 초과하면 버림) */
+    size_t caplen;
+    int status;
+    int eof;
+    int closing;               /* 에러로 정리 중 - 남은 SQE 완료를 기다린다 */
+    int inflight;              /* 커널에 걸려 있는 SQE 수 */
+
+    /* io_uring: 클라이언트로 보낼 버퍼 큐 (순서 유지, send 는 한 번에 하나) */
+    sendq_t *q;
+    int qhead, qcount;
+    int sending;
+    int recv_armed;
+    int starved;
+    struct relay *next_starved;
+
+    /* epoll */
+    int state;
+    rio_t *rio;                /* origin 쪽 논블로킹 Rio (버퍼는 MAXLINE) */
+    char *buf;
+    size_t bhead, btail;
+    int cli_registered;
+    epref_t ev_server, ev_client;
+
+    struct relay *next;        /* 제출 큐 */
+} relay_t;
+
+static ioeng_kind_t kind = IOENG_NONE;
+static int listenfd_g = -1, accept_flags_g;
+static ioeng_accept_fn *on_accept_g;
+static int accept_stopped;     /* ioeng_stop_accept 뒤로는 다시 걸지 않는다 */
+
+/* 워커 -> 엔진 제출 큐 */
+static int wakefd = -1;
+static pthread_mutex_t subq_lock = PTHREAD_MUTEX_INITIALIZER;
+static relay_t *subq_head, *subq_tail;
+
+/* 워커 큐가 가득 차서 아직 못 넘긴 연결 */
+static int pending[ACCEPT_PENDING_MAX + URING_ENTRIES * 2];
+static int npending;
+
+static void finish(relay_t *r);
+
+/* 공통 헬퍼 */
+
+static void capture(relay_t *r, const char *data, size_t n) {
+    if (!r->cap)
+        return;
+    if (r->caplen + n > r->job.capture_max) {
+        Free(r->cap);          /* 너무 크다 - 캐시하지 않는다 */
+        r->cap = NULL;
+        return;
+    }
+    memcpy(r->cap + r->caplen, data, n);
+    r->caplen += n;
+}
+
+static void dispatch_pending(void) {
+    int k;
+
+    if (!npending)
+        return;
+    k = on_accept_g(pending, npending);
+    if (k > 0) {
+        memmove(pending, pending + k, (npending - k) * sizeof(int));
+        npending -= k;
+    }
+}
+
+static relay_t *take_submissions(void) {
+    relay_t *list;
+    uint64_t cnt;
+
+    if (read(wakefd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        fprintf(stderr, "ioeng: eventfd read: %s\n", strerror(errno));
+    pthread_mutex_lock(&subq_lock);
+    list = subq_head;
+    subq_head = subq_tail = NULL;
+    pthread_mutex_unlock(&subq_lock);
+    return list;
+}
+
+static void relay_free(relay_t *r) {
+    Free(r->job.req);
+    if (r->q)
+        Free(r->q);
+    if (r->buf)
+        Free(r->buf);
+    if (r->rio)
+        Free(r->rio);
+    Free(r);
+}
+
+/* 완료 콜백 호출 후 해제 */
+static void complete(relay_t *r) {
+    char *cap = NULL;
+    size_t caplen = 0;
+
+    if (r->status == IOENG_OK && r->cap) {
+        cap = r->cap;
+        caplen = r->caplen;
+    } else if (r->cap) {
+        Free(r->cap);
+    }
+    r->cap = NULL;
+    r->job.done(r->job.arg, r->job.clientfd, r->status, cap, caplen);
+    relay_free(r);
+}
+
+/****************************************
+ * io_uring 백엔드
+ ****************************************/
+
+static struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned sq_local;         /* 아직 커널에 알리지 않은 tail */
+    unsigned sq_published;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *br;
+    char *bufs;
+    unsigned short br_tail;
+    int accept_armed;
+    int timeout_armed;
+    uint64_t wakebuf;
+    struct __kernel_timespec retry_ts;
+    relay_t *starved;          /* 버퍼가 없어서 recv 가 끊긴 릴레이들 */
+} ur;
+
+static int uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, ur.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_submit(unsigned wait) {
+    unsigned n = ur.sq_local - ur.sq_published;
+    int rc;
+
+    __atomic_store_n(ur.sq_tail, ur.sq_local, __ATOMIC_RELEASE);
+    ur.sq_published = ur.sq_local;
+    rc = uring_enter(n, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    if (rc < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+        unix_error("io_uring_enter error");
+    return rc;
+}
+
+static struct io_uring_sqe *sqe_get(void) {
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (ur.sq_local - __atomic_load_n(ur.sq_head, __ATOMIC_ACQUIRE) >= ur.sq_entries)
+        uring_submit(0);       /* SQ 가 가득 참 - 먼저 밀어 넣는다 */
+    idx = ur.sq_local & *ur.sq_mask;
+    sqe = &ur.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ur.sq_array[idx] = idx;
+    ur.sq_local++;
+    return sqe;
+}
+
+static void buf_recycle(unsigned short bid) {
+    struct io_uring_buf *b = &ur.br->bufs[ur.br_tail & (NBUFS - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)(ur.bufs + (size_t)bid * BUFSZ);
+    b->len = BUFSZ;
+    b->bid = bid;
+    ur.br_tail++;
+    __atomic_store_n(&ur.br->tail, ur.br_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_init(void) {
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    size_t sqsz, cqsz;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+    if ((ur.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0) {
+        memset(&p, 0, sizeof(p));  /* 오래된 커널 - 플래그 없이 다시 */
+        if ((ur.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+            return -1;
+    }
+
+    sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sqsz = cqsz = (sqsz > cqsz) ? sqsz : cqsz;
+    sq = mmap(NULL, sqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              ur.fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        goto fail;
+    cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ur.fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            goto fail;
+    }
+    ur.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ur.fd, IORING_OFF_SQES);
+    if (ur.sqes == MAP_FAILED)
+        goto fail;
+
+    ur.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ur.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ur.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ur.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ur.sq_entries = p.sq_entries;
+    ur.sq_local = ur.sq_published = *ur.sq_tail;
+    ur.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ur.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ur.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ur.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* recv 용 버퍼 링을 커널에 등록 (5.19+) */
+    ur.br = mmap(NULL, NBUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ur.br == MAP_FAILED)
+        goto fail;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ur.br;
+    reg.ring_entries = NBUFS;
+    reg.bgid = BGID;
+    if (syscall(__NR_io_uring_register, ur.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        goto fail;
+    ur.bufs = Malloc((size_t)NBUFS * BUFSZ);
+    for (int i = 0; i < NBUFS; i++)
+        buf_recycle(i);
+
+    ur.retry_ts.tv_sec = 0;
+    ur.retry_ts.tv_nsec = RETRY_MS * 1000000L;
+    return 0;
+
+ fail:
+    close(ur.fd);              /* 매핑은 프로세스가 끝날 때 정리된다 */
+    return -1;
+}
+
+static void uring_arm_accept(void) {
+    struct io_uring_sqe *sqe = sqe_get();
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd_g;
+    sqe->accept_flags = accept_flags_g;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = UD(NULL, T_ACCEPT);
+    ur.accept_armed = 1;
+}
+
+static void uring_cancel_accept(void) {
+    struct io_uring_sqe *sqe = sqe_get();
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = UD(NULL, T_ACCEPT);
+    sqe->user_data = UD(NULL, T_NONE);
+    ur.accept_armed = 0;       /* 이미 도착한 CQE 는 pending 에 그대로 쌓인다 */
+}
+
+static void uring_arm_wake(void) {
+    struct io_uring_sqe *sqe = sqe_get();
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakefd;
+    sqe->addr = (uint64_t)(uintptr_t)&ur.wakebuf;
+    sqe->len = sizeof(ur.wakebuf);
+    sqe->user_data = UD(NULL, T_WAKE);
+}
+
+static void uring_arm_timeout(void) {
+    struct io_uring_sqe *sqe = sqe_get();
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&ur.retry_ts;
+    sqe->len = 1;
+    sqe->user_data = UD(NULL, T_TIMEOUT);
+    ur.timeout_armed = 1;
+}
+
+static void uring_connect(relay_t *r) {
+    struct io_uring_sqe *sqe;
+
+    for (; r->ai < r->job.naddrs; r->ai++) {
+        r->serverfd = socket(r->job.addrs[r->ai].ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (r->serverfd >= 0)
+            break;
+    }
+    if (r->ai >= r->job.naddrs) {
+        r->status = IOENG_ECONNECT;
+        finish(r);
+        return;
+    }
+    sqe = sqe_get();
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = r->serverfd;
+    sqe->addr = (uint64_t)(uintptr_t)&r->job.addrs[r->ai];
+    sqe->off = r->job.addrlens[r->ai];
+    sqe->user_data = UD(r, T_CONNECT);
+    r->inflight++;
+}
+
+static void uring_send_req(relay_t *r) {
+    struct io_uring_sqe *sqe = sqe_get();
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = r->serverfd;
+    sqe->addr = (uint64_t)(uintptr_t)(r->job.req + r->reqoff);
+    sqe->len = r->job.reqlen - r->reqoff;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = UD(r, T_SENDREQ);
+    r->inflight++;
+}
+
+static void uring_arm_recv(relay_t *r) {
+    struct io_uring_sqe *sqe = sqe_get();
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = r->serverfd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BGID;
+    sqe->user_data = UD(r, T_RECV);
+    r->recv_armed = 1;
+    r->inflight++;
+}
+
+static void uring_kick_send(relay_t *r) {
+    struct io_uring_sqe *sqe;
+    sendq_t *e;
+
+    if (r->sending || !r->qcount || r->closing)
+        return;
+    e = &r->q[r->qhead];
+    sqe = sqe_get();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = r->job.clientfd;
+    sqe->addr = (uint64_t)(uintptr_t)(ur.bufs + (size_t)e->bid * BUFSZ + e->off);
+    sqe->len = e->len - e->off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = UD(r, T_SENDCLI);
+    r->sending = 1;
+    r->inflight++;
+}
+
+static void uring_rearm_starved(void) {
+    relay_t *r = ur.starved;
+
+    ur.starved = NULL;
+    while (r) {
+        relay_t *next = r->next_starved;
+        r->starved = 0;
+        r->next_starved = NULL;
+        if (!r->closing && !r->eof && !r->recv_armed && r->qcount < RELAY_QMAX)
+            uring_arm_recv(r);
+        r = next;
+    }
+}
+
+/* 큐의 버퍼를 반납 - 커널이 보내는 중인 맨 앞 버퍼는 send 완료 때 반납한다 */
+static void uring_drop_queue(relay_t *r) {
+    int keep = r->sending ? 1 : 0;
+
+    while (r->qcount > keep) {
+        buf_recycle(r->q[(r->qhead + r->qcount - 1) % NBUFS].bid);
+        r->qcount--;
+    }
+}
+
+/* 에러 - 걸려 있는 recv 를 끊고 남은 SQE 가 끝나길 기다린다 */
+static void uring_fail(relay_t *r, int status) {
+    if (r->closing)
+        return;
+    r->closing = 1;
+    r->status = status;
+    uring_drop_queue(r);
+    if (r->recv_armed)
+        shutdown(r->serverfd, SHUT_RDWR);
+}
+
+static void uring_relay_cqe(relay_t *r, int tag, int res, unsigned flags) {
+    sendq_t *e;
+
+    switch (tag) {
+    case T_CONNECT:
+        r->inflight--;
+        if (res < 0) {
+            close(r->serverfd);
+            r->serverfd = -1;
+            r->ai++;
+            uring_connect(r);
+            return;
+        }
+        uring_send_req(r);
+        return;
+
+    case T_SENDREQ:
+        r->inflight--;
+        if (res < 0) {
+            /* 클라이언트에는 아직 아무것도 안 보냈으니 연결 실패로 취급 */
+            uring_fail(r, IOENG_ECONNECT);
+            break;
+        }
+        r->reqoff += res;
+        if (r->reqoff < r->job.reqlen)
+            uring_send_req(r);
+        else
+            uring_arm_recv(r);
+        return;
+
+    case T_RECV:
+        r->inflight--;
+        r->recv_armed = 0;
+        if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+            unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (r->closing) {
+                buf_recycle(bid);
+            } else {
+                capture(r, ur.bufs + (size_t)bid * BUFSZ, res);
+                e = &r->q[(r->qhead + r->qcount) % NBUFS];
+                e->bid = bid;
+                e->len = res;
+                e->off = 0;
+                r->qcount++;
+                uring_kick_send(r);
+                if (r->qcount < RELAY_QMAX)
+                    uring_arm_recv(r);   /* 가득 차면 T_SENDCLI 가 다시 건다 */
+            }
+        } else if (res == 0) {
+            r->eof = 1;
+        } else if (res == -ENOBUFS) {
+            if (!r->closing && !r->starved) {
+                r->starved = 1;
+                r->next_starved = ur.starved;
+                ur.starved = r;
+            }
+        } else if (res < 0) {
+            uring_fail(r, r->closing ? r->status : IOENG_EIO);
+        }
+        break;
+
+    case T_SENDCLI:
+        r->inflight--;
+        r->sending = 0;
+        if (r->closing) {
+            uring_drop_queue(r);
+            break;
+        }
+        if (res < 0) {
+            uring_fail(r, IOENG_EIO);   /* 클라이언트가 끊었다 */
+            break;
+        }
+        e = &r->q[r->qhead];
+        e->off += res;
+        if (e->off >= e->len) {
+            buf_recycle(e->bid);
+            r->qhead = (r->qhead + 1) % NBUFS;
+            r->qcount--;
+            if (r->qcount < RELAY_QMAX && !r->recv_armed && !r->eof && !r->starved)
+                uring_arm_recv(r);
+            if (ur.starved)
+                uring_rearm_starved();
+        }
+        uring_kick_send(r);
+        break;
+    }
+
+    if (r->inflight == 0 && (r->closing || (r->eof && !r->qcount && !r->sending)))
+        finish(r);
+}
+
+static void uring_start(relay_t *r) {
+    r->q = Malloc(NBUFS * sizeof(sendq_t));
+    uring_connect(r);
+}
+
+static void uring_loop(void) {
+    struct io_uring_cqe *cqe;
+    unsigned head, tail;
+    uint64_t ud;
+    int res, tag, stopped;
+    unsigned flags;
+
+    uring_arm_wake();
+    uring_arm_accept();
+    while (1) {
+        if (npending && !ur.timeout_armed)
+            uring_arm_timeout();
+        uring_submit(1);
+
+        head = *ur.cq_head;
+        tail = __atomic_load_n(ur.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            cqe = &ur.cqes[head & *ur.cq_mask];
+            ud = cqe->user_data;
+            res = cqe->res;
+            flags = cqe->flags;
+            __atomic_store_n(ur.cq_head, ++head, __ATOMIC_RELEASE);
+
+            tag = UD_TAG(ud);
+            switch (tag) {
+            case T_NONE:
+                break;
+            case T_ACCEPT:
+                if (res >= 0)
+                    pending[npending++] = res;
+                else if (res != -ECANCELED)
+                    fprintf(stderr, "ioeng: accept: %s\n", strerror(-res));
+                if (!(flags & IORING_CQE_F_MORE))
+                    ur.accept_armed = 0;
+                break;
+            case T_WAKE: {
+                relay_t *r = take_submissions();
+                while (r) {
+                    relay_t *next = r->next;
+                    uring_start(r);
+                    r = next;
+                }
+                uring_arm_wake();
+                break;
+            }
+            case T_TIMEOUT:
+                ur.timeout_armed = 0;
+                break;
+            default:
+                uring_relay_cqe(UD_PTR(ud), tag, res, flags);
+            }
+        }
+
+        /* 이번에 받은 연결을 한꺼번에 워커에 넘기고 accept 를 조절한다 */
+        dispatch_pending();
+        stopped = __atomic_load_n(&accept_stopped, __ATOMIC_ACQUIRE);
+        if ((stopped || npending >= ACCEPT_PENDING_MAX) && ur.accept_armed)
+            uring_cancel_accept();
+        else if (!stopped && npending < ACCEPT_PENDING_MAX && !ur.accept_armed)
+            uring_arm_accept();
+    }
+}
+
+/****************************************
+ * epoll 백엔드
+ ****************************************/
+
+static int epfd = -1;
+static int listen_registered;
+static epref_t ev_listen = { NULL, SIDE_LISTEN }, ev_wake = { NULL, SIDE_WAKE };
+
+static void ep_ctl(int op, int fd, unsigned events, epref_t *ref) {
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = ref;
+    if (epoll_ctl(epfd, op, fd, &ev) < 0 && op != EPOLL_CTL_DEL)
+        unix_error("epoll_ctl error");
+}
+
+static int epoll_init(void) {
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return -1;
+    return 0;
+}
+
+static void ep_connect(relay_t *r) {
+    for (; r->ai < r->job.naddrs; r->ai++) {
+        r->serverfd = socket(r->job.addrs[r->ai].ss_family,
+                             SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (r->serverfd < 0)
+            continue;
+        if (connect(r->serverfd, (SA *)&r->job.addrs[r->ai], r->job.addrlens[r->ai]) == 0
+            || errno == EINPROGRESS) {
+            r->state = ST_CONNECT;
+            ep_ctl(EPOLL_CTL_ADD, r->serverfd, EPOLLOUT, &r->ev_server);
+            return;
+        }
+        close(r->serverfd);
+        r->serverfd = -1;
+    }
+    r->status = IOENG_ECONNECT;
+    finish(r);
+}
+
+/* 상태 줄이 200 인가 - 아니면 캐시하지 않을 응답이니 모으지도 않는다 */
+static int status_ok(const char *line) {
+    int code;
+
+    return sscanf(line, "HTTP/%*d.%*d %d", &code) == 1 && code == 200;
+}
+
+/* 버퍼에 남은 것을 클라이언트로 - 다 보냈으면 1, 막혔으면 0, 에러면 -1 */
+static int ep_flush_client(relay_t *r) {
+    if (rio_writen_nb(r->job.clientfd, r->buf, r->btail, &r->bhead) < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    r->bhead = r->btail = 0;
+    return 1;
+}
+
+/*
+ * ep_read_origin - 버퍼가 차거나 EAGAIN 일 때까지 origin 에서 읽는다 (깨어날
+ *     때마다 read 한 번이 아니다). 읽었으면 1, 아직 없으면 0, 끝났으면
+ *     (EOF/에러 - finish 까지 했다) -1.
+ */
+static int ep_read_origin(relay_t *r) {
+    size_t n = 0;
+    ssize_t rc = rio_readnb_nb(r->rio, r->buf, EPOLL_BUFSZ, &n);
+
+    if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        r->status = IOENG_EIO;
+        finish(r);
+        return -1;
+    }
+    if (n == 0) {
+        if (rc < 0)
+            return 0;
+        r->eof = 1;
+        finish(r);
+        return -1;
+    }
+    capture(r, r->buf, n);
+    r->btail = n;
+    return 1;
+}
+
+/*
+ * ep_relay - buf 를 클라이언트로 보낸다. 다 보냈고 Rio 버퍼에 origin 바이트가
+ *     남아 있으면 이어서 읽는다 - 소켓은 비었으니 epoll 이 다시 깨워 주지 않는다.
+ */
+static void ep_relay(relay_t *r) {
+    int rc;
+
+    while ((rc = ep_flush_client(r)) > 0 && r->rio->rio_cnt > 0)
+        if (ep_read_origin(r) <= 0)
+            return;
+    if (rc < 0) {
+        r->status = IOENG_EIO;
+        finish(r);
+    } else if (rc == 0) {
+        /*
+         * 클라이언트가 느리다 - origin 읽기를 멈추고 쓰기 가능을 기다린다.
+         * events 를 0 으로 MOD 해도 EPOLLHUP/EPOLLERR 는 계속 오므로 (그동안
+         * origin 이 끊으면 루프가 헛돈다) epoll 에서 아예 뺀다.
+         */
+        ep_ctl(EPOLL_CTL_DEL, r->serverfd, 0, &r->ev_server);
+        ep_ctl(EPOLL_CTL_ADD, r->job.clientfd, EPOLLOUT, &r->ev_client);
+        r->cli_registered = 1;
+    }
+}
+
+static void ep_server_event(relay_t *r, unsigned events) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    switch (r->state) {
+    case ST_CONNECT:
+        getsockopt(r->serverfd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err) {
+            close(r->serverfd);   /* epoll 등록도 같이 사라진다 */
+            r->serverfd = -1;
+            r->ai++;
+            ep_connect(r);
+            return;
+        }
+        r->state = ST_SENDREQ;
+        /* fall through */
+    case ST_SENDREQ:
+        if (rio_writen_nb(r->serverfd, r->job.req, r->job.reqlen, &r->reqoff) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;        /* 보낸 만큼은 reqoff 에 - 쓰기 가능해지면 이어서 */
+            r->status = IOENG_ECONNECT;
+            finish(r);
+            return;
+        }
+        r->state = ST_STATUS;
+        r->buf = Malloc(EPOLL_BUFSZ);
+        r->rio = Malloc(offsetof(rio_t, rio_ibuf) + MAXLINE);
+        rio_readinitb_buf(r->rio, r->serverfd, r->rio->rio_ibuf, MAXLINE);
+        fcntl(r->job.clientfd, F_SETFL, fcntl(r->job.clientfd, F_GETFL, 0) | O_NONBLOCK);
+        ep_ctl(EPOLL_CTL_MOD, r->serverfd, EPOLLIN, &r->ev_server);
+        return;
+
+    case ST_STATUS:
+        /* 상태 줄 - 나눠 와도 읽은 만큼은 buf[0..btail) 에 있고 거기서 잇는다 */
+        if (rio_readlineb_nb(r->rio, r->buf, MAXLINE, &r->btail) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            r->status = IOENG_EIO;
+            finish(r);
+            return;
+        }
+        if (r->btail == 0) {   /* 아무것도 보내지 않고 끊었다 */
+            r->eof = 1;
+            finish(r);
+            return;
+        }
+        if (!status_ok(r->buf) && r->cap) {
+            Free(r->cap);
+            r->cap = NULL;
+        }
+        capture(r, r->buf, r->btail);
+        r->state = ST_RELAY;
+        break;
+
+    case ST_RELAY:
+        if (r->bhead < r->btail)
+            return;            /* 클라이언트가 아직 못 받았다 - 읽기 멈춤 상태 */
+        if (ep_read_origin(r) <= 0)
+            return;
+        break;
+    }
+    ep_relay(r);
+}
+
+static void ep_client_event(relay_t *r) {
+    int rc = ep_flush_client(r);
+
+    if (rc < 0) {
+        r->status = IOENG_EIO;
+        finish(r);
+    } else if (rc > 0) {
+        /* 다 보냈다 - 같은 이유로 클라이언트는 빼고 origin 을 다시 건다 */
+        ep_ctl(EPOLL_CTL_DEL, r->job.clientfd, 0, &r->ev_client);
+        r->cli_registered = 0;
+        ep_ctl(EPOLL_CTL_ADD, r->serverfd, EPOLLIN, &r->ev_server);
+        if (r->rio->rio_cnt > 0 && ep_read_origin(r) > 0)
+            ep_relay(r);       /* Rio 버퍼에 남은 것은 epoll 이 알려 주지 않는다 */
+    }
+}
+
+static void ep_start(relay_t *r) {
+    r->ev_server.r = r->ev_client.r = r;
+    r->ev_server.side = SIDE_SERVER;
+    r->ev_client.side = SIDE_CLIENT;
+    ep_connect(r);
+}
+
+static void ep_accept(void) {
+    int fd;
+
+    while (npending < ACCEPT_PENDING_MAX) {
+        fd = accept4(listenfd_g, NULL, NULL, accept_flags_g);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "ioeng: accept4: %s\n", strerror(errno));
+            break;
+        }
+        pending[npending++] = fd;
+    }
+}
+
+static void epoll_loop(void) {
+    struct epoll_event evs[64];
+    epref_t *ref;
+    int n, stopped;
+
+    fcntl(listenfd_g, F_SETFL, fcntl(listenfd_g, F_GETFL, 0) | O_NONBLOCK);
+    ep_ctl(EPOLL_CTL_ADD, wakefd, EPOLLIN, &ev_wake);
+    ep_ctl(EPOLL_CTL_ADD, listenfd_g, EPOLLIN, &ev_listen);
+    listen_registered = 1;
+
+    while (1) {
+        n = epoll_wait(epfd, evs, 64, npending ? RETRY_MS : -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+        for (int i = 0; i < n; i++) {
+            ref = evs[i].data.ptr;
+            switch (ref->side) {
+            case SIDE_LISTEN:
+                ep_accept();
+                break;
+            case SIDE_WAKE: {
+                relay_t *r = take_submissions();
+                while (r) {
+                    relay_t *next = r->next;
+                    ep_start(r);
+                    r = next;
+                }
+                break;
+            }
+            case SIDE_SERVER:
+                ep_server_event(ref->r, evs[i].events);
+                break;
+            case SIDE_CLIENT:
+                ep_client_event(ref->r);
+                break;
+            }
+        }
+
+        /* 워커에 못 넘긴 연결이 남아 있으면 리슨 소켓을 잠시 빼 둔다 */
+        dispatch_pending();
+        stopped = __atomic_load_n(&accept_stopped, __ATOMIC_ACQUIRE);
+        if ((stopped || npending) && listen_registered) {
+            ep_ctl(EPOLL_CTL_DEL, listenfd_g, 0, &ev_listen);
+            listen_registered = 0;
+        } else if (!stopped && !npending && !listen_registered) {
+            ep_ctl(EPOLL_CTL_ADD, listenfd_g, EPOLLIN, &ev_listen);
+            listen_registered = 1;
+        }
+    }
+}
+
+/****************************************
+ * 공용 인터페이스
+ ****************************************/
+
+/* 릴레이 종료 - 엔진 자원을 정리하고 콜백 호출 */
+static void finish(relay_t *r) {
+    if (kind == IOENG_URING) {
+        relay_t **pp;
+        for (pp = &ur.starved; *pp; pp = &(*pp)->next_starved) {
+            if (*pp == r) {
+                *pp = r->next_starved;
+                break;
+            }
+        }
+        uring_drop_queue(r);
+    } else if (r->cli_registered) {
+        ep_ctl(EPOLL_CTL_DEL, r->job.clientfd, 0, &r->ev_client);
+    }
+    if (r->serverfd >= 0)
+        close(r->serverfd);
+    if (kind == IOENG_EPOLL && r->state >= ST_STATUS)  /* 응답을 받는 동안만 논블로킹이었다 */
+        fcntl(r->job.clientfd, F_SETFL, fcntl(r->job.clientfd, F_GETFL, 0) & ~O_NONBLOCK);
+    complete(r);
+}
+
+/*
+ * ioeng_init - want 가 "uring" 이면 io_uring 을 먼저 시도하고, 안 되면
+ *     epoll 로 내려간다. 고른 백엔드 종류를 리턴.
+ */
+int ioeng_init(const char *want) {
+    if ((wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+        unix_error("eventfd error");
+
+    if (!strcmp(want, "uring")) {
+        if (uring_init() == 0) {
+            kind = IOENG_URING;
+            return kind;
+        }
+        fprintf(stderr, "ioeng: io_uring unavailable (%s), falling back to epoll\n",
+                strerror(errno));
+    } else if (strcmp(want, "epoll")) {
+        app_error("ioeng: unknown engine (use uring or epoll)");
+    }
+    if (epoll_init() < 0)
+        unix_error("epoll_create1 error");
+    kind = IOENG_EPOLL;
+    return kind;
+}
+
+ioeng_kind_t ioeng_kind(void) {
+    return kind;
+}
+
+const char *ioeng_name(void) {
+    return kind == IOENG_URING ? "io_uring" : kind == IOENG_EPOLL ? "epoll" : "none";
+}
+
+static void *engine_thread(void *vargp) {
+    if (kind == IOENG_URING)
+        uring_loop();
+    else
+        epoll_loop();
+    return NULL;
+}
+
+/* 엔진 스레드 시작 - 이후 listenfd 의 accept 는 엔진이 맡는다 */
+void ioeng_start(int listenfd, int accept_flags, ioeng_accept_fn *on_accept) {
+    pthread_t tid;
+
+    listenfd_g = listenfd;
+    accept_flags_g = accept_flags;
+    on_accept_g = on_accept;
+    Pthread_create(&tid, NULL, engine_thread, NULL);
+}
+
+/*
+ * ioeng_stop_accept - 아무 스레드에서나 호출. 엔진이 더 이상 accept 하지 않게
+ *     한다 (이미 받은 연결과 진행 중인 릴레이는 계속 처리한다).
+ */
+void ioeng_stop_accept(void) {
+    uint64_t one = 1;
+
+    __atomic_store_n(&accept_stopped, 1, __ATOMIC_RELEASE);
+    if (write(wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        unix_error("eventfd write error");
+}
+
+/* 워커 스레드에서 호출 - 작업을 복사해 엔진 큐에 넣고 엔진을 깨운다 */
+void ioeng_submit(ioeng_job_t *job) {
+    relay_t *r = Calloc(1, sizeof(relay_t));
+    uint64_t one = 1;
+
+    r->job = *job;
+    r->serverfd = -1;
+    r->status = IOENG_OK;
+    if (job->capture_max)
+        r->cap = Malloc(job->capture_max);
+
+    pthread_mutex_lock(&subq_lock);
+    if (subq_tail)
+        subq_tail->next = r;
+    else
+        subq_head = r;
+    subq_tail = r;
+    pthread_mutex_unlock(&subq_lock);
+
+    if (write(wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        unix_error("eventfd write error");
+}
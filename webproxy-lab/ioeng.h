@@ -0,0 +1,62 @@
+/*
+ * ioeng.h - 프록시 릴레이용 단일 스레드 I/O 엔진
+ *
+ * 엔진 스레드 하나가 리슨 소켓의 accept 와 여러 개의 origin -> client
+ * 릴레이를 동시에 처리한다. 백엔드는 시작할 때 고른다.
+ *   - io_uring : multishot accept/recv, 등록된 버퍼 링, connect/send SQE
+ *   - epoll    : io_uring 을 쓸 수 없을 때의 대체 경로
+ */
+#ifndef __IOENG_H__
+#define __IOENG_H__
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+#define IOENG_MAXADDR 4   /* 릴레이 하나가 시도할 origin 주소 수 */
+
+typedef enum {
+    IOENG_NONE = 0,
+    IOENG_EPOLL,
+    IOENG_URING
+} ioeng_kind_t;
+
+/* 릴레이 결과 */
+#define IOENG_OK          0   /* origin EOF 까지 전부 전달함 */
+#define IOENG_ECONNECT   -1   /* origin 연결 실패 (클라이언트에는 아무것도 안 보냄) */
+#define IOENG_EIO        -2   /* 릴레이 도중 I/O 에러 */
+
+/*
+ * accept 콜백 - 엔진 스레드에서 호출된다. 받아간 fd 수를 리턴해야 하며,
+ * 다 못 받은 나머지는 엔진이 들고 있다가 나중에 다시 넘긴다.
+ */
+typedef int ioeng_accept_fn(int *fds, int n);
+
+/*
+ * 릴레이 완료 콜백 - 엔진 스레드에서 호출된다. capture 는 capture_max
+ * 이하로 응답 전체를 담았을 때만 NULL 이 아니며, 소유권은 콜백에 넘어간다.
+ * clientfd 를 닫는 것도 콜백의 몫이다.
+ */
+typedef void ioeng_done_fn(void *arg, int clientfd, int status,
+                           char *capture, size_t caplen);
+
+/* 워커가 엔진에 넘기는 릴레이 작업 */
+typedef struct {
+    int clientfd;
+    struct sockaddr_storage addrs[IOENG_MAXADDR];   /* connect 할 origin 주소들 */
+    socklen_t addrlens[IOENG_MAXADDR];
+    int naddrs;
+    char *req;              /* origin 에 보낼 요청 (Malloc, 엔진이 해제) */
+    size_t reqlen;
+    size_t capture_max;     /* 캐시용으로 모을 최대 크기 (0 이면 안 모음) */
+    ioeng_done_fn *done;
+    void *arg;
+} ioeng_job_t;
+
+int ioeng_init(const char *want);
+ioeng_kind_t ioeng_kind(void);
+const char *ioeng_name(void);
+void ioeng_start(int listenfd, int accept_flags, ioeng_accept_fn *on_accept);
+void ioeng_submit(ioeng_job_t *job);
+void ioeng_stop_accept(void);
+
+#endif /* __IOENG_H__ */
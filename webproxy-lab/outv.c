@@ -0,0 +1,83 @@
+/*
+ * outv.c - 응답/요청 머리를 iovec 조각으로 모아 한 번에 보내는 빌더
+ *
+ * 조각은 복사하지 않고 가리키기만 한다 - 고정 문자열, 요청 버퍼 안의 헤더,
+ * 캐시 블록, mmap 한 파일 본문을 그대로. 숫자처럼 새로 만들어야 하는 것만
+ * outv_printf 로 빌더 안의 작은 자리에 찍는다. 보낼 때는 rio_writev 한 번 (대개
+ * writev 시스템 콜 하나) 이라 머리가 작은 TCP 조각 여러 개로 나가지 않고,
+ * Nagle 때문에 뒤 조각이 ACK 를 기다리는 일도 없다. 가리킨 메모리는
+ * outv_flush 가 끝날 때까지 살아 있어야 하고, 조각이 tmp 를 가리키므로 outv_t 를
+ * 복사해서 쓰지 않는다.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "csapp.h"
+#include "outv.h"
+
+void outv_init(outv_t *o) {
+    o->n = 0;
+    o->len = 0;
+    o->overflow = 0;
+    o->tmplen = 0;
+}
+
+/* p[0..n) 를 조각으로 붙인다. 바로 앞 조각에 이어지면 그 조각을 늘린다 */
+void outv_add(outv_t *o, const void *p, size_t n) {
+    struct iovec *last;
+
+    if (n == 0)
+        return;
+    o->len += n;
+    if (o->n > 0) {
+        last = &o->iov[o->n - 1];
+        if ((const char *)last->iov_base + last->iov_len == p) {
+            last->iov_len += n;
+            return;
+        }
+    }
+    if (o->n == OUTV_MAX) {
+        o->overflow = 1;
+        return;
+    }
+    o->iov[o->n].iov_base = (void *)p;
+    o->iov[o->n].iov_len = n;
+    o->n++;
+}
+
+void outv_str(outv_t *o, const char *s) {
+    outv_add(o, s, strlen(s));
+}
+
+/* 형식화한 조각 - tmp 에 찍으므로 연달아 부르면 한 조각으로 이어진다 */
+void outv_printf(outv_t *o, const char *fmt, ...) {
+    va_list ap;
+    int k;
+
+    va_start(ap, fmt);
+    k = vsnprintf(o->tmp + o->tmplen, OUTV_TMP - o->tmplen, fmt, ap);
+    va_end(ap);
+    if (k < 0 || (size_t)k >= OUTV_TMP - o->tmplen) {
+        o->overflow = 1;
+        return;
+    }
+    outv_add(o, o->tmp + o->tmplen, k);
+    o->tmplen += k;
+}
+
+/*
+ * outv_flush - 모은 조각을 fd 로 보낸다. flags 에 MSG_MORE 를 주면 뒤따를
+ *     데이터 (CGI 출력, splice 등) 와 같은 TCP 조각에 담기도록 커널이 잠시
+ *     들고 있는다. 빌더는 그대로 두므로 같은 내용을 다시 보낼 수 있다.
+ *     다 보냈으면 o->len, 실패하면 -1.
+ */
+ssize_t outv_flush(outv_t *o, int fd, int flags) {
+    struct iovec iov[OUTV_MAX];
+
+    if (o->overflow) {
+        errno = E2BIG;
+        return -1;
+    }
+    memcpy(iov, o->iov, o->n * sizeof(iov[0]));
+    return rio_writev(fd, iov, o->n, flags) < 0 ? -1 : (ssize_t)o->len;
+}
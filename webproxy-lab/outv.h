@@ -0,0 +1,29 @@
+/*
+ * outv.h - 응답/요청 머리를 iovec 조각으로 모아 한 번에 보내는 빌더
+ */
+#ifndef __OUTV_H__
+#define __OUTV_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define OUTV_MAX 256               /* 조각 수 - 이어진 조각은 하나로 합친다 */
+#define OUTV_TMP 256               /* outv_printf 로 만든 조각을 담는 자리 */
+
+typedef struct {
+    struct iovec iov[OUTV_MAX];
+    int n;
+    size_t len;                    /* 모든 조각의 길이 합 */
+    int overflow;                  /* 조각이나 tmp 가 모자랐다 - outv_flush 가 실패한다 */
+    size_t tmplen;
+    char tmp[OUTV_TMP];
+} outv_t;
+
+void outv_init(outv_t *o);
+void outv_add(outv_t *o, const void *p, size_t n);
+void outv_str(outv_t *o, const char *s);
+void outv_printf(outv_t *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+ssize_t outv_flush(outv_t *o, int fd, int flags);
+
+#endif /* __OUTV_H__ */
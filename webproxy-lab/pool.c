@@ -0,0 +1,233 @@
+/*
+ * pool.c - origin 별 유휴 keep-alive 연결 풀
+ *
+ * 연결은 host:port 해시 버킷의 호스트 항목 아래에 최근에 반납된 것부터
+ * 매달리고, 동시에 전체 유휴 목록에 반납 순서대로 들어간다. 전체 목록의
+ * 앞쪽이 가장 오래 쉰 연결이므로 idle timeout 정리는 앞에서부터 떼어 내기만
+ * 하면 된다. 정리는 get/put 때와 함께 watchdog 휠의 타이머 (tw_call) 로도
+ * 돌므로, 요청이 끊긴 뒤에도 쉬는 연결이 idle timeout 을 넘겨 fd 를 붙잡고
+ * 있지 않는다. 타이머는 풀이 비어 있지 않은 동안만 가장 오래 쉰 연결의 만료
+ * 시각에 맞춰 걸려 있다. 풀 전체의 연결 수도 max_total 로 묶어서, 차 있으면
+ * 가장 오래 쉰 연결을 닫고 자리를 낸다.
+ *
+ * 꺼낼 때는 MSG_PEEK 로 origin 이 이미 닫았는지 확인한다. 그래도 확인과
+ * 요청 전송 사이에 닫힐 수 있으므로 호출한 쪽은 재사용 연결이 응답 없이
+ * 끊기면 새 연결로 한 번 더 시도해야 한다.
+ */
+#include "csapp.h"
+#include "pool.h"
+#include "twheel.h"
+#include <time.h>
+
+#define POOL_BUCKETS 256
+
+struct phost;
+
+typedef struct pconn {
+    int fd;
+    long long idle_since;          /* 반납 시각 (ms) */
+    struct phost *host;
+    struct pconn *hprev, *hnext;   /* 같은 호스트 안 (최근 반납이 앞) */
+    struct pconn *gprev, *gnext;   /* 전체 유휴 목록 (오래된 것이 앞) */
+} pconn_t;
+
+typedef struct phost {
+    char *key;                     /* "host:port" */
+    unsigned hash;
+    int nidle;
+    pconn_t *head;
+    struct phost *next;            /* 해시 버킷 체인 */
+} phost_t;
+
+static phost_t *buckets[POOL_BUCKETS];
+static pconn_t *oldest, *newest;
+static int nidle;                  /* 풀 전체의 연결 수 */
+static int max_per_host = 8, max_total = 256;
+static int idle_ms = 15000;
+static tw_watch_t reap_timer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* 호스트 이름은 대소문자 구분 없이 같은 origin 이다 */
+static unsigned key_hash(const char *key) {
+    unsigned h = 5381;
+
+    while (*key)
+        h = h * 33 + tolower((unsigned char)*key++);
+    return h;
+}
+
+/* lock 안에서 호출. create 면 없을 때 만든다 */
+static phost_t *host_find(const char *host, const char *port, int create) {
+    char key[MAXLINE];
+    unsigned h;
+    phost_t *ph;
+
+    snprintf(key, sizeof(key), "%s:%s", host, port);
+    h = key_hash(key);
+    for (ph = buckets[h % POOL_BUCKETS]; ph; ph = ph->next)
+        if (ph->hash == h && !strcasecmp(ph->key, key))
+            return ph;
+    if (!create)
+        return NULL;
+
+    ph = Calloc(1, sizeof(phost_t));
+    ph->key = Malloc(strlen(key) + 1);
+    strcpy(ph->key, key);
+    ph->hash = h;
+    ph->next = buckets[h % POOL_BUCKETS];
+    buckets[h % POOL_BUCKETS] = ph;
+    return ph;
+}
+
+static void host_free(phost_t *ph) {
+    phost_t **pp = &buckets[ph->hash % POOL_BUCKETS];
+
+    while (*pp != ph)
+        pp = &(*pp)->next;
+    *pp = ph->next;
+    Free(ph->key);
+    Free(ph);
+}
+
+/* 두 목록에서 떼어 낸다. 호스트에 남은 연결이 없으면 호스트 항목도 지운다 */
+static void conn_unlink(pconn_t *c) {
+    phost_t *ph = c->host;
+
+    if (c->hprev)
+        c->hprev->hnext = c->hnext;
+    else
+        ph->head = c->hnext;
+    if (c->hnext)
+        c->hnext->hprev = c->hprev;
+
+    if (c->gprev)
+        c->gprev->gnext = c->gnext;
+    else
+        oldest = c->gnext;
+    if (c->gnext)
+        c->gnext->gprev = c->gprev;
+    else
+        newest = c->gprev;
+
+    nidle--;
+    if (--ph->nidle == 0)
+        host_free(ph);
+}
+
+static void conn_close(pconn_t *c) {
+    conn_unlink(c);
+    Close(c->fd);
+    Free(c);
+}
+
+/* idle timeout 이 지난 연결을 닫는다 (lock 안에서) */
+static void reap(long long now) {
+    while (oldest && now - oldest->idle_since >= idle_ms)
+        conn_close(oldest);
+}
+
+/* reap_timer - watchdog 스레드에서. 다음 만료까지 ms, 풀이 비었으면 -1 */
+static long long reap_fire(tw_watch_t *wt) {
+    long long now = now_ms(), next = -1;
+
+    pthread_mutex_lock(&lock);
+    reap(now);
+    if (oldest)
+        next = oldest->idle_since + idle_ms - now;
+    pthread_mutex_unlock(&lock);
+    return next;
+}
+
+/* origin 이 닫았거나 요청하지 않은 데이터가 와 있으면 다시 쓸 수 없다 */
+static int conn_alive(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void pool_init(int max, int total, int idle) {
+    max_per_host = max;
+    max_total = total;
+    idle_ms = idle;
+}
+
+/* host:port 로 쉬고 있는 연결 중 가장 최근 것을 꺼낸다. 없으면 -1 */
+int pool_get(const char *host, const char *port) {
+    phost_t *ph;
+    pconn_t *c;
+    int fd;
+
+    while (1) {
+        pthread_mutex_lock(&lock);
+        reap(now_ms());
+        if (!(ph = host_find(host, port, 0))) {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        c = ph->head;
+        conn_unlink(c);
+        pthread_mutex_unlock(&lock);
+
+        fd = c->fd;
+        Free(c);
+        if (conn_alive(fd))
+            return fd;
+        Close(fd);
+    }
+}
+
+/*
+ * 응답을 끝까지 읽은 연결을 돌려놓는다. 호스트당 한도가 차 있으면 닫고, 풀
+ *     전체가 차 있으면 가장 오래 쉰 연결을 대신 닫는다.
+ */
+void pool_put(const char *host, const char *port, int fd) {
+    long long now = now_ms();
+    phost_t *ph;
+    pconn_t *c;
+    int was_empty;
+
+    pthread_mutex_lock(&lock);
+    reap(now);
+    ph = host_find(host, port, 0);
+    if (max_per_host <= 0 || max_total <= 0 || (ph && ph->nidle >= max_per_host)) {
+        pthread_mutex_unlock(&lock);
+        Close(fd);
+        return;
+    }
+    while (nidle >= max_total)
+        conn_close(oldest);
+    ph = host_find(host, port, 1);     /* 위에서 마지막 연결과 함께 지워졌을 수 있다 */
+    c = Malloc(sizeof(pconn_t));
+    c->fd = fd;
+    c->idle_since = now;
+    c->host = ph;
+
+    c->hprev = NULL;
+    c->hnext = ph->head;
+    if (ph->head)
+        ph->head->hprev = c;
+    ph->head = c;
+    ph->nidle++;
+
+    c->gnext = NULL;
+    c->gprev = newest;
+    if (newest)
+        newest->gnext = c;
+    else
+        oldest = c;
+    newest = c;
+    was_empty = (nidle++ == 0);
+    pthread_mutex_unlock(&lock);
+
+    /* 풀이 비어 있었으면 정리 타이머도 쉬고 있었다 (watchdog lock 은 lock 밖에서) */
+    if (was_empty)
+        tw_call(&reap_timer, idle_ms, reap_fire);
+}
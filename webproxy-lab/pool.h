@@ -0,0 +1,11 @@
+/*
+ * pool.h - origin(host:port) 별 유휴 keep-alive 연결 풀
+ */
+#ifndef __POOL_H__
+#define __POOL_H__
+
+void pool_init(int max_per_host, int max_total, int idle_ms);
+int pool_get(const char *host, const char *port);
+void pool_put(const char *host, const char *port, int fd);
+
+#endif /* __POOL_H__ */
@@ -9,6 +9,8 @@
  * Based on the Tiny Web server from the CS:APP text
  */
 #include "csapp.h"
+#include "httpreq.h"
+#include "outv.h"
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr =
     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
@@ -17,8 +19,8 @@ static const char *conn_hdr = "Connection: close\r\n";
 static const char *proxy_conn_hdr = "Proxy-Connection: close\r\n";
 
 void doit(int fd);
-void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname);
-int parse_uri(char *uri, char *hostname, char *port, char *path);
+int read_request(rio_t *rp, char *buf, size_t size, hreq_t *hr);
+void build_request(outv_t *req, char *buf, hreq_t *hr);
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
 
 int main(int argc, char **argv) 
@@ -32,13 +34,18 @@ int main(int argc, char **argv)
     fprintf(stderr, "usage: %s <port>\n", argv[0]);
     exit(1);
   }
+  /* A browser that hangs up mid-response must not kill the proxy */
+  Signal(SIGPIPE, SIG_IGN);
   listenfd = Open_listenfd(argv[1]);
   while (1) {
     clientlen = sizeof(clientaddr);
-    connfd = Accept(listenfd, (SA *)&clientaddr,
+    /* Not Accept(): ECONNABORTED etc. cost only that connection */
+    connfd = accept(listenfd, (SA *)&clientaddr,
                     &clientlen); // line:netp:tiny:accept
+    if (connfd < 0)
+      continue;
     Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
-                0);
+                NI_NUMERICHOST | NI_NUMERICSERV);
     printf("Accepted connection from (%s, %s)\n", hostname, port);
     /* --- This is the sequential part --- */
     doit(connfd); // Handle one request
@@ -50,151 +57,168 @@ int main(int argc, char **argv)
 void doit(int fd) 
 {
   int server_fd; /* File descriptor for the origin server */
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  char hostname[MAXLINE], port[MAXLINE], path[MAXLINE];
-  char request_buf[MAXLINE]; /* Buffer to build the request to the server */
+  int rc;
+  char buf[MAXBUF];          /* Request line and headers, parsed in place */
+  char hostname[MAXLINE], port[MAXLINE];
+  outv_t req;                /* Request to the server: fragments of buf */
   rio_t rio_browser;         /* RIO buffer for browser connection */
   rio_t rio_server;          /* RIO buffer for server connection */
-  /* 1. Read request line from browser */
-  Rio_readinitb(&rio_browser, fd);
-  if (!Rio_readlineb(&rio_browser, buf, MAXLINE))
+  hreq_t hr;                 /* Slices of buf: method, URI parts, headers */
+  /* 1. Read request line and headers from browser */
+  rio_readinitb(&rio_browser, fd);
+  if ((rc = read_request(&rio_browser, buf, sizeof(buf), &hr)) == 0)
+    return;
+  if (rc < 0) {
+    clienterror(fd, "", "400", "Bad Request",
+                "Proxy couldn't parse the request");
     return;
-  printf("Request from browser:\n%s", buf);
-  sscanf(buf, "%s %s %s", method, uri, version);
+  }
+  printf("Request from browser:\n%.*s", (int)hr.end, buf);
+  buf[hr.method.off + hr.method.len] = '\0'; /* Method is used in place */
   /* We only handle GET requests for this lab */
-  if (strcasecmp(method, "GET")) {
-    clienterror(fd, method, "501", "Not Implemented",
+  if (!hreq_is(buf, hr.method, "GET")) {
+    clienterror(fd, buf + hr.method.off, "501", "Not Implemented",
                 "Proxy does not implement this method");
     return;
   }
-  /* 2. Parse URI to get hostname, port, and path */
-  if (parse_uri(uri, hostname, port, path) < 0) {
-    clienterror(fd, uri, "400", "Bad Request",
+  /* 2. The URI was already split by the parser: copy hostname and port */
+  if (hr.uri.host.len == 0) {
+    buf[hr.target.off + hr.target.len] = '\0';
+    clienterror(fd, buf + hr.target.off, "400", "Bad Request",
                 "Proxy couldn't parse the URI");
     return;
   }
-  /* 3. Build the new HTTP request to send to the origin server */
-  sprintf(request_buf, "GET %s HTTP/1.0\r\n", path);
-  /* 4. Read headers from browser and add required headers */
-  read_requesthdrs(&rio_browser, request_buf, hostname);
+  snprintf(hostname, sizeof(hostname), "%.*s", (int)hr.uri.host.len,
+           buf + hr.uri.host.off);
+  if (hr.uri.port.len)
+    snprintf(port, sizeof(port), "%.*s", (int)hr.uri.port.len,
+             buf + hr.uri.port.off);
+  else
+    strcpy(port, "80");
+  /* 3-4. Build the new HTTP request from the parsed slices (no copying) */
+  build_request(&req, buf, &hr);
   /* 5. Connect to the origin server (Proxy acts as a client) */
-  server_fd = Open_clientfd(hostname, port);
+  server_fd = open_clientfd(hostname, port); /* Not Open_clientfd: no exit */
   if (server_fd < 0) {
     clienterror(fd, hostname, "502", "Bad Gateway",
                 "Proxy couldn't connect to the server");
     return;
   }
-  printf("--- Forwarding request to %s:%s ---\n%s", hostname, port, request_buf);
-  /* 6. Send the modified request to the origin server */
-  Rio_writen(server_fd, request_buf, strlen(request_buf));
+  printf("--- Forwarding request to %s:%s ---\n", hostname, port);
+  for (int i = 0; i < req.n; i++)
+    fwrite(req.iov[i].iov_base, 1, req.iov[i].iov_len, stdout);
+  /* 6. Send the modified request to the origin server in one writev */
+  if (outv_flush(&req, server_fd, 0) < 0) {
+    Close(server_fd);
+    return;
+  }
   /*
    * 7. Relay the response from the origin server back to the browser
-   * Read from server_fd, write to fd (browser)
+   * Read from server_fd, write to fd (browser). An I/O error on either
+   * side ends only this transfer, so the unix_error() wrappers are not used.
    */
-  Rio_readinitb(&rio_server, server_fd);
+  rio_readinitb(&rio_server, server_fd);
   ssize_t n;
-  while ((n = Rio_readnb(&rio_server, buf, MAXLINE)) > 0) {
-    Rio_writen(fd, buf, n);
+  while ((n = rio_readnb(&rio_server, buf, MAXLINE)) > 0) {
+    if (rio_writen(fd, buf, n) != n)
+      break;
   }
   /* 8. Clean up */
   Close(server_fd);
 }
 
-void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname) 
+/*
+ * read_request - Read lines into buf until the blank line, letting the
+ * parser pick up where it stopped each time. Returns 1 when done, 0 on EOF,
+ * -1 on a malformed request or one that does not fit in buf.
+ */
+int read_request(rio_t *rp, char *buf, size_t size, hreq_t *hr) 
+{
+  size_t len = 0;
+  ssize_t n;
+  int rc;
+  hreq_init(hr);
+  while ((rc = hreq_parse(hr, buf, len)) == HREQ_AGAIN) {
+    if (len + 1 >= size)
+      return -1;
+    if ((n = rio_readlineb(rp, buf + len, size - len)) <= 0)
+      return 0; /* EOF or a reset browser: just drop the connection */
+    len += n;
+  }
+  return rc == HREQ_DONE ? 1 : -1;
+}
+
+/*
+ * build_request - Gather the request for the origin server. Kept header
+ * lines point into buf (consecutive ones merge into one fragment); the
+ * browser's Host header is kept, User-Agent and the Connection headers
+ * are replaced with our own.
+ */
+void build_request(outv_t *req, char *buf, hreq_t *hr) 
 {
-  char buf[MAXLINE];
   int host_header_found = 0;
-  Rio_readlineb(rp, buf, MAXLINE);
-  printf("%s", buf);
-  while (strcmp(buf, "\r\n")) {
-    /* If browser sends Host header, use it */
-    if (strstr(buf, "Host:")) {
+  hslice_t path = hr->uri.path;
+  outv_init(req);
+  outv_str(req, "GET ");
+  if (path.len)
+    outv_add(req, buf + path.off, path.len);
+  else
+    outv_str(req, "/");
+  outv_str(req, " HTTP/1.0\r\n");
+  for (int i = 0; i < hr->nhdrs; i++) {
+    hreq_hdr_t *h = &hr->hdrs[i];
+    size_t end = h->value.off + h->value.len;
+    /* The parser already classified the name - switch on it */
+    switch (h->id) {
+    case HDR_HOST:
       host_header_found = 1;
-      strcat(request_buf, buf);
+      break;
+    /* Ignore other standard headers from browser, we will add our own */
+    case HDR_USER_AGENT:
+    case HDR_CONNECTION:
+    case HDR_PROXY_CONNECTION:
+      continue;
+    default:
+      break;
     }
-    /* Ignore other standard headers from browser */
-    else if (strstr(buf, "User-Agent:") || strstr(buf, "Connection:") ||
-               strstr(buf, "Proxy-Connection:")) {
-      // Do nothing, we will add our own
+    /* The line as the browser sent it, with its CRLF when it has one */
+    if (buf[end] == '\r' && buf[end + 1] == '\n') {
+      outv_add(req, buf + h->name.off, end + 2 - h->name.off);
+    } else {
+      outv_add(req, buf + h->name.off, end - h->name.off);
+      outv_str(req, "\r\n");
     }
-    /* Forward all other headers */
-    else {
-      strcat(request_buf, buf);
-    }
-    Rio_readlineb(rp, buf, MAXLINE);
-    printf("%s", buf);
   }
-  /* Add mandatory headers if not found */
+  /* Add mandatory headers if not found, then the final blank line */
   if (!host_header_found) {
-    sprintf(buf, "Host: %s\r\n", hostname);
-    strcat(request_buf, buf);
-  }
-  strcat(request_buf, user_agent_hdr);
-  strcat(request_buf, conn_hdr);
-  strcat(request_buf, proxy_conn_hdr);
-  /* Add the final blank line */
-  strcat(request_buf, "\r\n");
-  return;
-}
-
-int parse_uri(char *uri, char *hostname, char *port, char *path) 
-{
-  char *host_ptr, *port_ptr, *path_ptr;
-  /* Check for "http://" prefix */
-  if (strncasecmp(uri, "http://", 7) != 0) {
-    return -1; /* Not a valid HTTP URI for this proxy */
-  }
-  host_ptr = uri + 7; /* Move pointer past "http://" */
-  /* Find the start of the path (the first '/') */
-  path_ptr = strchr(host_ptr, '/');
-  if (path_ptr == NULL) {
-    /* No path, e.g., http://www.google.com */
-    strcpy(path, "/");
-  } else {
-    /* Path found */
-    strcpy(path, path_ptr);
-    *path_ptr = '\0'; /* Terminate host string at the path */
-  }
-  /* Find the port separator (':') */
-  port_ptr = strchr(host_ptr, ':');
-  if (port_ptr == NULL) {
-    /* No port specified, use default 80 */
-    strcpy(port, "80");
-    strcpy(hostname, host_ptr);
-  } else {
-    /* Port specified */
-    *port_ptr = '\0'; /* Terminate host string */
-    strcpy(hostname, host_ptr);
-    strcpy(port, port_ptr + 1);
+    outv_str(req, "Host: ");
+    outv_add(req, buf + hr->uri.host.off, hr->uri.host.len);
+    outv_str(req, "\r\n");
   }
-  /* After parsing, host_ptr points to the start of the hostname */
-  /* We've already copied it, but let's restore the original string */
-  /* just in case, though not strictly necessary here. */
-  if(path_ptr) *path_ptr = '/';
-  if(port_ptr) *port_ptr = ':';
-  return 0; /* Success */
+  outv_str(req, user_agent_hdr);
+  outv_str(req, conn_hdr);
+  outv_str(req, proxy_conn_hdr);
+  outv_str(req, "\r\n");
 }
 
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg,char *longmsg) 
 {
-  char buf[MAXLINE], body[MAXBUF];
+  char body[MAXBUF];
+  outv_t o;
+  int n;
   /* Build the HTTP response body */
-  sprintf(body, "<html><title>Proxy Error</title>");
-  sprintf(body, "%s<body bgcolor="
-                "ffffff"
-                ">\r\n",
-          body);
-  sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-  sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-  sprintf(body, "%s<hr><em>The Simple Proxy Server</em>\r\n", body);
-  /* Print the HTTP response */
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  n = snprintf(body, sizeof(body), "<html><title>Proxy Error</title>"
+               "<body bgcolor=ffffff>\r\n%s: %s\r\n<p>%s: %s\r\n"
+               "<hr><em>The Simple Proxy Server</em>\r\n",
+               errnum, shortmsg, longmsg, cause);
+  if (n >= (int)sizeof(body))
+    n = sizeof(body) - 1;
+  /* Send the head and body with one writev */
+  outv_init(&o);
+  outv_printf(&o, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\n"
+              "Content-length: %d\r\n\r\n", errnum, shortmsg, n);
+  outv_add(&o, body, n);
+  outv_flush(&o, fd, 0);
 }
 
 
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE   /* accept4, splice, tee, memfd_create */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,304 +6,2429 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include "csapp.h"
+#include "ioeng.h"
+#include "coro.h"
+#include "http.h"
+#include "pool.h"
+#include "dns.h"
+#include "dial.h"
+#include "twheel.h"
+#include "reload.h"
+#include "affinity.h"
+#include "httpreq.h"
+#include "outv.h"
+#include "tunnel.h"
 
 /* 추천 최대 캐시 및 객체 크기 */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 #define NTHREADS 4
+#define HIT_THREADS 2            /* cache hit 전용 워커 (빠른 차선) */
+#define SLOW_THREADS 2           /* 느린 origin 전용 워커 */
+#define SLOW_ORIGIN_MS 500       /* 연결이나 첫 바이트가 평균 이보다 느리면 느린 origin */
+#define LANE_PENDING_MAX 1024    /* 분류기가 차선 큐가 차서 들고 있을 수 있는 연결 수 */
+#define LANE_RETRY_MS 10
+#define RQ_BUF_INIT 512          /* 요청 버퍼 첫 크기 */
+#define RQ_MAX (64 * 1024)       /* 요청 줄과 헤더를 합친 한도 (넘으면 끊는다) */
+#define RBUF_CLIENT (4 * 1024)   /* 클라이언트 Rio 버퍼 - 요청 줄과 헤더 (본문은 바로 읽는다) */
+#define RBUF_ORIGIN (64 * 1024)  /* origin Rio 버퍼 - 응답 머리와 본문 앞부분을 read 한 번에 */
 #define SBUFSIZE 16
+#define ACCEPT_BATCH 16   /* 리슨 소켓이 한 번 깨어날 때 최대 accept 수 */
+#define LOGQSIZE 1024     /* 연결 로그 큐 크기 (가득 차면 로그를 버림) */
+#define ZPIPE_SIZE (256 * 1024)  /* splice 릴레이 파이프 크기 (한 번에 옮기는 최대량) */
+#define POOL_MAX_PER_HOST 8      /* origin 하나에 남겨 둘 유휴 keep-alive 연결 수 */
+#define POOL_MAX_TOTAL 256       /* 모든 origin 을 합쳐 남겨 둘 유휴 연결 수 */
+#define POOL_IDLE_MS 15000       /* 이보다 오래 쉰 origin 연결은 닫는다 */
+#define CLIENT_IDLE_MS 5000      /* keep-alive 클라이언트가 다음 요청 없이 쉴 수 있는 시간 */
+#define CLIENT_MAX_REQS 100      /* 클라이언트 연결 하나에서 처리할 최대 요청 수 */
+#define PIPELINE_MAX 16          /* 한 연결에서 동시에 처리할 파이프라인 요청 수 */
+#define FREE_KEEP 4              /* 스레드마다 목록에 남겨 둘 창/파이프/버퍼 수 (나머지는 해제) */
+#define NRESOLVERS 2             /* 이름 풀이 스레드 수 */
+#define HEADER_MS 10000          /* 요청 줄부터 헤더 끝까지 (-t header=) */
+#define FIRST_BYTE_MS 30000      /* origin 에 요청을 보내고 상태 줄이 올 때까지 (-t first=) */
+#define ORIGIN_IDLE_MS 30000     /* 응답 도중 origin 이 말이 없는 시간 (-t idle=) */
+#define WRITE_STALL_MS 30000     /* 클라이언트로 한 번 쓰는 데 걸리는 시간 (-t write=) */
+#define TUNNEL_IDLE_MS 300000    /* CONNECT 터널의 양쪽이 다 조용한 시간 (-t tunnel=) */
+#define RELAY_WINDOW (256 * 1024) /* miss 릴레이가 클라이언트보다 앞서 읽어 둘 최대 바이트 (-w) */
+#define DRAIN_MS 30000           /* 종료/재시작 때 진행 중인 연결을 기다리는 최대 시간 */
+#define CACHE_MAGIC 0x50435831   /* cache_export 형식 ("PCX1") */
+
+/* doit 이 끝난 뒤 클라이언트 연결을 어떻게 할지 */
+#define CONN_CLOSE   0    /* 닫는다 */
+#define CONN_KEEP    1    /* 같은 rio_t 로 다음 요청을 읽는다 */
+#define CONN_HANDOFF 2    /* I/O 엔진이나 터널 스레드가 가져갔다 (그쪽이 닫는다) */
+
+/* fetch_origin 이 응답 본문을 클라이언트에 넘기는 방법 */
+#define BODY_PLAIN   0    /* 받은 그대로 (Content-Length 나 EOF 까지) */
+#define BODY_CHUNKED 1    /* chunked 를 그대로 - 1.1 클라이언트 */
+#define BODY_DECHUNK 2    /* chunked 를 풀어서 EOF 까지 - 1.0 클라이언트 */
+#define BODY_ENCHUNK 3    /* EOF 까지인 본문을 청크로 감싸서 - 1.1 클라이언트 */
+
+/* 워커 스레드 차선 - 분류기가 요청 줄을 보고 고른다 */
+#define LANE_HIT  0       /* cache hit (와 금방 끝나는 501) */
+#define LANE_MISS 1
+#define LANE_SLOW 2       /* 느리다고 알려진 origin */
+#define NLANES    3
 
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
 
-/* 캐시 구조체 */
-typedef struct cache_block {
-    char *url;
-    char *content;
-    size_t size;
-    int lru_counter;
-    struct cache_block *next;
-    struct cache_block *prev;
-} cache_block;
+/* 캐시 구조체 */
+typedef struct cache_block {
+    char *url;
+    char *content;
+    size_t size;
+    int lru_counter;
+    int refcnt;          /* 캐시 자신의 참조 1 + 지금 content 를 보내는 중인 수 */
+    struct cache *owner; /* 이 블록이 들어 있는 노드 캐시 */
+    struct cache_block *next;
+    struct cache_block *prev;
+} cache_block;
+
+/* NUMA 노드마다 하나 (-c 로 워커를 고정하지 않으면 하나뿐) */
+typedef struct cache {
+    cache_block *head;
+    cache_block *tail;
+    size_t total_size;
+    int counter;
+    sem_t mutex;
+    sem_t w;
+    int readcnt;
+    unsigned long hits;       /* 이 노드 워커의 hit */
+    unsigned long remote;     /* 그중 다른 노드 캐시에서 찾은 것 (로컬로 복제) */
+} cache_t;
+
+/* Shared buffer of connected descriptors */
+typedef struct {
+    int *buf;
+    int n;
+    int front;
+    int rear;
+    sem_t mutex;
+    sem_t slots;
+    sem_t items;
+} sbuf_t;
+
+/* 연결 로그 큐 - accept 경로에서는 주소만 넣고, 출력은 로그 스레드가 한다 */
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+} connlog_t;
+
+typedef struct {
+    connlog_t *buf;
+    int n;
+    int front;
+    int rear;
+    int count;
+    unsigned long dropped;   /* 큐가 가득 차서 버린 로그 수 */
+    sem_t mutex;
+    sem_t items;
+} logq_t;
+
+/*
+ * 파싱한 클라이언트 요청 - 요청 줄의 필드, origin 주소와 origin 에 보낼 헤더를
+ * 버퍼 하나에 NUL 로 끝나게 이어 담는다 (RQ_STR 로 꺼낸다). 필드는 버퍼가 커지며
+ * 옮겨 가도 되도록 포인터 대신 위치 (hslice_t) 로 둔다. 읽는 동안만 한 줄
+ * 만큼 여유를 두고, 다 읽으면 딱 맞게 줄인다. 파이프라인이면 여러 개가 동시에
+ * 살아 있어서 힙에 둔다.
+ */
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    hslice_t method, uri, version, hostname, port, path, header;
+    int keep;        /* 클라이언트가 이 응답 뒤에도 연결을 쓰겠다고 했다 */
+    int chunk_ok;    /* HTTP/1.1 클라이언트라 chunked 를 알아듣는다 */
+    int kind;        /* RQ_* */
+    long long body_len;  /* 요청 본문 - Content-Length, -1 이면 chunked, 0 이면 없음 */
+    int expect;      /* Expect: 100-continue - origin 에 보낸 뒤 100 을 대신 보낸다 */
+    hdr_id_t bypass; /* 캐시를 거치지 않게 한 헤더 (HDRF_CACHE/COND), 없으면 HDR_OTHER */
+} request_t;
+
+#define RQ_STR(rq, field) ((rq)->buf + (rq)->field.off)
+
+/* 요청 종류 - 캐시를 볼지, 캐시를 무효화할지, 터널을 열지 */
+#define RQ_GET     0
+#define RQ_HEAD    1      /* GET 캐시로 답한다 (본문 없이) */
+#define RQ_UNSAFE  2      /* POST, PUT, DELETE, PATCH - 성공하면 그 URL 캐시를 지운다 */
+#define RQ_CONNECT 3      /* host:port - 응답 대신 터널을 연다 */
+
+/*
+ * Rio 버퍼 - 연결에 붙박지 않고 바이트가 남아 있는 동안만 빌린다. 크기는
+ * 쓰임새마다 (RBUF_CLIENT, RBUF_ORIGIN) 달라서 rio_t 의 기본 버퍼 자리에
+ * 그 크기만큼만 잡고, 크기별 스레드 목록에 돌려놓는다.
+ */
+typedef struct rbuf {
+    struct rbuf *next;
+    size_t size;
+    rio_t rio;             /* 마지막 멤버여야 한다 (버퍼가 rio_ibuf 자리에 붙는다) */
+} rbuf_t;
+
+/*
+ * 분류기에서 다음 요청을 기다리는 연결의 상태 (fd 로 찾는다). 워커는 요청
+ * 사이에 Rio 버퍼가 비어 있으면 연결을 분류기에 돌려보내므로 요청 수는
+ * 여기 남겨 둔다.
+ */
+typedef struct {
+    tw_watch_t watch;     /* 분류기에서 기다리는 동안의 시간 제한 */
+    int nreq;             /* 이 연결에서 받은 요청 수 */
+} conn_state_t;
+
+/*
+ * 파이프라인 응답 자리 - 요청 순서대로 줄을 서고, miss 는 fetch 코루틴이
+ * 응답을 파이프(pw)에 쓰면 연결 코루틴이 차례가 왔을 때 pr 에서 꺼내 보낸다.
+ * 파이프가 차면 fetch 코루틴이 기다리므로 앞 응답이 느려도 메모리는 묶여 있다.
+ */
+#define SLOT_HIT  0
+#define SLOT_MISS 1
+#define SLOT_501  2
+#define SLOT_400  3
+#define SLOT_INLINE 4     /* 본문이 있거나 캐시를 지우는 요청 - 앞 응답들 뒤에 연결 코루틴이 직접 */
+typedef struct {
+    int type;
+    request_t rq;
+    cache_block *block;   /* SLOT_HIT: 참조를 잡아 둔 캐시 블록 */
+    int pr, pw;           /* SLOT_MISS: 응답 파이프 */
+    int keep;             /* SLOT_MISS: fetch 가 끝난 뒤 연결 유지 가능 여부 */
+    int refs;             /* 연결 코루틴 + fetch 코루틴 (같은 스레드라 락 없음) */
+} slot_t;
+
+/*
+ * 캐시에 넣을 응답 사본. 버퍼는 처음에 작게 잡고, 응답 머리를 다 읽어
+ * Content-Length 를 알면 머리 + 본문 크기로 딱 맞게 늘린다 (모르면 두 배씩,
+ * MAX_OBJECT_SIZE 까지). 200 이 아니거나 캐시 지시자가 막거나 한도를 넘으면
+ * 버퍼를 버리고 ok 를 내린 뒤 그만 모은다. chunked 나 EOF 까지인 응답은 본문을
+ * 풀어서 모으고 끝에 Content-Length 를 붙여 두므로 (capture_finish) 캐시에서
+ * 내줄 때는 언제나 길이가 정해진 응답이다.
+ */
+typedef struct {
+    char *buf;
+    size_t len, size;
+    size_t head;          /* 0 이 아니면 Content-Length 를 끼워 넣을 머리 끝 */
+    int ok;
+    http_resp_t resp;     /* origin 응답 머리를 해석한 것 (fetch_origin 이 채운다) */
+} capture_t;
+
+/*
+ * 릴레이 창 - origin 에서 읽은 응답을 클라이언트가 받아 갈 때까지 담아 두는
+ * 고리 버퍼 (크기 relay_window). 클라이언트가 느려도 창이 찰 때까지는 origin 을
+ * 계속 읽으므로 창보다 작은 응답은 origin 연결이 바로 풀로 돌아가고 캐시에도
+ * 바로 들어간다. 창이 차면 클라이언트가 받아 갈 때까지 origin 읽기를 멈춘다.
+ */
+typedef struct window {
+    int fd;                /* 클라이언트 (코루틴 파이프라인이면 slot 파이프) */
+    char *buf;
+    size_t start, len;     /* 보낼 바이트는 buf[start] 부터 len 개 (끝에서 앞으로 돌아간다) */
+    int epfd;              /* 코루틴이 origin 과 클라이언트를 함께 기다릴 때 (필요할 때 만든다) */
+    struct window *next;
+} window_t;
+
+/*
+ * splice 릴레이용 파이프 - 스레드별 목록에 모아 두고 재사용한다. 코루틴
+ * 모드에서는 한 스레드의 여러 릴레이가 동시에 진행되므로 릴레이마다 하나씩 빌린다.
+ */
+typedef struct zpipe {
+    int data[2];   /* origin -> (data) -> client */
+    int cap[2];    /* tee 로 복제한 캐시용 사본 */
+    int size;
+    struct zpipe *next;
+} zpipe_t;
+
+/* 함수 프로토타입 */
+void serve_conn(int fd);
+int wait_request(int fd, rio_t *rio, int ms);
+int read_request(rio_t *rio, int can_keep, request_t *rq);
+int rq_kind(const char *buf, hslice_t method);
+void request_free(request_t *rq);
+int doit(int fd, request_t *rq, rio_t *rio);
+int serve_pipeline(int fd, rio_t *rio, request_t *first, int *nreq);
+void slot_fetch(void *arg);
+void slot_put(slot_t *slot);
+int drain_pipe(int pfd, int fd);
+void request_error(int fd, request_t *rq, int rc);
+rio_t *rbuf_get(int fd, size_t size);
+void rbuf_put(rio_t *rp);
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
+int send_cached(int fd, cache_block *block, int *keep, int chunk_ok, int head_only);
+int client_framed(http_resp_t *resp, int chunk_ok);
+int fetch_origin(window_t *w, request_t *rq, rio_t *rio, outv_t *req, capture_t *cap,
+                 int *keep);
+int send_body(request_t *rq, rio_t *rio, int serverfd);
+int copy_body(rio_t *rio, int serverfd, long long len);
+int skip_interim(rio_t *rp, char *line, ssize_t *n);
+int status_11(char *head, size_t *hlen, size_t size, const http_resp_t *resp);
+void deadline(tw_watch_t *wt, int fd, int ms);
+int deadline_clear(tw_watch_t *wt);
+ssize_t client_write(int fd, void *buf, size_t n);
+ssize_t client_writev(int fd, outv_t *o);
+ssize_t client_readline(rio_t *rp, char *buf);
+ssize_t origin_write(int fd, void *buf, size_t n);
+ssize_t origin_readline(rio_t *rp, char *buf, int ms);
+ssize_t origin_read(rio_t *rp, char *buf, size_t n);
+window_t *window_get(int fd);
+void window_put(window_t *w);
+char *window_space(window_t *w, size_t *room);
+int window_write(window_t *w, char *p, size_t n);
+int window_flush(window_t *w);
+int window_wait(window_t *w, rio_t *rp);
+int window_drain(window_t *w);
+void capture_init(capture_t *cap);
+int capture_reserve(capture_t *cap, size_t n);
+void capture_drop(capture_t *cap);
+void capture_add(capture_t *cap, char *p, size_t n);
+void capture_finish(capture_t *cap);
+int relay_out(window_t *w, char *p, size_t n, capture_t *cap);
+int relay_length(rio_t *rp, window_t *w, long long len, capture_t *cap);
+int blank_line(const char *line);
+int relay_chunked(rio_t *rp, window_t *w, capture_t *cap, int pass);
+int relay_enchunk(rio_t *rp, window_t *w, capture_t *cap);
+ssize_t relay_splice(zpipe_t *zp, int serverfd, int clientfd, capture_t *cap, long long limit);
+zpipe_t *zpipe_get(void);
+void zpipe_put(zpipe_t *zp);
+int zpipe_reset(zpipe_t *zp);
+int relay_via_engine(int fd, char *uri, char *hostname, char *port, char *path, char *request_header,
+                     size_t capture_max);
+void relay_done(void *arg, int clientfd, int status, char *capture, size_t caplen);
+int tunnel(int fd, rio_t *rio, request_t *rq);
+void tunnel_done(int clientfd);
+int engine_accept(int *fds, int n);
+void *thread(void *vargp);
+void lanes_init(void);
+void lane_park(int fd, int ms);
+int classify(char *buf, size_t len);
+void *classify_thread(void *vargp);
+void *sched_thread(void *vargp);
+void conn_coro(void *arg);
+void coro_dispatch(int *fds, int n);
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, int item);
+void sbuf_insert_batch(sbuf_t *sp, int *items, int n);
+int sbuf_tryinsert_batch(sbuf_t *sp, int *items, int n);
+int sbuf_remove(sbuf_t *sp);
+
+/* accept 파이프라인 */
+int accept_batch(int listenfd, int flags, int *fds, connlog_t *peers, int max);
+void logq_init(logq_t *lq, int n);
+void logq_push_batch(logq_t *lq, connlog_t *peers, int n);
+void *log_thread(void *vargp);
+void *signal_thread(void *vargp);
+
+/* 캐시 함수 */
+void cache_init(cache_t *cache);
+cache_t *node_cache(void);
+cache_block *cache_get(char *url);
+int cache_contains(char *url);
+void cache_touch(cache_block *block);
+void cache_put(char *url, char *content, size_t size);
+void cache_invalidate(char *url);
+void cache_stats_dump(FILE *fp);
+cache_block *cache_find(cache_t *cache, char *url);
+cache_block *cache_lookup(cache_t *cache, char *url);
+void cache_release(cache_block *block);
+void cache_insert(cache_t *cache, char *url, char *content, size_t size);
+void cache_evict(cache_t *cache, size_t needed_size);
+void cache_remove_block(cache_t *cache, cache_block *block);
+int cache_export(void);
+void cache_import(cache_t *cache, int fd);
+
+/* 종료와 재시작 */
+void begin_drain(void);
+void drain_and_exit(void);
+
+/* 전역 변수 */
+sbuf_t sbuf;                       /* 보통 차선 (엔진 모드에서는 유일한 큐) */
+sbuf_t hit_sbuf, slow_sbuf;
+sbuf_t *lanes[NLANES] = {&hit_sbuf, &sbuf, &slow_sbuf};
+int lane_epfd = -1;                /* 분류기가 요청을 기다리는 연결들 (워커 스레드 모드만) */
+conn_state_t *conns;
+int nconns;
+cache_t caches[AFF_MAXNODES];
+int ncaches = 1;
+char *pin_cpus;          /* -c: 워커를 고정할 CPU (NULL = 고정하지 않음) */
+static int next_pin;
+logq_t logq;
+int zerocopy = 0;   /* -z: miss 릴레이를 splice/tee 로 */
+int coro_mode = 0;  /* -m coro: 워커 스레드 대신 스레드마다 코루틴 스케줄러 */
+coro_sched_t *scheds[NTHREADS];
+static __thread zpipe_t *zpipe_free;
+static __thread window_t *window_free;
+static __thread rbuf_t *rbuf_free[2];     /* [0] RBUF_CLIENT, [1] RBUF_ORIGIN */
+static __thread int nzpipe_free, nwindow_free, nrbuf_free[2];
+size_t relay_window = RELAY_WINDOW;
+
+/* 종료/재시작 - 진행 중인 연결 수 (엔진에 넘긴 릴레이 포함) */
+char **saved_argv;
+int listen_fd = -1;
+int share_cache = 0;     /* -s: 재시작할 때 캐시를 새 프로세스에 넘긴다 */
+int stop_pipe[2];        /* signal_thread -> 메인 스레드: accept 를 멈춰라 */
+volatile int draining;
+static int active_conns;
+
+/* 단계별 시간 제한 (ms) */
+int header_ms = HEADER_MS, connect_ms = DIAL_ATTEMPT_MS, first_ms = FIRST_BYTE_MS;
+int idle_ms = ORIGIN_IDLE_MS, write_ms = WRITE_STALL_MS, tunnel_ms = TUNNEL_IDLE_MS;
+static __thread tw_watch_t client_watch, origin_watch;   /* 워커 스레드용 (코루틴은 coro_deadline) */
+
+int main(int argc, char **argv) {
+    int listenfd, n, opt, bad = 0, inherited[RELOAD_MAXFDS];
+    int connfds[ACCEPT_BATCH];
+    connlog_t peers[ACCEPT_BATCH];
+    struct pollfd pfd[2];
+    pthread_t tid;
+    char *engine = NULL;
+    int accept_flags = SOCK_CLOEXEC;
+    sigset_t sigs;
+    char *subopts, *value;
+    char *const timeouts[] = {"header", "connect", "first", "idle", "write", "tunnel", NULL};
+    int *timeout_vars[] = {&header_ms, &connect_ms, &first_ms, &idle_ms, &write_ms, &tunnel_ms};
+
+    /* SIGPIPE 무시 */
+    Signal(SIGPIPE, SIG_IGN);
+
+    /*
+     * SIGUSR1 (통계), SIGUSR2 (재시작), SIGTERM (종료) 는 signal_thread 만
+     * 받는다 (모든 스레드가 이 마스크를 물려받음)
+     */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGUSR2);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    saved_argv = argv;
+
+    /*
+     * -e uring|epoll : 캐시 miss 릴레이와 accept 를 I/O 엔진 스레드에 맡긴다.
+     *                  엔진은 origin 에 HTTP/1.0 + Connection: close 로 묻고
+     *                  EOF 까지 그대로 옮기므로, 엔진이 맡은 miss 에는 origin
+     *                  풀, chunked 처리, 1xx 건너뛰기, 시간 제한이 없다
+     * -z             : 워커의 miss 릴레이를 splice/tee 로 (유저 공간 복사 없음)
+     * -m coro        : 연결마다 코루틴 하나 (doit 은 그대로, I/O 대기 때 양보)
+     * -t name=ms,... : 시간 제한 (header, connect, first, idle, write, tunnel)
+     * -w bytes       : miss 릴레이 창 크기 (클라이언트보다 앞서 읽어 둘 양)
+     * -s             : SIGUSR2 재시작 때 캐시를 공유 메모리로 새 프로세스에 넘긴다
+     * -c auto|cpus   : 워커를 CPU 하나씩에 고정하고 캐시를 NUMA 노드마다 둔다
+     *                  (auto = 쓸 수 있는 CPU 전부, 아니면 "0-7,16-23" 꼴의 목록)
+     */
+    while ((opt = getopt(argc, argv, "e:zm:t:w:sc:")) != -1) {
+        switch (opt) {
+        case 'e':
+            engine = optarg;
+            break;
+        case 'z':
+            zerocopy = 1;
+            break;
+        case 'm':
+            if (!strcmp(optarg, "coro"))
+                coro_mode = 1;
+            else if (strcmp(optarg, "threads"))
+                bad = 1;
+            break;
+        case 't':
+            subopts = optarg;
+            while (*subopts) {
+                int i = getsubopt(&subopts, timeouts, &value);
+
+                if (i < 0 || !value || atoi(value) <= 0) {
+                    bad = 1;
+                    break;
+                }
+                *timeout_vars[i] = atoi(value);
+            }
+            break;
+        case 'w':
+            if (atol(optarg) <= 0)
+                bad = 1;
+            relay_window = atol(optarg);
+            break;
+        case 's':
+            share_cache = 1;
+            break;
+        case 'c':
+            pin_cpus = optarg;
+            if (aff_init(strcmp(optarg, "auto") ? optarg : NULL) < 0)
+                bad = 1;
+            break;
+        default:
+            bad = 1;
+        }
+    }
+    if (bad || optind != argc - 1 || (coro_mode && engine)) {
+        fprintf(stderr, "usage: %s <port> [-e uring|epoll | -m threads|coro] [-z] "
+                "[-t header|connect|first|idle|write|tunnel=ms,...] [-w bytes] [-s] [-c auto|cpus]\n", argv[0]);
+        exit(1);
+    }
+
+    /* 캐시 초기화 - 재시작으로 떴으면 리슨 소켓과 (있으면) 옛 캐시를 넘겨받는다 */
+    ncaches = aff_nodes();
+    for (int i = 0; i < ncaches; i++)
+        cache_init(&caches[i]);
+    if (pin_cpus)
+        printf("Pinning workers to %d NUMA node(s)\n", ncaches);
+    if ((n = reload_inherit(inherited, RELOAD_MAXFDS)) > 0) {
+        listen_fd = inherited[0];
+        for (int i = 1; i < n; i++) {
+            cache_import(&caches[0], inherited[i]);
+            Close(inherited[i]);
+        }
+    }
+    if (pipe2(stop_pipe, O_CLOEXEC) < 0)
+        unix_error("pipe2 error");
+    pool_init(POOL_MAX_PER_HOST, POOL_MAX_TOTAL, POOL_IDLE_MS);
+    dns_init(NRESOLVERS);
+    dial_init(connect_ms);
+    tw_watchdog_start();
+    tunnel_init(tunnel_ms, tunnel_done);
+    Pthread_create(&tid, NULL, signal_thread, NULL);
+
+    /* Shared buffer 초기화 */
+    sbuf_init(&sbuf, SBUFSIZE);
+
+    /* 워커 스레드 생성 (코루틴 모드면 스케줄러 스레드) */
+    for (int i = 0; i < NTHREADS; i++) {
+        if (coro_mode) {
+            scheds[i] = coro_sched_create();
+            Pthread_create(&tid, NULL, sched_thread, scheds[i]);
+        } else {
+            Pthread_create(&tid, NULL, thread, &sbuf);
+        }
+    }
+
+    /*
+     * 워커 스레드 모드는 요청 줄을 먼저 보고 차선을 나눈다. hit 이 origin 을
+     * 기다리는 miss 뒤에 줄 서지 않도록. 코루틴은 miss 가 양보하므로 필요 없고,
+     * 엔진 모드는 miss 를 엔진이 가져가므로 워커가 오래 막히지 않는다.
+     */
+    if (!coro_mode && !engine) {
+        lanes_init();
+        for (int i = 0; i < HIT_THREADS; i++)
+            Pthread_create(&tid, NULL, thread, &hit_sbuf);
+        for (int i = 0; i < SLOW_THREADS; i++)
+            Pthread_create(&tid, NULL, thread, &slow_sbuf);
+    }
+
+    /* 연결 로그는 별도 스레드가 출력 (accept 경로에서 printf/DNS 제거) */
+    logq_init(&logq, LOGQSIZE);
+    Pthread_create(&tid, NULL, log_thread, NULL);
+
+    /* 재시작으로 넘겨받을 때는 SCM_RIGHTS 로만 가도록 exec 너머로는 물려주지 않는다 */
+    if (listen_fd < 0)
+        listen_fd = Open_listenfd(argv[optind]);
+    listenfd = listen_fd;
+    fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+
+    /* 엔진 모드: accept 도 엔진 스레드가 하고 메인 스레드는 멈추라는 말만 기다린다 */
+    if (engine) {
+        ioeng_init(engine);
+        printf("I/O engine: %s\n", ioeng_name());
+        ioeng_start(listenfd, SOCK_CLOEXEC, engine_accept);
+        reload_ready();
+        while (read(stop_pipe[0], &n, 1) < 0 && errno == EINTR)
+            ;
+        ioeng_stop_accept();
+        drain_and_exit();
+    }
+
+    /* 리슨 소켓은 논블로킹 - poll 로 깨어난 뒤 EAGAIN 까지 한꺼번에 accept */
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL, 0) | O_NONBLOCK);
+    pfd[0].fd = listenfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = stop_pipe[0];
+    pfd[1].events = POLLIN;
+
+    /*
+     * 워커 스레드는 블로킹 Rio 를 쓰므로 연결 소켓에 SOCK_NONBLOCK 을 주지 않는다.
+     * 코루틴은 논블로킹이어야 EAGAIN 에서 스케줄러로 양보할 수 있다.
+     */
+    if (coro_mode)
+        accept_flags |= SOCK_NONBLOCK;
+
+    reload_ready();
+    while (1) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("poll error");
+        }
+        if (pfd[1].revents)     /* 종료/재시작 - 리슨 소켓은 새 프로세스 몫 */
+            break;
+        n = accept_batch(listenfd, accept_flags, connfds, peers, ACCEPT_BATCH);
+        if (n > 0) {
+            __atomic_add_fetch(&active_conns, n, __ATOMIC_RELAXED);
+            if (coro_mode) {
+                coro_dispatch(connfds, n);
+            } else {
+                for (int i = 0; i < n; i++) {
+                    if (connfds[i] < nconns)    /* fd 번호는 다시 쓰인다 - 요청 수를 새로 */
+                        conns[connfds[i]].nreq = 0;
+                    lane_park(connfds[i], header_ms);
+                }
+            }
+            logq_push_batch(&logq, peers, n);
+        }
+    }
+    Close(listenfd);
+    drain_and_exit();
+    return 0;
+}
+
+/* 워커 스레드 루틴 - vargp 는 이 워커가 맡은 차선 */
+void *thread(void *vargp) {
+    sbuf_t *sp = vargp;
+
+    Pthread_detach(pthread_self());
+    if (pin_cpus)
+        aff_pin(__atomic_fetch_add(&next_pin, 1, __ATOMIC_RELAXED));
+    while (1) {
+        int connfd = sbuf_remove(sp);
+        serve_conn(connfd);
+    }
+    return NULL;
+}
+
+/* 분류기와 빠른/느린 차선을 만든다 */
+void lanes_init(void) {
+    struct rlimit rl;
+    pthread_t tid;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        unix_error("getrlimit error");
+    nconns = rl.rlim_cur == RLIM_INFINITY ? 65536 : rl.rlim_cur;
+    conns = Calloc(nconns, sizeof(conn_state_t));
+    if ((lane_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        unix_error("epoll_create1 error");
+    sbuf_init(&hit_sbuf, SBUFSIZE);
+    sbuf_init(&slow_sbuf, SBUFSIZE);
+    Pthread_create(&tid, NULL, classify_thread, NULL);
+}
+
+/*
+ * lane_park - 연결을 분류기에 맡긴다 (아무 스레드에서나). 다음 요청이 ms 안에
+ *     오지 않으면 watchdog 이 끊고 분류기가 닫는다.
+ */
+void lane_park(int fd, int ms) {
+    struct epoll_event ev;
+
+    if (fd >= nconns) {          /* 상태를 둘 자리가 없다 - 분류 없이 보통 차선으로 */
+        sbuf_insert(&sbuf, fd);
+        return;
+    }
+    tw_watch(&conns[fd].watch, fd, ms);
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(lane_epfd, EPOLL_CTL_MOD, fd, &ev) < 0 &&
+        (errno != ENOENT || epoll_ctl(lane_epfd, EPOLL_CTL_ADD, fd, &ev) < 0))
+        unix_error("epoll_ctl error");
+}
+
+/*
+ * classify - 들여다본 buf[0..len) (요청 줄이 다 와 있다) 로 차선을 고른다.
+ *     hit 은 빠른 차선, 느리다고 알려진 origin 은 느린 차선, 나머지 miss 는
+ *     보통 차선. 본문을 올려 보내는 요청은 언제나 보통 차선이다 (캐시로 답하지
+ *     않고, 업로드가 느린 클라이언트가 빠른 차선을 붙잡지 않도록). 캐시에 있는
+ *     URL 이라도 캐시를 거치지 않게 하는 헤더 (read_request 의 bypass 와 같은
+ *     HDRF_CACHE/HDRF_COND) 가 있거나 머리가 아직 다 오지 않아 그런 헤더가 없다고
+ *     말할 수 없으면 origin 에 가므로 miss 로 본다. 필드는 buf 안에서 NUL 로
+ *     닫아 쓴다.
+ */
+int classify(char *buf, size_t len) {
+    hreq_t hr;
+    hreq_uri_t *u = &hr.uri;
+    int rc, bypass = 0;
+
+    hreq_init(&hr);
+    if ((rc = hreq_parse(&hr, buf, len)) < 0)
+        return LANE_HIT;          /* 400 으로 바로 끝난다 */
+    if (!hr.method.len)
+        return LANE_MISS;         /* 앞의 빈 줄뿐 - 요청 줄이 아직 안 왔다 */
+    switch (rq_kind(buf, hr.method)) {
+    case RQ_CONNECT:              /* 연결만 하고 터널 스레드에 넘긴다 */
+    case RQ_UNSAFE:
+        return LANE_MISS;
+    case -1:
+        return LANE_HIT;          /* 501 */
+    }
+    for (int i = 0; i < hr.nhdrs && !bypass; i++)
+        bypass = hdr_flags(hr.hdrs[i].id) & (HDRF_CACHE | HDRF_COND);
+    buf[hr.target.off + hr.target.len] = '\0';
+    if (rc == HREQ_DONE && !bypass && cache_contains(buf + hr.target.off))
+        return LANE_HIT;
+    if (!u->host.len)
+        return LANE_MISS;
+    buf[u->host.off + u->host.len] = '\0';
+    if (u->port.len)
+        buf[u->port.off + u->port.len] = '\0';
+    return dial_slow(buf + u->host.off, u->port.len ? buf + u->port.off : "80",
+                     SLOW_ORIGIN_MS) ? LANE_SLOW : LANE_MISS;
+}
+
+/*
+ * classify_thread - 요청이 오기 시작한 연결의 첫 줄을 MSG_PEEK 로 들여다보고
+ *     (읽어 가지 않으므로 워커는 평소처럼 Rio 로 읽는다) 차선에 넣는다. 첫 줄이
+ *     아직 다 오지 않았으면 기다리지 않고 보통 차선으로 보낸다. 차선 큐가 차면
+ *     엔진의 accept 처럼 잠시 들고 있다가 다시 넣는다 - 분류기는 막히지 않는다.
+ */
+void *classify_thread(void *vargp) {
+    struct epoll_event evs[64];
+    char buf[MAXLINE];
+    static int pending[NLANES][LANE_PENDING_MAX];
+    int npend[NLANES] = {0}, n, fd, lane, k, busy;
+    ssize_t len;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        busy = 0;
+        for (lane = 0; lane < NLANES; lane++)
+            busy |= npend[lane];
+        n = epoll_wait(lane_epfd, evs, 64, busy ? LANE_RETRY_MS : -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+        for (int i = 0; i < n; i++) {
+            fd = evs[i].data.fd;
+            len = recv(fd, buf, sizeof(buf) - 1, MSG_PEEK | MSG_DONTWAIT);
+            if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+                evs[i].events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                epoll_ctl(lane_epfd, EPOLL_CTL_MOD, fd, &evs[i]);
+                continue;
+            }
+            /* 닫혔거나 시간이 다 되어 watchdog 이 끊었다 */
+            if (tw_unwatch(&conns[fd].watch) || len <= 0) {
+                Close(fd);
+                __atomic_sub_fetch(&active_conns, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            buf[len] = '\0';
+            lane = memchr(buf, '\n', len) ? classify(buf, len) : LANE_MISS;
+            if (npend[lane] == 0 && sbuf_tryinsert_batch(lanes[lane], &fd, 1) == 1)
+                continue;
+            if (npend[lane] == LANE_PENDING_MAX)
+                sbuf_insert(lanes[lane], fd);   /* 최후의 수단 - 기다린다 */
+            else
+                pending[lane][npend[lane]++] = fd;
+        }
+
+        /* 들고 있던 연결을 차선에 다시 넣어 본다 */
+        for (lane = 0; lane < NLANES; lane++) {
+            if (!npend[lane])
+                continue;
+            k = sbuf_tryinsert_batch(lanes[lane], pending[lane], npend[lane]);
+            memmove(pending[lane], pending[lane] + k, (npend[lane] - k) * sizeof(int));
+            npend[lane] -= k;
+        }
+    }
+    return NULL;
+}
+
+/* 코루틴 스케줄러 스레드 - 연결은 coro_dispatch 가 보내 준다 */
+void *sched_thread(void *vargp) {
+    Pthread_detach(pthread_self());
+    if (pin_cpus)
+        aff_pin(__atomic_fetch_add(&next_pin, 1, __ATOMIC_RELAXED));
+    coro_sched_run(vargp);
+    return NULL;
+}
+
+/* 연결 하나를 맡는 코루틴 - 워커 스레드 루틴의 한 바퀴와 같다 */
+void conn_coro(void *arg) {
+    serve_conn((int)(long)arg);
+}
+
+/* accept 한 연결들을 스케줄러에 돌아가며 나눠 준다 (스케줄러당 post 한 번) */
+void coro_dispatch(int *fds, int n) {
+    static int next;
+    void *args[NTHREADS][ACCEPT_BATCH];
+    int cnt[NTHREADS] = {0};
+
+    for (int i = 0; i < n; i++) {
+        args[next][cnt[next]++] = (void *)(long)fds[i];
+        next = (next + 1) % NTHREADS;
+    }
+    for (int i = 0; i < NTHREADS; i++)
+        coro_post(scheds[i], conn_coro, args[i], cnt[i]);
+}
+
+/*
+ * serve_conn - 클라이언트 연결 하나를 끝까지 처리한다. keep-alive 면 같은
+ *     rio_t 로 다음 요청을 읽는다 (버퍼에 남은 바이트를 버리지 않는다).
+ *     요청 사이에 CLIENT_IDLE_MS 동안 아무것도 오지 않으면 닫는다.
+ *     분류기가 있으면 (워커 스레드 모드) 요청 사이에 버퍼가 비었을 때 연결을
+ *     분류기에 돌려보낸다 - 다음 요청은 그 종류에 맞는 차선의 워커가 맡는다.
+ *     코루틴이고 다음 요청들이 이미 버퍼에 와 있으면 (파이프라인) 한꺼번에 처리한다.
+ */
+void serve_conn(int fd) {
+    rio_t *rio = NULL;
+    request_t rq;
+    int rc = CONN_KEEP, nreq = 0, base = 0;
+    int park = lane_epfd >= 0 && fd < nconns;
+
+    if (park)
+        base = conns[fd].nreq;
+    while (rc == CONN_KEEP) {
+        /* 요청 사이에 버퍼가 비었으면 돌려준다 - 쉬는 연결은 버퍼를 잡지 않는다 */
+        if (rio && rio->rio_cnt == 0) {
+            rbuf_put(rio);
+            rio = NULL;
+        }
+        if (nreq > 0 && park && !rio && !draining) {
+            conns[fd].nreq = base + nreq;
+            lane_park(fd, CLIENT_IDLE_MS);
+            return;                 /* 이제 fd 는 분류기 것 */
+        }
+        /* 빠지는 중이면 요청 사이에서 닫는다 (이미 와 있는 요청은 처리) */
+        if (nreq > 0 && ((draining && !rio) || !wait_request(fd, rio, CLIENT_IDLE_MS)))
+            break;
+        if (!rio)
+            rio = rbuf_get(fd, RBUF_CLIENT);
+        deadline(&client_watch, fd, header_ms);
+        rc = read_request(rio, base + ++nreq < CLIENT_MAX_REQS, &rq);
+        deadline_clear(&client_watch);
+        if (rc < 0) {
+            /* 요청 본문 길이를 모르므로 다음 요청 위치도 모른다 - 닫는다 */
+            request_error(fd, &rq, rc);
+            request_free(&rq);
+            rc = CONN_CLOSE;
+        } else if (rc > 0 && rq.kind == RQ_CONNECT) {
+            rc = tunnel(fd, rio, &rq);
+            request_free(&rq);
+        } else if (rc > 0) {
+            if (coro_active() && rio->rio_cnt > 0 && rq.keep)
+                rc = serve_pipeline(fd, rio, &rq, &nreq);
+            else {
+                rc = doit(fd, &rq, rio);
+                request_free(&rq);
+            }
+        }
+    }
+    if (rio)
+        rbuf_put(rio);
+    if (rc != CONN_HANDOFF) {   /* 엔진에 넘긴 연결은 엔진 쪽에서 닫는다 */
+        Close(fd);
+        __atomic_sub_fetch(&active_conns, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* 다음 요청이 ms 안에 오기 시작하면 1 (이미 버퍼에 있으면 바로), 아니면 0 */
+int wait_request(int fd, rio_t *rio, int ms) {
+    struct pollfd pfd;
+    int n;
+
+    if (rio && rio->rio_cnt > 0)
+        return 1;
+    if (coro_active())          /* 스케줄러 스레드를 막지 않고 코루틴만 재운다 */
+        return coro_wait_fd_timeout(fd, POLLIN, ms) == 0;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while ((n = poll(&pfd, 1, ms)) < 0 && errno == EINTR)
+        ;
+    return n > 0;
+}
+
+/* size (RBUF_CLIENT 나 RBUF_ORIGIN) 짜리 rbuf 를 빌려 fd 로 초기화한다 (스레드별 목록, 없으면 새로) */
+rio_t *rbuf_get(int fd, size_t size) {
+    rbuf_t **list = &rbuf_free[size == RBUF_ORIGIN], *rb = *list;
+
+    if (rb) {
+        *list = rb->next;
+        nrbuf_free[size == RBUF_ORIGIN]--;
+    } else {
+        rb = Malloc(offsetof(rbuf_t, rio.rio_ibuf) + size);
+        rb->size = size;
+    }
+    rio_readinitb_buf(&rb->rio, fd, rb->rio.rio_ibuf, size);
+    return &rb->rio;
+}
+
+void rbuf_put(rio_t *rp) {
+    rbuf_t *rb = (rbuf_t *)((char *)rp - offsetof(rbuf_t, rio));
+    int i = rb->size == RBUF_ORIGIN;
+
+    if (nrbuf_free[i] == FREE_KEEP) {
+        Free(rb);
+        return;
+    }
+    rb->next = rbuf_free[i];
+    rbuf_free[i] = rb;
+    nrbuf_free[i]++;
+}
+
+/* rq->buf 끝에 n 바이트 자리를 만든다 */
+static void rq_reserve(request_t *rq, size_t n) {
+    if (rq->len + n <= rq->cap)
+        return;
+    while (rq->len + n > rq->cap)
+        rq->cap = rq->cap ? rq->cap * 2 : RQ_BUF_INIT;
+    rq->buf = Realloc(rq->buf, rq->cap);
+}
+
+static void rq_put(request_t *rq, const char *p, size_t n) {
+    rq_reserve(rq, n);
+    memcpy(rq->buf + rq->len, p, n);
+    rq->len += n;
+}
+
+/* 버퍼 안의 off 에서 n 바이트를 끝에 붙인다 (Realloc 뒤의 위치에서 복사) */
+static void rq_put_self(request_t *rq, size_t off, size_t n) {
+    rq_reserve(rq, n);
+    memcpy(rq->buf + rq->len, rq->buf + off, n);
+    rq->len += n;
+}
+
+/* start 부터 지금까지를 NUL 로 끝나는 필드로 닫는다 */
+static hslice_t rq_field(request_t *rq, size_t start) {
+    hslice_t v = { start, rq->len - start };
+
+    rq_put(rq, "", 1);
+    return v;
+}
+
+/* 한 줄을 버퍼 끝에 읽어 붙인다 (NUL 은 붙이지만 len 에는 넣지 않는다) */
+static ssize_t rq_readline(rio_t *rio, request_t *rq) {
+    ssize_t n;
+
+    rq_reserve(rq, MAXLINE);
+    if ((n = rio_readlineb(rio, rq->buf + rq->len, MAXLINE)) > 0)
+        rq->len += n;
+    return n;
+}
+
+/* 헤더 하나를 "이름: 값\r\n" 으로 끝에 붙인다 */
+static void rq_put_header(request_t *rq, const hreq_hdr_t *h) {
+    rq_put_self(rq, h->name.off, h->name.len);
+    rq_put(rq, ": ", 2);
+    rq_put_self(rq, h->value.off, h->value.len);
+    rq_put(rq, "\r\n", 2);
+}
+
+/* method 로 요청 종류 (RQ_*), 지원하지 않는 메서드면 -1 */
+int rq_kind(const char *buf, hslice_t method) {
+    static const char *unsafe[] = {"POST", "PUT", "DELETE", "PATCH"};
+
+    if (hreq_is(buf, method, "GET"))
+        return RQ_GET;
+    if (hreq_is(buf, method, "HEAD"))
+        return RQ_HEAD;
+    if (hreq_is(buf, method, "CONNECT"))
+        return RQ_CONNECT;
+    for (size_t i = 0; i < sizeof(unsafe) / sizeof(unsafe[0]); i++)
+        if (hreq_is(buf, method, unsafe[i]))
+            return RQ_UNSAFE;
+    return -1;
+}
+
+/* Content-Length 값 - 숫자만, 아니면 -1 */
+static long long rq_length(const char *buf, hslice_t v) {
+    long long len = 0;
+
+    if (v.len == 0 || v.len > 18)
+        return -1;
+    for (size_t i = 0; i < v.len; i++) {
+        if (!isdigit((unsigned char)buf[v.off + i]))
+            return -1;
+        len = len * 10 + (buf[v.off + i] - '0');
+    }
+    return len;
+}
+
+/*
+ * read_request - 요청 줄과 헤더를 끝까지 읽어 rq 를 채운다. GET, HEAD, 본문을
+ *     올려 보내는 POST/PUT/DELETE/PATCH, CONNECT (대상은 host:port 꼴만) 면 1
+ *     (rq->kind), EOF/에러 (또는 RQ_MAX, HREQ_MAXHDRS 를 넘는 요청) 면 0,
+ *     지원하지 않는 메서드면 -1, 형식이 틀린 요청이면 -2. 0 이 아니면 호출한
+ *     쪽이 request_free 해야 한다. can_keep 이 0 이면 (요청 수 한도) 클라이언트가
+ *     원해도 keep 을 내린다.
+ *
+ *     본문은 읽지 않는다 - 틀 (rq->body_len) 만 정해 두면 doit 이 origin 으로
+ *     흘려 보낸다. Transfer-Encoding 은 chunked 로 끝나야 하고 Content-Length 와
+ *     함께 오면 안 된다 (요청 밀반입을 막는다, RFC 9112 6.3).
+ *
+ *     읽은 줄을 버퍼에 이어 붙이며 hreq_parse 로 그 자리에서 나눈다. 버퍼 배치:
+ *     요청 줄 (method, uri, version 뒤의 공백이 NUL 로 바뀐 채 - path 도 uri 의
+ *     끝부분을 그대로 쓴다), origin 에 보낼 헤더, hostname, port. 헤더는 끝에
+ *     Host, Connection, User-Agent 를 앞세워 새로 엮은 뒤 클라이언트 헤더가
+ *     있던 자리로 당긴다.
+ */
+int read_request(rio_t *rio, int can_keep, request_t *rq) {
+    hreq_t hr;
+    hreq_uri_t *u = &hr.uri;
+    const char *conn_hdr;
+    size_t start;
+    ssize_t n;
+    int rc, conn = -1, host = -1, te = -1;
+    long long cl = -1, v;
+
+    memset(rq, 0, sizeof(*rq));
+    hreq_init(&hr);
+    /* 캐시 hit 이어도 헤더를 끝까지 읽어야 다음 요청의 시작을 찾을 수 있다 */
+    while ((rc = hreq_parse(&hr, rq->buf, rq->len)) == HREQ_AGAIN) {
+        if ((n = rq_readline(rio, rq)) <= 0 || rq->len > RQ_MAX) {
+            request_free(rq);   /* EOF, 헤더 도중에 끊겼거나 시간 제한 */
+            return 0;
+        }
+    }
+    if (rc == HREQ_TOOBIG) {
+        request_free(rq);
+        return 0;
+    }
+    if (rc == HREQ_ERROR)
+        return -2;
+
+    /* 요청 줄의 필드를 그 자리에서 NUL 로 닫는다 (뒤는 공백이나 줄 끝) */
+    rq->method = hr.method;
+    rq->uri = hr.target;
+    rq->version = hr.version.len ? hr.version
+                                 : (hslice_t){ hr.target.off + hr.target.len, 0 };
+    rq->buf[hr.method.off + hr.method.len] = '\0';
+    rq->buf[hr.target.off + hr.target.len] = '\0';
+    rq->buf[rq->version.off + rq->version.len] = '\0';
+    if ((rq->kind = rq_kind(rq->buf, hr.method)) < 0)
+        return -1;
+    if (rq->kind == RQ_CONNECT && (!u->host.len || !u->port.len || u->path.len))
+        return -2;
+    rq->path = u->path;
+
+    /* 어느 헤더를 넘길지 - 같은 이름이 여럿이면 Connection 계열은 마지막 것 */
+    for (int i = 0; i < hr.nhdrs; i++) {
+        hslice_t value = hr.hdrs[i].value;
+
+        if (!rq->bypass && (hdr_flags(hr.hdrs[i].id) & (HDRF_CACHE | HDRF_COND)))
+            rq->bypass = hr.hdrs[i].id;
+        switch (hr.hdrs[i].id) {
+        case HDR_HOST:
+            if (host < 0)
+                host = i;
+            break;
+        case HDR_CONNECTION:
+        case HDR_PROXY_CONNECTION:
+            if (hreq_has_token(rq->buf, value, "close"))
+                conn = 0;
+            else if (hreq_has_token(rq->buf, value, "keep-alive"))
+                conn = 1;
+            break;
+        case HDR_CONTENT_LENGTH:
+            if ((v = rq_length(rq->buf, value)) < 0 || (cl >= 0 && v != cl))
+                return -2;
+            cl = v;
+            break;
+        case HDR_TRANSFER_ENCODING:
+            te = i;
+            rq->body_len = -1;
+            break;
+        case HDR_EXPECT:
+            rq->expect = hreq_has_token(rq->buf, value, "100-continue");
+            break;
+        default:
+            break;
+        }
+    }
+    /* 본문 틀 - chunked 가 마지막이 아닌 Transfer-Encoding 은 끝을 알 수 없다 */
+    if (te >= 0) {
+        hslice_t val = hr.hdrs[te].value;
+
+        if (cl >= 0 || hr.minor < 1 || val.len < 7 ||
+            !hreq_is(rq->buf, (hslice_t){ val.off + val.len - 7, 7 }, "chunked") ||
+            !hreq_has_token(rq->buf, val, "chunked"))
+            return -2;
+    } else if (cl > 0) {
+        rq->body_len = cl;
+    }
+    if (rq->body_len != 0 && rq->kind == RQ_CONNECT)
+        return -2;
+
+    /*
+     * origin 에 보낼 헤더 - 엔진은 EOF 까지 릴레이하므로 origin 이 닫게 한다.
+     * 끝에 새로 엮은 다음 클라이언트 헤더가 있던 자리로 당긴다.
+     */
+    start = rq->len;
+    if (host >= 0) {
+        rq_put_header(rq, &hr.hdrs[host]);
+    } else {
+        rq_put(rq, "Host: ", 6);
+        rq_put_self(rq, u->host.off, u->host.len);
+        rq_put(rq, "\r\n", 2);
+    }
+    conn_hdr = ioeng_kind() == IOENG_NONE ? "Connection: keep-alive\r\n"
+                                          : "Connection: close\r\nProxy-Connection: close\r\n";
+    rq_put(rq, conn_hdr, strlen(conn_hdr));
+    rq_put(rq, user_agent_hdr, strlen(user_agent_hdr));
+    for (int i = 0; i < hr.nhdrs; i++) {
+        hdr_id_t id = hr.hdrs[i].id;
+
+        /* 홉 헤더는 빼되 Transfer-Encoding 은 본문을 그대로 흘려 보내므로 남긴다 */
+        if (id != HDR_HOST && id != HDR_USER_AGENT && id != HDR_EXPECT &&
+            (!(hdr_flags(id) & HDRF_HOP) || id == HDR_TRANSFER_ENCODING))
+            rq_put_header(rq, &hr.hdrs[i]);
+    }
+    rq_put(rq, "\r\n", 2);
+    memmove(rq->buf + hr.hdr_start, rq->buf + start, rq->len - start);
+    rq->len = hr.hdr_start + (rq->len - start);
+    rq->header = rq_field(rq, hr.hdr_start);
+
+    /* origin 주소 - uri 안에서는 뒤에 ':' 나 '/' 가 붙어 있어 따로 NUL 로 닫는다 */
+    start = rq->len;
+    rq_put_self(rq, u->host.off, u->host.len);
+    rq->hostname = rq_field(rq, start);
+    start = rq->len;
+    if (u->port.len)
+        rq_put_self(rq, u->port.off, u->port.len);
+    else
+        rq_put(rq, "80", 2);     /* 기본 포트 */
+    rq->port = rq_field(rq, start);
+    if (!u->path.len) {
+        start = rq->len;
+        rq_put(rq, "/", 1);
+        rq->path = rq_field(rq, start);
+    }
+
+    /* 다 읽었다 - 읽는 동안 잡아 둔 한 줄 여유를 돌려준다 */
+    rq->buf = Realloc(rq->buf, rq->len);
+    rq->cap = rq->len;
+
+    /* HTTP/1.1 은 기본이 keep-alive, 1.0 은 keep-alive 를 밝혀야 한다 */
+    rq->chunk_ok = hr.minor >= 1;
+    rq->keep = can_keep && rq->kind != RQ_CONNECT && (conn == 1 || (conn == -1 && rq->chunk_ok));
+    return 1;
+}
+
+void request_free(request_t *rq) {
+    Free(rq->buf);
+    rq->buf = NULL;
+}
+
+/*
+ * doit - 요청 하나에 응답하고 연결을 어떻게 할지 (CONN_*) 돌려준다. GET 과
+ *     HEAD 는 캐시를 먼저 본다 (HEAD 는 GET 사본의 머리만). 본문이 있는 요청은
+ *     rio 에서 읽어 origin 으로 흘려 보내고 (rio 가 NULL 인 파이프라인 fetch 에는
+ *     본문이 없다), 성공한 POST/PUT/DELETE/PATCH 는 그 URL 의 캐시를 지운다.
+ */
+int doit(int fd, request_t *rq, rio_t *rio) {
+    cache_block *cached = NULL;
+    int keep = rq->keep, rc;
+
+    /*
+     * 캐시 확인 - 참조를 잡아 두므로 보내는 동안 교체/제거되어도 안전.
+     * 인증 정보나 조건이 붙은 요청은 캐시로 답하지도 (재검증하지 않는다)
+     * 그 응답을 넣지도 (다른 클라이언트에게 갈 수 있다) 않는다.
+     */
+    if ((rq->kind == RQ_GET || rq->kind == RQ_HEAD) && !rq->bypass)
+        cached = cache_get(RQ_STR(rq, uri));
+
+    if (cached) {
+        printf("Cache hit: %s\n", RQ_STR(rq, uri));
+        if (send_cached(fd, cached, &keep, rq->chunk_ok, rq->kind == RQ_HEAD) < 0)
+            keep = 0;
+        
+        cache_touch(cached);
+        cache_release(cached);
+        return keep ? CONN_KEEP : CONN_CLOSE;
+    }
+
+    if (rq->bypass)
+        printf("Cache bypass (%s): %s %s\n", hdr_name(rq->bypass),
+               RQ_STR(rq, method), RQ_STR(rq, uri));
+    else
+        printf("%s: %s %s\n", rq->kind == RQ_UNSAFE ? "Forward" : "Cache miss",
+               RQ_STR(rq, method), RQ_STR(rq, uri));
+
+    /* 엔진 모드: 주소만 구하고 connect 부터 릴레이까지 엔진 스레드에 넘긴다 (GET 만) */
+    if (ioeng_kind() != IOENG_NONE && rq->kind == RQ_GET && rq->body_len == 0)
+        return relay_via_engine(fd, RQ_STR(rq, uri), RQ_STR(rq, hostname), RQ_STR(rq, port),
+                                RQ_STR(rq, path), RQ_STR(rq, header),
+                                rq->bypass ? 0 : MAX_OBJECT_SIZE) ? CONN_HANDOFF : CONN_CLOSE;
+
+    /* origin 에는 HTTP/1.1 keep-alive 로 요청 (연결은 풀에서 재사용) - 요청 버퍼를 그대로 */
+    window_t *w = window_get(fd);
+    capture_t cap;
+    outv_t req;
+
+    outv_init(&req);
+    outv_add(&req, RQ_STR(rq, method), rq->method.len);
+    outv_str(&req, " ");
+    outv_add(&req, RQ_STR(rq, path), rq->path.len);
+    outv_str(&req, " HTTP/1.1\r\n");
+    outv_add(&req, RQ_STR(rq, header), rq->header.len);
+    capture_init(&cap);
+    if (rq->kind != RQ_GET || rq->bypass)
+        capture_drop(&cap);     /* 그냥 GET 응답만 캐시한다 */
+
+    rc = fetch_origin(w, rq, rio, &req, &cap, &keep);
+    if (rc == -1) {
+        clienterror(fd, RQ_STR(rq, hostname), "404", "Not found", "Could not connect to server");
+        cap.ok = 0;
+        keep = 0;
+    } else if (rc == -3) {
+        clienterror(fd, RQ_STR(rq, hostname), "502", "Bad Gateway", "Invalid response framing");
+        cap.ok = 0;
+        keep = 0;
+    }
+
+    /* origin 이 받아들였으면 이 URL 의 사본은 낡았다 (RFC 9111 4.4) */
+    if (rq->kind == RQ_UNSAFE && cap.resp.status > 0 && cap.resp.status < 400)
+        cache_invalidate(RQ_STR(rq, uri));
+
+    /* 캐시에 저장 - 사본 버퍼를 그대로 넘긴다 (길이를 몰랐으면 남는 곳을 줄여서) */
+    if (cap.ok && cap.len > 0) {
+        if (cap.len < cap.size)
+            cap.buf = Realloc(cap.buf, cap.len);
+        cache_put(RQ_STR(rq, uri), cap.buf, cap.len);
+        
+        printf("Cached: %s (%zu bytes, %s)\n", RQ_STR(rq, uri), cap.len,
+               cap.resp.content_type[0] ? cap.resp.content_type : "no type");
+        cap.buf = NULL;
+    }
+
+    /* origin 과 캐시는 이미 끝났다 - 느린 클라이언트는 창만 붙잡고 있다 */
+    if (window_drain(w) < 0)
+        keep = 0;
+    window_put(w);
+    Free(cap.buf);
+    return keep ? CONN_KEEP : CONN_CLOSE;
+}
+
+/*
+ * serve_pipeline - first 와 그 뒤로 버퍼에 이미 들어와 있는 요청들을 최대
+ *     PIPELINE_MAX 개까지 한꺼번에 꺼낸다. hit 은 바로 캐시 블록을 잡아 두고,
+ *     miss 는 각자 fetch 코루틴을 띄워 origin 에 동시에 보낸다. 응답은 요청
+ *     순서대로 내보낸다. 본문이 있거나 캐시를 지우는 요청이 끼어 있으면 (또는
+ *     miss 용 파이프를 못 만들면) 거기서 멈추고, 앞 응답들을 다 보낸 뒤 연결
+ *     코루틴이 직접 doit 한다 (본문은 rio 에 이어져 있고, 뒤의 GET 이 지워질
+ *     사본을 보지 않는다). 코루틴 안에서만 부른다.
+ */
+int serve_pipeline(int fd, rio_t *rio, request_t *first, int *nreq) {
+    slot_t *slots[PIPELINE_MAX], *slot;
+    request_t rq = *first;
+    int n = 0, rc = 1, keep = 1, fds[2];
+
+    while (1) {
+        slot = Calloc(1, sizeof(slot_t));
+        slot->rq = rq;
+        slot->refs = 1;
+        slots[n++] = slot;
+        if (rc < 0) {
+            slot->type = rc == -1 ? SLOT_501 : SLOT_400;
+            break;
+        }
+        if (rq.body_len != 0 || rq.kind == RQ_UNSAFE) {
+            slot->type = SLOT_INLINE;
+            break;
+        }
+        if ((rq.kind == RQ_GET || rq.kind == RQ_HEAD) && !rq.bypass &&
+            (slot->block = cache_get(RQ_STR(&rq, uri))) != NULL) {
+            slot->type = SLOT_HIT;
+        } else if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+            /* fd 가 모자라다 (EMFILE 등) - 여기서부터는 앞 응답 뒤에 차례로 직접 */
+            slot->type = SLOT_INLINE;
+            break;
+        } else {
+            slot->type = SLOT_MISS;
+            fcntl(fds[1], F_SETPIPE_SZ, ZPIPE_SIZE);
+            slot->pr = fds[0];
+            slot->pw = fds[1];
+            slot->refs++;
+            coro_spawn(slot_fetch, slot);
+        }
+        if (!rq.keep || n == PIPELINE_MAX || rio->rio_cnt == 0)
+            break;
+        deadline(&client_watch, fd, header_ms);
+        rc = read_request(rio, ++*nreq < CLIENT_MAX_REQS, &rq);
+        deadline_clear(&client_watch);
+        if (rc > 0 && rq.kind == RQ_CONNECT)
+            rc = -2;            /* 터널은 앞 응답들 뒤에 열 수 없다 - 400 */
+        if (rc == 0) {
+            keep = 0;
+            break;
+        }
+    }
+
+    /* 요청 순서대로 내보낸다 - 한 번 실패하거나 닫기로 했으면 나머지는 버린다 */
+    for (int i = 0; i < n; i++) {
+        slot = slots[i];
+        if (slot->type == SLOT_HIT) {
+            int k = slot->rq.keep;
+
+            if (keep) {
+                printf("Cache hit: %s\n", RQ_STR(&slot->rq, uri));
+                if (send_cached(fd, slot->block, &k, slot->rq.chunk_ok,
+                                slot->rq.kind == RQ_HEAD) < 0)
+                    k = 0;
+                keep = k;
+            }
+            cache_touch(slot->block);
+            cache_release(slot->block);
+        } else if (slot->type == SLOT_MISS) {
+            if (keep)
+                keep = drain_pipe(slot->pr, fd) == 0 && slot->keep;
+            Close(slot->pr);
+        } else if (slot->type == SLOT_INLINE) {
+            if (keep)
+                keep = doit(fd, &slot->rq, rio) == CONN_KEEP;
+        } else if (keep) {
+            request_error(fd, &slot->rq, slot->type == SLOT_501 ? -1 : -2);
+            keep = 0;
+        }
+        slot_put(slot);
+    }
+    return keep ? CONN_KEEP : CONN_CLOSE;
+}
+
+/* fetch 코루틴 - 평소처럼 doit 하되 응답은 클라이언트 대신 자기 파이프에 쓴다 */
+void slot_fetch(void *arg) {
+    slot_t *slot = arg;
+
+    slot->keep = doit(slot->pw, &slot->rq, NULL) == CONN_KEEP;
+    Close(slot->pw);            /* 연결 코루틴 쪽에서는 EOF 로 끝을 안다 */
+    slot_put(slot);
+}
+
+void slot_put(slot_t *slot) {
+    if (--slot->refs == 0) {
+        request_free(&slot->rq);
+        Free(slot);
+    }
+}
+
+/* 파이프에 쌓이는 응답을 EOF 까지 클라이언트로 옮긴다 */
+int drain_pipe(int pfd, int fd) {
+    char buf[MAXLINE];
+    ssize_t n;
+
+    while ((n = read(pfd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN && coro_wait_fd(pfd, POLLIN) == 0)
+                continue;
+            return -1;
+        }
+        if (client_write(fd, buf, n) != n)
+            return -1;
+    }
+    return 0;
+}
+
+/* read_request 가 음수를 돌려준 요청에 답한다 (-1 은 501, -2 는 400) */
+void request_error(int fd, request_t *rq, int rc) {
+    if (rc == -1)
+        clienterror(fd, RQ_STR(rq, method), "501", "Not Implemented",
+                    "Proxy does not implement this method");
+    else
+        clienterror(fd, "", "400", "Bad Request", "Proxy couldn't parse the request");
+}
+
+/* 에러 응답 전송 - 머리와 본문을 한 번에 */
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) {
+    char body[MAXBUF];
+    outv_t o;
+    int n;
+
+    n = snprintf(body, sizeof(body), "<html><title>Proxy Error</title><body bgcolor=ffffff>\r\n"
+                 "%s: %s\r\n<p>%s: %s\r\n<hr><em>The Proxy Web server</em>\r\n",
+                 errnum, shortmsg, longmsg, cause);
+    if (n >= (int)sizeof(body))
+        n = sizeof(body) - 1;
+    outv_init(&o);
+    outv_printf(&o, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\n\r\n",
+                errnum, shortmsg, n);
+    outv_add(&o, body, n);
+
+    /* 클라이언트가 이미 떠났어도 프록시 전체를 끝내지 않는다 (rio_writev) */
+    client_writev(fd, &o);
+}
+
+/*
+ * 현재 스레드의 목록에서 splice 파이프를 하나 빌린다 (없으면 새로 만든다).
+ * 만들지 못하면 (EMFILE 등) NULL.
+ */
+zpipe_t *zpipe_get(void) {
+    zpipe_t *zp = zpipe_free;
+
+    if (zp) {
+        zpipe_free = zp->next;
+        nzpipe_free--;
+        return zp;
+    }
+    zp = Malloc(sizeof(zpipe_t));
+    zp->data[0] = zp->cap[0] = -1;
+    if (zpipe_reset(zp) < 0) {
+        Free(zp);
+        return NULL;
+    }
+    return zp;
+}
+
+/* 빈 파이프를 돌려준다 - 목록이 차 있으면 닫는다 (다시 만들다 실패한 것은 버린다) */
+void zpipe_put(zpipe_t *zp) {
+    if (zp->data[0] < 0) {
+        Free(zp);
+        return;
+    }
+    if (nzpipe_free == FREE_KEEP) {
+        Close(zp->data[0]);
+        Close(zp->data[1]);
+        Close(zp->cap[0]);
+        Close(zp->cap[1]);
+        Free(zp);
+        return;
+    }
+    zp->next = zpipe_free;
+    zpipe_free = zp;
+    nzpipe_free++;
+}
+
+/*
+ * 파이프를 새로 만든다 - 에러로 중간에 끝나 찌꺼기가 남았을 때도 쓴다.
+ * 못 만들면 -1 이고 zp 에는 파이프가 없다 (zpipe_put 이 버린다).
+ */
+int zpipe_reset(zpipe_t *zp) {
+    if (zp->data[0] >= 0) {
+        Close(zp->data[0]);
+        Close(zp->data[1]);
+        Close(zp->cap[0]);
+        Close(zp->cap[1]);
+    }
+    zp->data[0] = zp->cap[0] = -1;
+    if (pipe2(zp->data, O_CLOEXEC) < 0)
+        return -1;
+    if (pipe2(zp->cap, O_CLOEXEC) < 0) {
+        Close(zp->data[0]);
+        Close(zp->data[1]);
+        zp->data[0] = zp->cap[0] = -1;
+        return -1;
+    }
+    /* 크게 잡을수록 splice 호출이 줄어든다 (pipe-max-size 를 넘으면 기본 크기 유지) */
+    fcntl(zp->data[1], F_SETPIPE_SZ, ZPIPE_SIZE);
+    fcntl(zp->cap[1], F_SETPIPE_SZ, ZPIPE_SIZE);
+    zp->size = fcntl(zp->data[1], F_GETPIPE_SZ);
+    if (fcntl(zp->cap[1], F_GETPIPE_SZ) < zp->size)
+        zp->size = fcntl(zp->cap[1], F_GETPIPE_SZ);
+    return 0;
+}
+
+/*
+ * relay_splice - origin -> 파이프 -> client 를 splice 로 옮긴다. cap->ok 인
+ *     동안은 파이프 내용을 tee 로 cap 파이프에 복제해서 그 사본만 cap->buf 로
+ *     읽어 들이고, MAX_OBJECT_SIZE 를 넘으면 그 뒤로는 순수 splice 만 한다.
+ *     limit 바이트를 옮기면 멈춘다 (-1 이면 EOF 까지). 옮긴 바이트 수,
+ *     에러거나 limit 전에 EOF 면 -1. 파이프 zp 는 호출한 쪽이 빌리고 돌려준다.
+ */
+ssize_t relay_splice(zpipe_t *zp, int serverfd, int clientfd, capture_t *cap, long long limit) {
+    ssize_t n, m, t, total = 0;
+    size_t want;
+
+    while (limit < 0 || total < limit) {
+        want = zp->size;
+        if (limit >= 0 && limit - total < want)
+            want = limit - total;
+        deadline(&origin_watch, serverfd, idle_ms);
+        n = splice(serverfd, NULL, zp->data[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            /* 코루틴: 논블로킹 소켓이 비었으면 읽을 수 있을 때까지 양보 */
+            if (errno == EAGAIN && rio_wait_hook && rio_wait_hook(serverfd, POLLIN) == 0)
+                continue;
+            return -1;         /* 파이프는 비어 있다 */
+        }
+        if (deadline_clear(&origin_watch) && n == 0)
+            n = -1;            /* 시간 제한으로 끊긴 EOF */
+        if (n < 0)
+            return -1;
+        if (n == 0) {          /* EOF */
+            if (limit >= 0)
+                total = -1;    /* Content-Length 보다 짧다 */
+            break;
+        }
+
+        if (cap->ok && capture_reserve(cap, n) == 0) {
+            /* 파이프에는 방금 들어온 n 바이트뿐이고 cap 파이프는 비어 있다 */
+            t = tee(zp->data[0], zp->cap[1], n, 0);
+            if (t > 0 && rio_readn(zp->cap[0], cap->buf + cap->len, t) != t)
+                t = -1;
+            if (t != n) {
+                capture_drop(cap);
+                zpipe_reset(zp);   /* data 파이프 내용까지 잃으므로 릴레이도 실패 */
+                return -1;
+            }
+            cap->len += n;
+        }
+
+        deadline(&client_watch, clientfd, write_ms);
+        while (n > 0) {
+            m = splice(zp->data[0], NULL, clientfd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN && rio_wait_hook && rio_wait_hook(clientfd, POLLOUT) == 0)
+                    continue;
+                deadline_clear(&client_watch);
+                zpipe_reset(zp);   /* 못 보낸 바이트가 다음 요청에 섞이지 않게 */
+                return -1;
+            }
+            n -= m;
+            total += m;
+        }
+        deadline_clear(&client_watch);
+    }
+    return total;
+}
+
+/*
+ * fetch_origin - 요청을 origin 에 보내고 응답을 클라이언트로 릴레이하면서 cap 에
+ *     모은다. 풀에서 꺼낸 연결이 응답 한 줄 없이 끊기면 (origin 의 idle close 와
+ *     엇갈린 경우) 새 연결로 한 번 더 보낸다 (req 는 writev 한 번으로 보내고
+ *     그대로 남으므로 다시 보낼 수 있다). 응답 경계가 분명하고 origin 이 닫지
+ *     않겠다고 했으면 본문을 다 읽은 연결을 풀에 돌려놓는다.
+ *     origin 의 Connection 계열 헤더는 빼고 클라이언트 쪽 것을 새로 붙인다
+ *     (캐시 사본에는 붙이지 않는다). *keep 은 클라이언트가 keep-alive 를 원하는지로
+ *     들어와서, 클라이언트가 응답 끝을 알 수 있을 때만 1 로 남는다.
+ *     chunked 응답은 1.1 클라이언트에는 청크째, 1.0 클라이언트에는 풀어서 넘기고,
+ *     EOF 까지인 응답은 1.1 클라이언트에 청크로 감싸 넘긴다 (BODY_*).
+ *     클라이언트로 가는 바이트는 창 w 에 쌓이고, 창에 남은 것은 호출한 쪽이
+ *     window_drain 으로 마저 보낸다 (origin 연결은 그 전에 놓아 준다).
+ *     요청 본문이 있으면 머리 뒤에 rio 에서 흘려 보낸다 - 다시 보낼 수 없으므로
+ *     이때는 풀의 연결을 쓰지 않고 재시도도 없다. origin 의 1xx 는 건너뛴다.
+ *     0 성공, -1 origin 에 연결하지 못함 (클라이언트에는 아직 아무것도 안 보냄),
+ *     -2 릴레이 도중 실패 (본문을 받다가 클라이언트가 끊긴 것 포함), -3 응답의
+ *     Content-Length 가 틀렸다 (클라이언트에는 아직 아무것도 안 보냄).
+ */
+int fetch_origin(window_t *w, request_t *rq, rio_t *rio, outv_t *req, capture_t *cap,
+                 int *keep) {
+    char line[MAXLINE], head[MAXLINE];
+    char *host = RQ_STR(rq, hostname), *port = RQ_STR(rq, port);
+    rio_t *rp;
+    zpipe_t *zp;
+    http_resp_t resp;
+    int serverfd, reused, rc, body = BODY_PLAIN, spilled = 0, chunk_ok = rq->chunk_ok, up;
+    size_t hlen = 0;
+    ssize_t n;
+    long long sent;
+
+    while (1) {
+        reused = 1;
+        up = 0;
+        if (rq->body_len != 0 || (serverfd = pool_get(host, port)) < 0) {
+            reused = 0;
+            if ((serverfd = dial(host, port)) < 0)
+                return -1;
+        }
+        rp = rbuf_get(serverfd, RBUF_ORIGIN);
+        deadline(&origin_watch, serverfd, first_ms);
+        sent = tw_now();
+        if (outv_flush(req, serverfd, 0) >= 0 &&
+            (up = send_body(rq, rio, serverfd)) != -1 &&
+            (n = origin_readline(rp, line, first_ms)) > 0)
+            break;
+        deadline_clear(&origin_watch);
+        rbuf_put(rp);
+        Close(serverfd);
+        if (up == -1) {             /* 본문 도중에 클라이언트가 끊겼다 - 답할 곳이 없다 */
+            capture_drop(cap);
+            *keep = 0;
+            return -2;
+        }
+        if (!reused) {
+            dial_record_ttfb(host, port, tw_now() - sent);   /* 답이 없던 것도 느린 것 */
+            return -1;
+        }
+    }
+    dial_record_ttfb(host, port, tw_now() - sent);
+    if (up < 0)
+        *keep = 0;              /* origin 이 본문을 다 받지 않고 답했다 - 남은 본문은 버린다 */
+    if (skip_interim(rp, line, &n) < 0) {
+        deadline_clear(&origin_watch);
+        rbuf_put(rp);
+        Close(serverfd);
+        capture_drop(cap);
+        *keep = 0;
+        return -2;
+    }
+
+    /* 상태 줄을 못 알아보면 예전처럼 EOF 까지 그대로 넘긴다 (캐시하지 않는다) */
+    if (http_parse_status_line(line, &resp) < 0) {
+        memset(&resp, 0, sizeof(resp));
+        resp.content_length = -1;
+        resp.close = 1;
+    }
+    if (resp.status != 200)
+        capture_drop(cap);      /* 에러 응답은 머리부터 모으지 않는다 */
+
+    /* 응답 헤더 - 한 줄씩 해석하면서 모아 두었다가 한꺼번에 보낸다 */
+    rc = 0;
+    while (1) {
+        int last = 0;
+
+        if (resp.status == 0) {             /* 알아볼 수 없는 응답은 그대로 */
+            *keep = 0;
+            capture_add(cap, line, n);
+            last = 1;
+        } else if (!strcmp(line, "\r\n")) {
+            http_resp_finish(&resp);
+            if (resp.bad) {     /* 본문 경계를 믿을 수 없다 - 아무것도 넘기지 않는다 */
+                rc = spilled ? -1 : -3;
+                break;
+            }
+            if (rq->kind == RQ_HEAD) {     /* 머리의 길이는 GET 의 것 - 본문은 없다 */
+                resp.content_length = 0;
+                resp.chunked = 0;
+            }
+            if (resp.chunked)
+                body = chunk_ok ? BODY_CHUNKED : BODY_DECHUNK;
+            else if (resp.content_length < 0 && chunk_ok && !spilled &&
+                     status_11(head, &hlen, sizeof(head), &resp) == 0)
+                body = BODY_ENCHUNK;    /* chunked 는 1.1 응답에만 */
+            *keep = *keep && (client_framed(&resp, chunk_ok) || body == BODY_ENCHUNK);
+            /* 길이를 모르는 사본은 빈 줄 자리에 나중에 Content-Length 를 넣는다 */
+            if (resp.content_length >= 0)
+                capture_add(cap, line, n);
+            else
+                cap->head = cap->len;
+            /* 본문을 읽기 전에 캐시 여부를 정하고, 길이를 알면 사본을 딱 맞게 */
+            if (!http_resp_cacheable(&resp, cap->len, MAX_OBJECT_SIZE))
+                capture_drop(cap);
+            else if (resp.content_length > 0)
+                capture_reserve(cap, resp.content_length);
+            n = sprintf(line, "%sConnection: %s\r\n\r\n",
+                        body == BODY_ENCHUNK ? "Transfer-Encoding: chunked\r\n" : "",
+                        *keep ? "keep-alive" : "close");
+            last = 1;
+        } else if (http_hop_header(line)) {
+            n = 0;
+        } else if (http_te_header(line)) {
+            if (!chunk_ok)      /* 1.0 클라이언트에는 풀어서 보낸다 */
+                n = 0;          /* 사본도 풀어서 모은다 */
+        } else {
+            capture_add(cap, line, n);
+        }
+        if (hlen + n > sizeof(head)) {
+            if (window_write(w, head, hlen) < 0)
+                rc = -1;
+            hlen = 0;
+            spilled = 1;
+        }
+        memcpy(head + hlen, line, n);
+        hlen += n;
+        if (rc < 0 || last)
+            break;
+        if ((n = origin_readline(rp, line, idle_ms)) <= 0) {
+            rc = -1;
+            break;
+        }
+        http_parse_resp_header(line, &resp);
+    }
+    if (rc == 0 && window_write(w, head, hlen) < 0)
+        rc = -1;
+
+    /* 본문 */
+    if (rc < 0)
+        ;
+    else if (body == BODY_CHUNKED || body == BODY_DECHUNK)
+        rc = relay_chunked(rp, w, cap, body == BODY_CHUNKED);
+    else if (body == BODY_ENCHUNK)
+        rc = relay_enchunk(rp, w, cap);
+    else if (!zerocopy || (zp = zpipe_get()) == NULL)
+        /* -z 라도 파이프를 못 만들었으면 (EMFILE 등) 이 응답은 복사로 */
+        rc = relay_length(rp, w, resp.content_length, cap);
+    else {
+        /*
+         * Rio 버퍼에 이미 읽혀 있는 본문 앞부분을 먼저 보내고 나머지는 splice.
+         * splice 는 클라이언트에 바로 쓰므로 창을 먼저 비운다 (이 경로는 tee 가
+         * 파이프 앞부분을 복제하는 탓에 파이프를 창처럼 쌓아 둘 수 없다).
+         */
+        long long left = resp.content_length;
+        size_t k = rp->rio_cnt;
+
+        if (left >= 0 && k > left)
+            k = left;
+        if (k > 0) {
+            rc = relay_out(w, rp->rio_bufptr, k, cap);
+            rp->rio_bufptr += k;
+            rp->rio_cnt -= k;
+            if (left >= 0)
+                left -= k;
+        }
+        if (rc == 0 && left != 0 &&
+            (window_drain(w) < 0 || relay_splice(zp, serverfd, w->fd, cap, left) < 0))
+            rc = -1;
+        zpipe_put(zp);
+    }
+
+    /* 응답 뒤에 남는 바이트가 있으면 다음 응답과 섞이므로 재사용하지 않는다 */
+    deadline_clear(&origin_watch);
+    if (rc == 0 && http_resp_reusable(&resp) && rp->rio_cnt == 0)
+        pool_put(host, port, serverfd);
+    else
+        Close(serverfd);
+    rbuf_put(rp);
+    cap->resp = resp;
+    if (rc == 0)
+        capture_finish(cap);
+    if (rc < 0) {
+        capture_drop(cap);
+        *keep = 0;
+    }
+    return rc == -3 ? -3 : rc < 0 ? -2 : 0;
+}
+
+/*
+ * send_body - 요청 본문을 클라이언트에서 origin 으로 흘려 보낸다 (없으면 0).
+ *     Expect: 100-continue 는 origin 에 넘기지 않고 프록시가 바로 100 으로 답한
+ *     뒤 본문을 받는다. chunked 본문은 청크 틀과 trailer 까지 그대로 넘기되 틀을
+ *     따라 읽어 본문 끝에서 정확히 멈춘다. 0 성공, -1 클라이언트가 끊겼거나
+ *     본문이 틀렸다, -2 origin 에 쓰지 못했다 (origin 이 먼저 답하고 닫은 경우).
+ */
+int send_body(request_t *rq, rio_t *rio, int serverfd) {
+    static char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    char line[MAXLINE], *end;
+    long long size;
+    ssize_t n;
+    int rc;
+
+    if (rq->body_len == 0)
+        return 0;
+    if (rq->expect && rq->chunk_ok && rio->rio_cnt == 0 &&
+        client_write(rio->rio_fd, cont, sizeof(cont) - 1) != sizeof(cont) - 1)
+        return -1;
+    if (rq->body_len > 0)
+        return copy_body(rio, serverfd, rq->body_len);
+
+    while (1) {
+        if ((n = client_readline(rio, line)) <= 0)
+            return -1;
+        size = strtoll(line, &end, 16);
+        if (end == line || size < 0)
+            return -1;
+        if (origin_write(serverfd, line, n) != n)
+            return -2;
+        if (size == 0)
+            break;
+        if ((rc = copy_body(rio, serverfd, size + 2)) < 0)  /* 데이터와 뒤의 CRLF */
+            return rc;
+    }
+    /* trailer 헤더들과 빈 줄 */
+    do {
+        if ((n = client_readline(rio, line)) <= 0)
+            return -1;
+        if (origin_write(serverfd, line, n) != n)
+            return -2;
+    } while (!blank_line(line));
+    return 0;
+}
+
+/*
+ * copy_body - 클라이언트 rio 에서 len 바이트를 origin 으로. MAXBUF 씩 옮기므로
+ *     본문이 커도 메모리는 그대로이고, origin 이 느리면 클라이언트에서도 그만큼
+ *     천천히 읽는다. 반환값은 send_body 와 같다.
+ */
+int copy_body(rio_t *rio, int serverfd, long long len) {
+    char buf[MAXBUF];
+    ssize_t n;
+    size_t want;
+
+    while (len > 0) {
+        want = len < (long long)sizeof(buf) ? len : sizeof(buf);
+        deadline(&client_watch, rio->rio_fd, idle_ms);
+        n = rio_readnb(rio, buf, want);
+        if (deadline_clear(&client_watch) || n != want)
+            return -1;
+        if (origin_write(serverfd, buf, n) != n)
+            return -2;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * skip_interim - line 이 1xx 중간 응답 (101 은 빼고) 의 상태 줄이면 그 머리를
+ *     버리고 다음 상태 줄을 line 에 읽는다 (*n 은 그 길이). 100 Continue 는
+ *     이미 프록시가 대신 보냈다. 실패하면 -1.
+ */
+int skip_interim(rio_t *rp, char *line, ssize_t *n) {
+    http_resp_t resp;
+
+    while (http_parse_status_line(line, &resp) == 0 && resp.status >= 100 &&
+           resp.status < 200 && resp.status != 101) {
+        do {
+            if ((*n = origin_readline(rp, line, idle_ms)) <= 0)
+                return -1;
+        } while (!blank_line(line));
+        if ((*n = origin_readline(rp, line, first_ms)) <= 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * status_11 - head[0..*hlen) 맨 앞의 (아직 보내지 않은) 상태 줄을 파싱해 둔
+ *     상태 코드와 이유 문구로 "HTTP/1.1 SSS reason\r\n" 이 되게 다시 쓴다
+ *     (1.1 이면 그대로). 뒤의 헤더들은 새 줄 길이에 맞춰 옮긴다. size 안에
+ *     들어가지 않으면 -1 이고 head 는 그대로다.
+ */
+int status_11(char *head, size_t *hlen, size_t size, const http_resp_t *resp) {
+    char prefix[32];
+    char *eol;
+    size_t old, pre, len, rest;
+
+    if (resp->version != 10)
+        return 0;
+    if ((eol = memchr(head, '\n', *hlen)) == NULL)
+        return -1;
+    old = eol + 1 - head;
+    rest = *hlen - old;
+    pre = sprintf(prefix, "HTTP/1.1 %03d ", resp->status);
+    len = pre + resp->reason_len + 2;
+    if (rest + len > size)
+        return -1;
+
+    /* 줄이 길어지면 헤더를 먼저 비켜 두고, 짧아지면 줄을 다 쓴 뒤에 당긴다 */
+    if (len > old)
+        memmove(head + len, head + old, rest);
+    memmove(head + pre, head + resp->reason, resp->reason_len);
+    memcpy(head, prefix, pre);
+    memcpy(head + pre + resp->reason_len, "\r\n", 2);
+    if (len < old)
+        memmove(head + len, head + old, rest);
+    *hlen = len + rest;
+    return 0;
+}
+
+/* 클라이언트가 연결을 닫지 않고도 응답의 끝을 알 수 있는가 */
+int client_framed(http_resp_t *resp, int chunk_ok) {
+    return resp->content_length >= 0 || (resp->chunked && chunk_ok);
+}
+
+/*
+ * send_cached - 캐시된 응답을 보낸다. 저장된 헤더에서 Connection 계열은 빼고
+ *     이번 클라이언트 연결에 맞는 Connection 헤더를 붙인다. 클라이언트가 응답
+ *     끝을 알 수 없거나 헤더를 해석할 수 없으면 *keep 을 내리고 그대로 보낸다.
+ *     head_only 면 (HEAD) 머리만 보낸다. 보내기에 실패하면 -1.
+ */
+int send_cached(int fd, cache_block *block, int *keep, int chunk_ok, int head_only) {
+    char line[MAXLINE], *p = block->content, *nl;
+    char *end = block->content + block->size;
+    http_resp_t resp;
+    outv_t o;
+    size_t n;
+    int first = 1;
+
+    /* 남길 헤더 줄은 캐시 블록을 그대로 가리킨다 (이어진 줄은 한 조각) */
+    outv_init(&o);
+    while (1) {
+        nl = memchr(p, '\n', end - p);
+        if (!nl || nl - p + 1 >= MAXLINE)
+            goto raw;
+        n = nl - p + 1;
+        memcpy(line, p, n);     /* 해석용 - http_* 는 NUL 로 끝나는 줄을 본다 */
+        line[n] = '\0';
+        p += n;
+        if (first) {
+            if (http_parse_status_line(line, &resp) < 0)
+                goto raw;
+            first = 0;
+        } else if (!strcmp(line, "\r\n")) {
+            break;
+        } else {
+            http_parse_resp_header(line, &resp);
+            if (http_hop_header(line))
+                continue;
+        }
+        outv_add(&o, p - n, n);
+    }
+    http_resp_finish(&resp);
+    *keep = *keep && client_framed(&resp, chunk_ok);
+    outv_str(&o, *keep ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    if (!head_only)
+        outv_add(&o, p, end - p);
+    if (o.overflow)
+        goto raw;
+    return client_writev(fd, &o) < 0 ? -1 : 0;
+
+raw:
+    *keep = 0;
+    if (head_only && (nl = memmem(block->content, block->size, "\r\n\r\n", 4)) != NULL)
+        end = nl + 4;
+    n = end - block->content;
+    return client_write(fd, block->content, n) == n ? 0 : -1;
+}
+
+/*
+ * deadline - fd 에 대한 다음 I/O 를 ms 로 제한한다. 코루틴은 그동안의 대기에
+ *     마감을 걸고 (넘기면 Rio 가 -1), 워커 스레드는 watchdog 이 fd 를 끊는다
+ *     (막혀 있던 read 는 EOF, write 는 EPIPE). 같은 wt 로 다시 부르면 다시 잰다.
+ */
+void deadline(tw_watch_t *wt, int fd, int ms) {
+    if (coro_active())
+        coro_deadline(ms);
+    else
+        tw_watch(wt, fd, ms);
+}
+
+/*
+ * deadline_clear - 시간 제한을 푼다. 워커 스레드는 fd 를 닫거나 풀에 넣기 전에
+ *     반드시 불러야 한다. watchdog 이 이미 fd 를 끊었으면 1 - 그때 본 EOF 는
+ *     응답의 끝이 아니다 (코루틴은 Rio 가 바로 -1 을 돌려주므로 항상 0).
+ */
+int deadline_clear(tw_watch_t *wt) {
+    if (coro_active()) {
+        coro_deadline(-1);
+        return 0;
+    }
+    return tw_unwatch(wt);
+}
+
+/* 클라이언트로 n 바이트 - write_ms 안에 다 보내지 못하면 실패 */
+ssize_t client_write(int fd, void *buf, size_t n) {
+    ssize_t rc;
+
+    deadline(&client_watch, fd, write_ms);
+    rc = rio_writen(fd, buf, n);
+    if (deadline_clear(&client_watch))
+        rc = -1;
+    return rc;
+}
+
+/* client_write 의 조각 모음판 - 다 보냈으면 o->len */
+ssize_t client_writev(int fd, outv_t *o) {
+    ssize_t rc;
+
+    deadline(&client_watch, fd, write_ms);
+    rc = outv_flush(o, fd, 0);
+    if (deadline_clear(&client_watch))
+        rc = -1;
+    return rc;
+}
+
+/* 클라이언트에서 한 줄 (요청 본문) - idle_ms 동안 아무것도 오지 않으면 실패 */
+ssize_t client_readline(rio_t *rp, char *buf) {
+    ssize_t rc;
+
+    deadline(&client_watch, rp->rio_fd, idle_ms);
+    rc = rio_readlineb(rp, buf, MAXLINE);
+    if (deadline_clear(&client_watch))
+        rc = -1;
+    return rc;
+}
+
+/* origin 으로 n 바이트 (요청 본문) - write_ms 안에 다 보내지 못하면 실패 */
+ssize_t origin_write(int fd, void *buf, size_t n) {
+    ssize_t rc;
 
-typedef struct {
-    cache_block *head;
-    cache_block *tail;
-    size_t total_size;
-    int counter;
-    sem_t mutex;
-    sem_t w;
-    int readcnt;
-} cache_t;
+    deadline(&origin_watch, fd, write_ms);
+    rc = rio_writen(fd, buf, n);
+    if (deadline_clear(&origin_watch))
+        rc = -1;
+    return rc;
+}
 
-/* Shared buffer of connected descriptors */
-typedef struct {
-    int *buf;
-    int n;
-    int front;
-    int rear;
-    sem_t mutex;
-    sem_t slots;
-    sem_t items;
-} sbuf_t;
+/* origin 에서 한 줄 - ms 동안 아무것도 오지 않으면 실패 */
+ssize_t origin_readline(rio_t *rp, char *buf, int ms) {
+    ssize_t rc;
 
-/* 함수 프로토타입 */
-void doit(int fd);
-void parse_uri(char *uri, char *hostname, char *port, char *path);
-void build_request_header(rio_t *rio, char *header, char *hostname, char *port);
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
-void *thread(void *vargp);
-void sbuf_init(sbuf_t *sp, int n);
-void sbuf_deinit(sbuf_t *sp);
-void sbuf_insert(sbuf_t *sp, int item);
-int sbuf_remove(sbuf_t *sp);
+    deadline(&origin_watch, rp->rio_fd, ms);
+    rc = rio_readlineb(rp, buf, MAXLINE);
+    if (deadline_clear(&origin_watch))
+        rc = -1;
+    return rc;
+}
 
-/* 캐시 함수 */
-void cache_init(cache_t *cache);
-cache_block *cache_find(cache_t *cache, char *url);
-void cache_insert(cache_t *cache, char *url, char *content, size_t size);
-void cache_evict(cache_t *cache, size_t needed_size);
-void cache_remove_block(cache_t *cache, cache_block *block);
+/*
+ * origin_read - origin 에서 n 바이트까지. Rio 버퍼에 남은 것이 있으면 거기서,
+ *     없으면 read 한 번 (rio_readnb 와 달리 n 을 다 채울 때까지 붙잡지 않는다).
+ *     idle_ms 동안 아무것도 오지 않으면 실패.
+ */
+ssize_t origin_read(rio_t *rp, char *buf, size_t n) {
+    ssize_t rc;
 
-/* 전역 변수 */
-sbuf_t sbuf;
-cache_t cache;
+    if (rp->rio_cnt > 0) {
+        if (n > rp->rio_cnt)
+            n = rp->rio_cnt;
+        memcpy(buf, rp->rio_bufptr, n);
+        rp->rio_bufptr += n;
+        rp->rio_cnt -= n;
+        return n;
+    }
+    deadline(&origin_watch, rp->rio_fd, idle_ms);
+    while ((rc = read(rp->rio_fd, buf, n)) < 0) {
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN && rio_wait_hook && rio_wait_hook(rp->rio_fd, POLLIN) == 0)
+            continue;
+        break;
+    }
+    if (deadline_clear(&origin_watch))
+        rc = -1;
+    return rc;
+}
 
-int main(int argc, char **argv) {
-    int listenfd, connfd;
-    char hostname[MAXLINE], port[MAXLINE];
-    socklen_t clientlen;
-    struct sockaddr_storage clientaddr;
-    pthread_t tid;
+/* 현재 스레드의 목록에서 창을 하나 빌린다 (없으면 새로 만든다) */
+window_t *window_get(int fd) {
+    window_t *w = window_free;
 
-    /* SIGPIPE 무시 */
-    Signal(SIGPIPE, SIG_IGN);
+    if (w) {
+        window_free = w->next;
+        nwindow_free--;
+    } else {
+        w = Malloc(sizeof(window_t));
+        /* malloc 은 큰 블록을 풀어도 커널에 돌려주지 않을 수 있어 직접 매핑 */
+        w->buf = Mmap(NULL, relay_window, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    w->fd = fd;
+    w->start = w->len = 0;
+    w->epfd = -1;
+    return w;
+}
 
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
-        exit(1);
+/*
+ * 창을 돌려준다 - 남은 바이트는 버린다. 목록에는 FREE_KEEP 개까지만 두므로
+ * miss 가 몰렸다 지나간 뒤에도 창 메모리가 그때 크기로 남지 않는다.
+ */
+void window_put(window_t *w) {
+    if (w->epfd >= 0)
+        Close(w->epfd);
+    if (nwindow_free == FREE_KEEP) {
+        Munmap(w->buf, relay_window);
+        Free(w);
+        return;
     }
+    w->next = window_free;
+    window_free = w;
+    nwindow_free++;
+}
 
-    /* 캐시 초기화 */
-    cache_init(&cache);
+/* 클라이언트가 받을 수 있게 될 때까지. write_ms 안에 안 되면 -1 */
+static int wait_client(window_t *w) {
+    struct pollfd pfd;
+    int n;
 
-    /* Shared buffer 초기화 */
-    sbuf_init(&sbuf, SBUFSIZE);
+    if (coro_active())
+        return coro_wait_fd_timeout(w->fd, POLLOUT, write_ms);
+    pfd.fd = w->fd;
+    pfd.events = POLLOUT;
+    while ((n = poll(&pfd, 1, write_ms)) < 0 && errno == EINTR)
+        ;
+    return n > 0 ? 0 : -1;
+}
 
-    /* 워커 스레드 생성 */
-    for (int i = 0; i < NTHREADS; i++) {
-        Pthread_create(&tid, NULL, thread, NULL);
+/* 막히지 않고 보낼 수 있는 만큼 클라이언트로 보낸다. 클라이언트가 끊겼으면 -1 */
+int window_flush(window_t *w) {
+    ssize_t n;
+    size_t k;
+
+    while (w->len > 0) {
+        k = relay_window - w->start;
+        if (k > w->len)
+            k = w->len;
+        /* 워커 스레드의 소켓은 블로킹이라 이번 호출만 논블로킹으로 */
+        if (coro_active())
+            n = write(w->fd, w->buf + w->start, k);
+        else
+            n = send(w->fd, w->buf + w->start, k, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        w->start = (w->start + n) % relay_window;
+        w->len -= n;
     }
+    w->start = 0;               /* 비었으면 처음부터 이어서 쓸 수 있게 */
+    return 0;
+}
 
-    listenfd = Open_listenfd(argv[1]);
-    
-    while (1) {
-        clientlen = sizeof(clientaddr);
-        connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-        Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
-        printf("Accepted connection from (%s, %s)\n", hostname, port);
-        sbuf_insert(&sbuf, connfd);
+/*
+ * window_space - 창에서 이어진 빈 곳과 그 크기. 가득 찼으면 클라이언트가 받아 갈
+ *     때까지 기다린다 (origin 읽기는 여기서 멈춘다). 실패하면 NULL.
+ */
+char *window_space(window_t *w, size_t *room) {
+    size_t end;
+
+    while (w->len == relay_window) {
+        if (window_flush(w) < 0)
+            return NULL;
+        if (w->len == relay_window && wait_client(w) < 0)
+            return NULL;
+    }
+    end = (w->start + w->len) % relay_window;
+    *room = end >= w->start ? relay_window - end : w->start - end;
+    return w->buf + end;
+}
+
+/* 창에 넣고 보낼 수 있는 만큼 보낸다 */
+int window_write(window_t *w, char *p, size_t n) {
+    char *dst;
+    size_t room;
+
+    while (n > 0) {
+        if ((dst = window_space(w, &room)) == NULL)
+            return -1;
+        if (room > n)
+            room = n;
+        memcpy(dst, p, room);
+        w->len += room;
+        p += room;
+        n -= room;
+    }
+    return window_flush(w);
+}
+
+/*
+ * window_wait - origin 을 읽기 전에 부른다. 창에 보낼 것이 남아 있으면 origin
+ *     에 읽을 거리가 생길 때까지 그동안 클라이언트로 내보낸다 (창이 비었거나 Rio
+ *     버퍼에 읽을 것이 있으면 바로 0). idle_ms 동안 양쪽 다 움직이지 않거나
+ *     기다릴 epoll 을 만들지 못하면 -1.
+ */
+int window_wait(window_t *w, rio_t *rp) {
+    struct pollfd pfd[2];
+    struct epoll_event ev, evs[2];
+    int n;
+
+    while (rp->rio_cnt == 0) {
+        if (window_flush(w) < 0)
+            return -1;
+        if (w->len == 0)
+            break;
+        if (coro_active()) {
+            /* 코루틴은 fd 하나만 기다리므로 둘을 epoll 하나에 모아 그것을 기다린다 */
+            if (w->epfd < 0) {
+                /* fd 가 모자라면 (EMFILE 등) 이 릴레이만 실패한다 */
+                if ((w->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+                    return -1;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.fd = rp->rio_fd;
+                if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, rp->rio_fd, &ev) < 0)
+                    return -1;     /* epfd 는 window_put 이 닫는다 */
+                ev.events = EPOLLOUT;
+                ev.data.fd = w->fd;
+                if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->fd, &ev) < 0)
+                    return -1;
+            }
+            if (coro_wait_fd_timeout(w->epfd, POLLIN, idle_ms) < 0)
+                return -1;
+            n = epoll_wait(w->epfd, evs, 2, 0);
+            for (int i = 0; i < n; i++)
+                if (evs[i].data.fd == rp->rio_fd)
+                    return 0;
+            continue;
+        }
+        pfd[0].fd = rp->rio_fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = w->fd;
+        pfd[1].events = POLLOUT;
+        while ((n = poll(pfd, 2, idle_ms)) < 0 && errno == EINTR)
+            ;
+        if (n <= 0)
+            return -1;
+        if (pfd[0].revents)
+            return 0;
     }
-    
     return 0;
 }
 
-/* 워커 스레드 루틴 */
-void *thread(void *vargp) {
-    Pthread_detach(pthread_self());
+/* 창에 남은 것을 다 보낸다 */
+int window_drain(window_t *w) {
     while (1) {
-        int connfd = sbuf_remove(&sbuf);
-        doit(connfd);
-        Close(connfd);
+        if (window_flush(w) < 0)
+            return -1;
+        if (w->len == 0)
+            return 0;
+        if (wait_client(w) < 0)
+            return -1;
     }
-    return NULL;
 }
 
-/* 클라이언트 요청 처리 */
-void doit(int fd) {
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-    char hostname[MAXLINE], port[MAXLINE], path[MAXLINE];
-    char request_header[MAXLINE];
-    rio_t rio_client, rio_server;
-    int serverfd;
-    cache_block *cached;
+void capture_init(capture_t *cap) {
+    memset(cap, 0, sizeof(*cap));
+    cap->ok = 1;
+}
 
-    /* 클라이언트로부터 요청 읽기 */
-    Rio_readinitb(&rio_client, fd);
-    if (!Rio_readlineb(&rio_client, buf, MAXLINE))
-        return;
-    
-    sscanf(buf, "%s %s %s", method, uri, version);
+/*
+ * capture_reserve - 사본 뒤에 n 바이트를 더 담을 자리를 마련한다. 모자라면
+ *     len + n 까지 늘리되 조금씩 늘어나는 일이 없도록 두 배 (MAX_OBJECT_SIZE
+ *     까지) 와 비교해 큰 쪽으로. 한도를 넘으면 사본을 버리고 -1.
+ */
+int capture_reserve(capture_t *cap, size_t n) {
+    size_t want = cap->len + n, size;
 
-    if (strcasecmp(method, "GET")) {
-        clienterror(fd, method, "501", "Not Implemented", "Proxy does not implement this method");
-        return;
+    if (!cap->ok)
+        return -1;
+    if (want > MAX_OBJECT_SIZE) {
+        capture_drop(cap);
+        return -1;
     }
+    if (want > cap->size) {
+        size = cap->size ? cap->size * 2 : 1024;
+        if (size > MAX_OBJECT_SIZE)
+            size = MAX_OBJECT_SIZE;
+        if (size < want)
+            size = want;
+        cap->buf = Realloc(cap->buf, size);
+        cap->size = size;
+    }
+    return 0;
+}
 
-    /* 캐시 확인 - Readers lock */
-    P(&cache.mutex);
-    cache.readcnt++;
-    if (cache.readcnt == 1)
-        P(&cache.w);
-    V(&cache.mutex);
+/* 캐시하지 않기로 했다 - 지금까지 모은 것을 버린다 */
+void capture_drop(capture_t *cap) {
+    Free(cap->buf);
+    cap->buf = NULL;
+    cap->len = cap->size = 0;
+    cap->ok = 0;
+}
 
-    cached = cache_find(&cache, uri);
-    
-    P(&cache.mutex);
-    cache.readcnt--;
-    if (cache.readcnt == 0)
-        V(&cache.w);
-    V(&cache.mutex);
+/* 캐시용 사본에 덧붙인다 */
+void capture_add(capture_t *cap, char *p, size_t n) {
+    if (capture_reserve(cap, n) == 0) {
+        memcpy(cap->buf + cap->len, p, n);
+        cap->len += n;
+    }
+}
 
-    if (cached) {
-        printf("Cache hit: %s\n", uri);
-        Rio_writen(fd, cached->content, cached->size);
-        
-        /* LRU 카운터 업데이트 - Writer lock */
-        P(&cache.w);
-        cached->lru_counter = cache.counter++;
-        V(&cache.w);
+/*
+ * capture_finish - 길이 없이 온 응답 (chunked, EOF 까지) 의 사본에 풀어서 모은
+ *     본문 길이로 Content-Length 를 넣어 마무리한다. 캐시 hit 은 본문을 다시
+ *     감싸거나 풀 일 없이 그대로 내보낸다.
+ */
+void capture_finish(capture_t *cap) {
+    char cl[64];
+    size_t body;
+    int k;
+
+    if (!cap->ok || cap->head == 0)
         return;
-    }
+    body = cap->len - cap->head;
+    k = sprintf(cl, "Content-Length: %zu\r\n\r\n", body);
+    if (capture_reserve(cap, k) < 0)
+        return;
+    memmove(cap->buf + cap->head + k, cap->buf + cap->head, body);
+    memcpy(cap->buf + cap->head, cl, k);
+    cap->len += k;
+    cap->head = 0;
+}
 
-    printf("Cache miss: %s\n", uri);
+/* 클라이언트 쪽 창에 넣고 사본에 모은다. 클라이언트가 끊겼으면 -1 */
+int relay_out(window_t *w, char *p, size_t n, capture_t *cap) {
+    if (window_write(w, p, n) < 0)
+        return -1;
+    capture_add(cap, p, n);
+    return 0;
+}
 
-    /* URI 파싱 */
-    parse_uri(uri, hostname, port, path);
+/*
+ * relay_length - 본문 len 바이트를 릴레이 (-1 이면 EOF 까지). origin 에서 창의
+ *     빈 곳으로 바로 읽는다. 길이보다 먼저 끊기면 -1.
+ */
+int relay_length(rio_t *rp, window_t *w, long long len, capture_t *cap) {
+    char *dst;
+    ssize_t n;
+    size_t want;
 
-    /* 서버에 연결 */
-    serverfd = Open_clientfd(hostname, port);
-    if (serverfd < 0) {
-        clienterror(fd, hostname, "404", "Not found", "Could not connect to server");
-        return;
+    while (len != 0) {
+        if (window_wait(w, rp) < 0 || (dst = window_space(w, &want)) == NULL)
+            return -1;
+        if (len >= 0 && len < want)
+            want = len;
+        if ((n = origin_read(rp, dst, want)) < 0)
+            return -1;
+        if (n == 0)
+            return len < 0 ? 0 : -1;
+        capture_add(cap, dst, n);
+        w->len += n;
+        if (window_flush(w) < 0)
+            return -1;
+        if (len > 0)
+            len -= n;
     }
+    return 0;
+}
 
-    /* 요청 헤더 구성 */
-    build_request_header(&rio_client, request_header, hostname, port);
-
-    /* 서버로 요청 전송 */
-    Rio_readinitb(&rio_server, serverfd);
-    sprintf(buf, "GET %s HTTP/1.0\r\n", path);
-    Rio_writen(serverfd, buf, strlen(buf));
-    Rio_writen(serverfd, request_header, strlen(request_header));
+/* 청크 데이터 뒤나 trailer 끝의 빈 줄인가 */
+int blank_line(const char *line) {
+    return !strcmp(line, "\r\n") || !strcmp(line, "\n");
+}
 
-    /* 서버 응답 읽고 클라이언트로 전달 + 캐싱 */
-    size_t n, total_size = 0;
-    char *cache_buf = Malloc(MAX_OBJECT_SIZE);  // 동적 할당으로 변경
-    int cacheable = 1;
+/*
+ * relay_chunked - chunked 본문을 청크 경계를 따라 읽어 마지막 청크와 trailer
+ *     에서 정확히 멈춘다 (그래야 연결을 재사용할 수 있다). pass 면 청크 틀까지
+ *     바이트 그대로 넘기고, 아니면 데이터만 넘긴다 (1.0 클라이언트). 사본에는
+ *     언제나 데이터만 모은다 (trailer 는 버린다).
+ */
+int relay_chunked(rio_t *rp, window_t *w, capture_t *cap, int pass) {
+    char line[MAXLINE], *end;
+    long long size;
+    ssize_t n;
 
-    // 핵심 수정: Rio_readnb 사용 (바이너리 파일 대응)
-    while ((n = Rio_readnb(&rio_server, buf, MAXLINE)) > 0) {
-        Rio_writen(fd, buf, n);
-        
-        /* 캐싱 가능한지 확인 */
-        if (cacheable && total_size + n <= MAX_OBJECT_SIZE) {
-            memcpy(cache_buf + total_size, buf, n);
-            total_size += n;
-        } else {
-            cacheable = 0;
-        }
+    while (1) {
+        if (window_wait(w, rp) < 0 || (n = origin_readline(rp, line, idle_ms)) <= 0 ||
+            (pass && window_write(w, line, n) < 0))
+            return -1;
+        size = strtoll(line, &end, 16);
+        if (end == line || size < 0)
+            return -1;
+        if (size == 0)
+            break;
+        if (relay_length(rp, w, size, cap) < 0 ||
+            (n = origin_readline(rp, line, idle_ms)) <= 0 || !blank_line(line) ||
+            (pass && window_write(w, line, n) < 0))
+            return -1;
     }
+    /* trailer 헤더들과 빈 줄 */
+    do {
+        if (window_wait(w, rp) < 0 || (n = origin_readline(rp, line, idle_ms)) <= 0 ||
+            (pass && window_write(w, line, n) < 0))
+            return -1;
+    } while (!blank_line(line));
+    return 0;
+}
 
-    /* 캐시에 저장 */
-    if (cacheable && total_size > 0 && total_size <= MAX_OBJECT_SIZE) {
-        char *content = Malloc(total_size);
-        memcpy(content, cache_buf, total_size);
-        
-        P(&cache.w);
-        cache_insert(&cache, uri, content, total_size);
-        V(&cache.w);
-        
-        printf("Cached: %s (%zu bytes)\n", uri, total_size);
+/*
+ * relay_enchunk - EOF 까지인 본문을 읽은 만큼씩 청크로 감싸 넘긴다. 1.1
+ *     클라이언트는 연결이 닫히기를 기다리지 않고 끝을 안다. 청크 머리 자리를
+ *     버퍼 앞에 비워 두고 읽으므로 감싸면서 복사하지 않는다.
+ */
+int relay_enchunk(rio_t *rp, window_t *w, capture_t *cap) {
+    char buf[MAXBUF], size[24];
+    ssize_t n;
+    int k;
+
+    while (1) {
+        if (window_wait(w, rp) < 0 ||
+            (n = origin_read(rp, buf + sizeof(size), sizeof(buf) - sizeof(size) - 2)) < 0)
+            return -1;
+        if (n == 0)
+            return window_write(w, "0\r\n\r\n", 5);
+        capture_add(cap, buf + sizeof(size), n);
+        k = sprintf(size, "%zx\r\n", (size_t)n);
+        memcpy(buf + sizeof(size) - k, size, k);
+        memcpy(buf + sizeof(size) + n, "\r\n", 2);
+        if (window_write(w, buf + sizeof(size) - k, k + n + 2) < 0)
+            return -1;
     }
-    
-    Free(cache_buf);  // 임시 버퍼 해제
-    Close(serverfd);
 }
 
-/* URI 파싱 */
-void parse_uri(char *uri, char *hostname, char *port, char *path) {
-    char *ptr;
-    char uri_copy[MAXLINE];
-    
-    strcpy(uri_copy, uri);
-    strcpy(port, "80"); /* 기본 포트 */
-    
-    /* http:// 제거 */
-    ptr = strstr(uri_copy, "://");
-    if (ptr)
-        ptr += 3;
-    else
-        ptr = uri_copy;
-    
-    char *path_ptr = strchr(ptr, '/');
-    if (path_ptr) {
-        strcpy(path, path_ptr);
-        *path_ptr = '\0';
-    } else {
-        strcpy(path, "/");
+/*
+ * tunnel - CONNECT: origin 에 연결하고 200 을 보낸 뒤 두 연결을 터널 스레드에
+ *     넘긴다 (그 뒤로는 양쪽 바이트를 splice 로 옮길 뿐 해석하지 않는다).
+ *     클라이언트가 200 을 기다리지 않고 먼저 보낸 바이트 (Rio 버퍼에 남은 것) 는
+ *     origin 에 먼저 보낸다. 넘겼으면 CONN_HANDOFF (fd 는 tunnel_done 에서 닫힌다).
+ */
+int tunnel(int fd, rio_t *rio, request_t *rq) {
+    static char established[] = "HTTP/1.1 200 Connection Established\r\n\r\n";
+    int serverfd;
+
+    printf("Tunnel: %s\n", RQ_STR(rq, uri));
+    if ((serverfd = dial(RQ_STR(rq, hostname), RQ_STR(rq, port))) < 0) {
+        clienterror(fd, RQ_STR(rq, uri), "502", "Bad Gateway", "Could not connect to server");
+        return CONN_CLOSE;
     }
-    
-    /* 포트 번호 추출 */
-    char *port_ptr = strchr(ptr, ':');
-    if (port_ptr) {
-        *port_ptr = '\0';
-        strcpy(port, port_ptr + 1);
+    if (client_write(fd, established, sizeof(established) - 1) != sizeof(established) - 1 ||
+        (rio->rio_cnt > 0 && rio_writen(serverfd, rio->rio_bufptr, rio->rio_cnt) < 0)) {
+        Close(serverfd);
+        return CONN_CLOSE;
     }
-    
-    strcpy(hostname, ptr);
+    rio->rio_cnt = 0;
+    if (tunnel_submit(fd, serverfd) < 0) {
+        /* 200 은 이미 나갔으니 연결을 끊어 알린다 */
+        Close(serverfd);
+        return CONN_CLOSE;
+    }
+    return CONN_HANDOFF;
 }
 
-/* HTTP 요청 헤더 구성 */
-void build_request_header(rio_t *rio, char *header, char *hostname, char *port) {
-    char buf[MAXLINE];
-    char host_hdr[MAXLINE], other_hdr[MAXLINE];
-    
-    host_hdr[0] = '\0';
-    other_hdr[0] = '\0';
-    
-    while (Rio_readlineb(rio, buf, MAXLINE) > 0) {
-        if (!strcmp(buf, "\r\n"))
-            break;
-        
-        if (strstr(buf, "Host:")) {
-            strcpy(host_hdr, buf);
-        } else if (!strstr(buf, "User-Agent:") && 
-                   !strstr(buf, "Connection:") && 
-                   !strstr(buf, "Proxy-Connection:")) {
-            strcat(other_hdr, buf);
-        }
+/* 터널 스레드에서 터널이 끝났을 때 */
+void tunnel_done(int clientfd) {
+    Close(clientfd);
+    __atomic_sub_fetch(&active_conns, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * relay_via_engine - origin 주소를 구한 뒤 요청과 함께 I/O 엔진에 넘긴다.
+ *     응답은 capture_max 까지 모아 캐시에 넣는다 (0 이면 넣지 않는다).
+ *     넘겼으면 1 (fd 는 relay_done 에서 닫힌다), 실패하면 0.
+ */
+int relay_via_engine(int fd, char *uri, char *hostname, char *port, char *path, char *request_header,
+                     size_t capture_max) {
+    dns_result_t res;
+    ioeng_job_t job;
+    size_t reqlen;
+
+    if (dns_resolve(hostname, port, &res) < 0) {
+        clienterror(fd, hostname, "404", "Not found", "Could not resolve server");
+        return 0;
     }
-    
-    if (!strlen(host_hdr)) {
-        sprintf(host_hdr, "Host: %s\r\n", hostname);
+
+    memset(&job, 0, sizeof(job));
+    for (int i = 0; i < res.naddrs && job.naddrs < IOENG_MAXADDR; i++) {
+        memcpy(&job.addrs[job.naddrs], &res.addrs[i], res.addrlens[i]);
+        job.addrlens[job.naddrs++] = res.addrlens[i];
     }
-    
-    sprintf(header, "%s%s%s%s%s\r\n",
-            host_hdr,
-            "Connection: close\r\n",
-            "Proxy-Connection: close\r\n",
-            user_agent_hdr,
-            other_hdr);
+
+    reqlen = strlen(path) + strlen(request_header) + sizeof("GET  HTTP/1.0\r\n");
+    job.req = Malloc(reqlen);
+    job.reqlen = sprintf(job.req, "GET %s HTTP/1.0\r\n%s", path, request_header);
+    job.clientfd = fd;
+    job.capture_max = capture_max;
+    job.done = relay_done;
+    job.arg = Malloc(strlen(uri) + 1);
+    strcpy(job.arg, uri);
+    ioeng_submit(&job);
+    return 1;
 }
 
-/* 에러 응답 전송 */
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) {
-    char buf[MAXLINE], body[MAXBUF];
+/* 엔진 스레드에서 릴레이가 끝났을 때 - 캐시에 넣고 클라이언트 연결을 닫는다 */
+void relay_done(void *arg, int clientfd, int status, char *capture, size_t caplen) {
+    char *uri = arg;
+    http_resp_t resp;
+    ssize_t head;
+
+    if (status == IOENG_ECONNECT)
+        clienterror(clientfd, uri, "404", "Not found", "Could not connect to server");
+
+    /* 엔진은 바이트만 모은다 - 머리를 보고 200 이고 캐시해도 되는 것만 넣는다 */
+    if (capture && caplen > 0 &&
+        ((head = http_parse_head(capture, caplen, &resp)) < 0 ||
+         !http_resp_cacheable(&resp, head, MAX_OBJECT_SIZE) ||
+         (resp.content_length >= 0 && head + resp.content_length != caplen)))
+        caplen = 0;
+    if (capture && caplen > 0) {
+        char *content = Realloc(capture, caplen);
+
+        cache_put(uri, content, caplen);
+
+        printf("Cached: %s (%zu bytes)\n", uri, caplen);
+    } else if (capture) {
+        Free(capture);
+    }
+    Close(clientfd);
+    __atomic_sub_fetch(&active_conns, 1, __ATOMIC_RELAXED);
+    Free(uri);
+}
 
-    sprintf(body, "<html><title>Proxy Error</title>");
-    sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-    sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-    sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-    sprintf(body, "%s<hr><em>The Proxy Web server</em>\r\n", body);
+/* 엔진 스레드의 accept 콜백 - 워커 큐에 들어갈 만큼만 받는다 (엔진은 막히면 안 된다) */
+int engine_accept(int *fds, int n) {
+    connlog_t peers[ACCEPT_BATCH];
+    int k, m = 0;
 
-    sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: text/html\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-    Rio_writen(fd, buf, strlen(buf));
-    Rio_writen(fd, body, strlen(body));
+    /* 워커가 끝내기 전에 세도록 미리 올려 두고 못 넘긴 만큼 뺀다 */
+    __atomic_add_fetch(&active_conns, n, __ATOMIC_RELAXED);
+    k = sbuf_tryinsert_batch(&sbuf, fds, n);
+    __atomic_sub_fetch(&active_conns, n - k, __ATOMIC_RELAXED);
+    for (int i = 0; i < k; i++) {
+        peers[m].addrlen = sizeof(peers[m].addr);
+        if (getpeername(fds[i], (SA *)&peers[m].addr, &peers[m].addrlen) == 0)
+            m++;
+        if (m == ACCEPT_BATCH) {
+            logq_push_batch(&logq, peers, m);
+            m = 0;
+        }
+    }
+    if (m)
+        logq_push_batch(&logq, peers, m);
+    return k;
 }
 
 /* Shared buffer 함수들 */
@@ -327,6 +2453,35 @@ void sbuf_insert(sbuf_t *sp, int item) {
     V(&sp->items);
 }
 
+/* 여러 개를 한 번의 mutex 구간으로 넣는다 (accept 배치 전달용) */
+void sbuf_insert_batch(sbuf_t *sp, int *items, int n) {
+    for (int i = 0; i < n; i++)
+        P(&sp->slots);
+    P(&sp->mutex);
+    for (int i = 0; i < n; i++)
+        sp->buf[(++sp->rear) % (sp->n)] = items[i];
+    V(&sp->mutex);
+    for (int i = 0; i < n; i++)
+        V(&sp->items);
+}
+
+/* 빈 슬롯만큼만 넣고 넣은 수를 리턴 - 기다리지 않는다 */
+int sbuf_tryinsert_batch(sbuf_t *sp, int *items, int n) {
+    int k = 0;
+
+    while (k < n && sem_trywait(&sp->slots) == 0)
+        k++;
+    if (!k)
+        return 0;
+    P(&sp->mutex);
+    for (int i = 0; i < k; i++)
+        sp->buf[(++sp->rear) % (sp->n)] = items[i];
+    V(&sp->mutex);
+    for (int i = 0; i < k; i++)
+        V(&sp->items);
+    return k;
+}
+
 int sbuf_remove(sbuf_t *sp) {
     int item;
     P(&sp->items);
@@ -337,6 +2492,151 @@ int sbuf_remove(sbuf_t *sp) {
     return item;
 }
 
+/* accept 파이프라인 함수들 */
+
+/*
+ * accept_batch - 논블로킹 리슨 소켓에서 대기 중인 연결을 최대 max 개까지
+ *     accept4 로 꺼낸다. 주소는 숫자 그대로 peers 에 담아 두고 이름 변환은
+ *     하지 않는다. 꺼낸 연결 수를 리턴 (없으면 0).
+ */
+int accept_batch(int listenfd, int flags, int *fds, connlog_t *peers, int max) {
+    int n = 0, fd;
+
+    while (n < max) {
+        peers[n].addrlen = sizeof(peers[n].addr);
+        fd = accept4(listenfd, (SA *)&peers[n].addr, &peers[n].addrlen, flags);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "accept4 error: %s\n", strerror(errno));
+            break;  /* EAGAIN: 대기 중인 연결을 다 꺼냄, EMFILE 등: 다음 wakeup 에 재시도 */
+        }
+        fds[n++] = fd;
+    }
+    return n;
+}
+
+void logq_init(logq_t *lq, int n) {
+    lq->buf = Calloc(n, sizeof(connlog_t));
+    lq->n = n;
+    lq->front = lq->rear = 0;
+    lq->count = 0;
+    lq->dropped = 0;
+    Sem_init(&lq->mutex, 0, 1);
+    Sem_init(&lq->items, 0, 0);
+}
+
+/* accept 스레드는 절대 로그 때문에 기다리지 않는다 - 가득 차면 버리고 센다 */
+void logq_push_batch(logq_t *lq, connlog_t *peers, int n) {
+    int pushed = 0;
+
+    P(&lq->mutex);
+    for (int i = 0; i < n; i++) {
+        if (lq->count == lq->n) {
+            lq->dropped++;
+            continue;
+        }
+        lq->buf[(++lq->rear) % (lq->n)] = peers[i];
+        lq->count++;
+        pushed++;
+    }
+    V(&lq->mutex);
+    for (int i = 0; i < pushed; i++)
+        V(&lq->items);
+}
+
+/* SIGUSR1 을 받으면 origin 별 연결 통계를 출력한다 */
+void *signal_thread(void *vargp) {
+    sigset_t sigs;
+    int sig, fds[2], nfds;
+
+    Pthread_detach(pthread_self());
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGUSR2);
+    sigaddset(&sigs, SIGTERM);
+    while (1) {
+        if (sigwait(&sigs, &sig) != 0)
+            continue;
+        if (sig == SIGUSR1) {
+            dial_stats_dump(stdout);
+            cache_stats_dump(stdout);
+        } else if (sig == SIGUSR2 && !draining) {
+            /* 새 프로세스가 리슨 소켓을 받아 accept 를 시작해야 이쪽이 빠진다 */
+            fds[0] = listen_fd;
+            nfds = 1;
+            if (share_cache && (fds[1] = cache_export()) >= 0)
+                nfds = 2;
+            fflush(stdout);
+            sig = reload_spawn(saved_argv, fds, nfds);
+            if (nfds == 2)
+                Close(fds[1]);
+            if (sig < 0) {
+                printf("Reload failed - still serving\n");
+                continue;
+            }
+            printf("Reload: handed the listening socket to the new process\n");
+            begin_drain();
+        } else if (sig == SIGTERM) {
+            begin_drain();
+        }
+    }
+    return NULL;
+}
+
+/* accept 를 멈추게 하고 keep-alive 연결은 요청 사이에서 닫게 한다 */
+void begin_drain(void) {
+    char c = 1;
+
+    if (draining)
+        return;
+    draining = 1;
+    if (write(stop_pipe[1], &c, 1) < 0)
+        unix_error("stop pipe write error");
+}
+
+/* 진행 중인 연결이 다 끝나거나 DRAIN_MS 가 지나면 종료한다 (메인 스레드) */
+void drain_and_exit(void) {
+    int waited = 0, left;
+
+    while ((left = __atomic_load_n(&active_conns, __ATOMIC_RELAXED)) > 0 && waited < DRAIN_MS) {
+        usleep(100 * 1000);
+        waited += 100;
+    }
+    printf("Exiting (%d connections still open)\n", left);
+#ifdef CORO_STACK_CHECK
+    printf("Coro stack peak: %zu of %d bytes\n", coro_stack_peak(), CORO_STACK_SIZE);
+#endif
+    fflush(stdout);
+    exit(0);
+}
+
+/* 로그 스레드 루틴 - 숫자 주소로 변환해서 출력 */
+void *log_thread(void *vargp) {
+    char hostname[NI_MAXHOST], port[NI_MAXSERV];
+    connlog_t peer;
+    unsigned long dropped;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        P(&logq.items);
+        P(&logq.mutex);
+        peer = logq.buf[(++logq.front) % (logq.n)];
+        logq.count--;
+        dropped = logq.dropped;
+        logq.dropped = 0;
+        V(&logq.mutex);
+
+        if (dropped)
+            printf("(%lu connection log entries dropped)\n", dropped);
+        if (getnameinfo((SA *)&peer.addr, peer.addrlen, hostname, sizeof(hostname),
+                        port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+            printf("Accepted connection from (%s, %s)\n", hostname, port);
+    }
+    return NULL;
+}
+
 /* 캐시 함수들 */
 void cache_init(cache_t *cache) {
     cache->head = NULL;
@@ -344,10 +2644,113 @@ void cache_init(cache_t *cache) {
     cache->total_size = 0;
     cache->counter = 0;
     cache->readcnt = 0;
+    cache->hits = 0;
+    cache->remote = 0;
     Sem_init(&cache->mutex, 0, 1);
     Sem_init(&cache->w, 0, 1);
 }
 
+/* 이 스레드의 노드 캐시 - 고정되지 않은 스레드 (엔진, 분류기 등) 는 첫 노드 */
+cache_t *node_cache(void) {
+    int node = aff_node();
+
+    return &caches[node < 0 ? 0 : node];
+}
+
+/*
+ * cache_get - 이 노드 캐시부터 찾고, 없으면 다른 노드 캐시를 찾는다. 고정된
+ *     워커가 다른 노드에서 찾으면 로컬 캐시에 복제해 둔다 - 복사본은 이
+ *     워커가 처음 쓰므로 이 노드 메모리에 놓이고, 다음 hit 부터는 원격 메모리를
+ *     읽지 않는다. 찾은 블록은 cache_lookup 처럼 참조를 잡아서 돌려준다.
+ */
+cache_block *cache_get(char *url) {
+    cache_t *local = node_cache();
+    cache_block *block;
+    char *copy;
+
+    if ((block = cache_lookup(local, url)) != NULL || ncaches == 1) {
+        if (block)
+            __atomic_add_fetch(&local->hits, 1, __ATOMIC_RELAXED);
+        return block;
+    }
+    for (int i = 0; i < ncaches && !block; i++)
+        if (&caches[i] != local)
+            block = cache_lookup(&caches[i], url);
+    if (!block)
+        return NULL;
+
+    __atomic_add_fetch(&local->hits, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&local->remote, 1, __ATOMIC_RELAXED);
+    if (aff_node() >= 0) {
+        copy = Malloc(block->size);
+        memcpy(copy, block->content, block->size);
+        cache_put(url, copy, block->size);
+    }
+    return block;
+}
+
+/* 어느 노드 캐시에든 있는가 (통계도 복제도 없이) */
+int cache_contains(char *url) {
+    cache_block *block = NULL;
+
+    for (int i = 0; i < ncaches && !block; i++)
+        block = cache_lookup(&caches[i], url);
+    if (block)
+        cache_release(block);
+    return block != NULL;
+}
+
+/* hit 한 블록을 그 블록이 든 캐시의 LRU 맨 앞으로 - Writer lock */
+void cache_touch(cache_block *block) {
+    cache_t *cache = block->owner;
+
+    P(&cache->w);
+    block->lru_counter = cache->counter++;
+    V(&cache->w);
+}
+
+/* 이 노드 캐시에 넣는다 (content 는 캐시 것이 된다) */
+void cache_put(char *url, char *content, size_t size) {
+    cache_t *cache = node_cache();
+
+    P(&cache->w);
+    cache_insert(cache, url, content, size);
+    V(&cache->w);
+}
+
+/*
+ * cache_invalidate - url 의 사본을 모든 노드 캐시에서 지운다 (POST 등이 성공한
+ *     뒤). 보내는 중인 참조가 있으면 블록은 그쪽이 마지막에 해제한다.
+ */
+void cache_invalidate(char *url) {
+    cache_block *block;
+
+    for (int i = 0; i < ncaches; i++) {
+        P(&caches[i].w);
+        if ((block = cache_find(&caches[i], url)) != NULL)
+            cache_remove_block(&caches[i], block);
+        V(&caches[i].w);
+        if (block)
+            printf("Invalidated: %s\n", url);
+    }
+}
+
+/* 노드 캐시마다 한 줄씩 */
+void cache_stats_dump(FILE *fp) {
+    for (int i = 0; i < ncaches; i++) {
+        cache_t *cache = &caches[i];
+        size_t n = 0;
+
+        P(&cache->w);
+        for (cache_block *b = cache->head; b; b = b->next)
+            n++;
+        fprintf(fp, "cache node%d objects=%zu bytes=%zu hits=%lu remote=%lu\n",
+                aff_os_node(i), n, cache->total_size, cache->hits, cache->remote);
+        V(&cache->w);
+    }
+    fflush(fp);
+}
+
 cache_block *cache_find(cache_t *cache, char *url) {
     cache_block *block = cache->head;
     while (block) {
@@ -359,19 +2762,51 @@ cache_block *cache_find(cache_t *cache, char *url) {
     return NULL;
 }
 
+/*
+ * cache_lookup - Readers lock 안에서 찾고 참조를 하나 올려서 돌려준다.
+ *     호출한 쪽은 content 를 다 쓴 뒤 cache_release 해야 한다. 락은 바로
+ *     풀리므로 보내는 도중(코루틴이면 양보하는 도중)에도 쓰기 쪽이 막히지 않는다.
+ */
+cache_block *cache_lookup(cache_t *cache, char *url) {
+    cache_block *block;
+
+    P(&cache->mutex);
+    cache->readcnt++;
+    if (cache->readcnt == 1)
+        P(&cache->w);
+    V(&cache->mutex);
+
+    block = cache_find(cache, url);
+    if (block)   /* 다른 reader 도 동시에 올릴 수 있으므로 atomic */
+        __atomic_add_fetch(&block->refcnt, 1, __ATOMIC_RELAXED);
+
+    P(&cache->mutex);
+    cache->readcnt--;
+    if (cache->readcnt == 0)
+        V(&cache->w);
+    V(&cache->mutex);
+    return block;
+}
+
+/* 참조를 내려놓는다 - 마지막 참조였으면 (캐시에서 이미 빠진 블록) 해제 */
+void cache_release(cache_block *block) {
+    if (__atomic_sub_fetch(&block->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        Free(block->url);
+        Free(block->content);
+        Free(block);
+    }
+}
+
 void cache_insert(cache_t *cache, char *url, char *content, size_t size) {
-    if (size > MAX_OBJECT_SIZE)
+    if (size > MAX_OBJECT_SIZE) {
+        Free(content);          /* 넘겨받은 버퍼는 여기서 책임진다 */
         return;
+    }
 
-    /* 중복 확인 - 이미 존재하면 업데이트 */
+    /* 중복 확인 - 이미 존재하면 교체 (보내는 중인 쪽은 옛 블록을 계속 쓴다) */
     cache_block *existing = cache_find(cache, url);
-    if (existing) {
-        Free(existing->content);
-        existing->content = content;
-        existing->size = size;
-        existing->lru_counter = cache->counter++;
-        return;
-    }
+    if (existing)
+        cache_remove_block(cache, existing);
 
     /* LRU 정책: 필요시 제거 */
     while (cache->total_size + size > MAX_CACHE_SIZE && cache->tail) {
@@ -384,6 +2819,8 @@ void cache_insert(cache_t *cache, char *url, char *content, size_t size) {
     block->content = content;
     block->size = size;
     block->lru_counter = cache->counter++;
+    block->refcnt = 1;
+    block->owner = cache;
     block->next = cache->head;
     block->prev = NULL;
 
@@ -427,7 +2864,102 @@ void cache_remove_block(cache_t *cache, cache_block *block) {
         cache->tail = block->prev;
 
     cache->total_size -= block->size;
-    Free(block->url);
-    Free(block->content);
-    Free(block);
+    cache_release(block);   /* 캐시의 참조 - 보내는 중이면 그쪽이 마지막에 해제 */
+}
+
+static int lru_cmp(const void *a, const void *b) {
+    return (*(cache_block **)a)->lru_counter - (*(cache_block **)b)->lru_counter;
+}
+
+/*
+ * cache_export - 캐시 전체를 memfd (공유 메모리) 에 담아 그 fd 를 돌려준다.
+ *     재시작할 때 새 프로세스에 SCM_RIGHTS 로 넘긴다. 오래 안 쓴 것부터
+ *     담으므로 cache_import 가 순서대로 넣으면 LRU 순서가 그대로 남는다.
+ *     노드 캐시가 여럿이면 모두 담는다 (복제된 url 은 import 때 하나로 합쳐진다).
+ *     형식: magic, 개수, 그 뒤로 블록마다 url 길이, 크기, url, 내용.
+ *     실패하면 -1.
+ */
+int cache_export(void) {
+    cache_block **blocks, *b;
+    size_t total = 2 * sizeof(uint32_t);
+    uint32_t n = 0, *hdr;
+    char *map, *p;
+    int fd;
+
+    if ((fd = memfd_create("proxy-cache", MFD_CLOEXEC)) < 0)
+        return -1;
+    for (int c = 0; c < ncaches; c++) {
+        P(&caches[c].w);
+        for (b = caches[c].head; b; b = b->next) {
+            n++;
+            total += 2 * sizeof(uint32_t) + strlen(b->url) + b->size;
+        }
+    }
+    blocks = Malloc((n + 1) * sizeof(cache_block *));
+    n = 0;
+    for (int c = 0; c < ncaches; c++)
+        for (b = caches[c].head; b; b = b->next)
+            blocks[n++] = b;
+    qsort(blocks, n, sizeof(cache_block *), lru_cmp);
+
+    if (ftruncate(fd, total) < 0 ||
+        (map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        for (int c = 0; c < ncaches; c++)
+            V(&caches[c].w);
+        Free(blocks);
+        Close(fd);
+        return -1;
+    }
+    hdr = (uint32_t *)map;
+    hdr[0] = CACHE_MAGIC;
+    hdr[1] = n;
+    p = map + 2 * sizeof(uint32_t);
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t len[2] = { strlen(blocks[i]->url), blocks[i]->size };
+
+        memcpy(p, len, sizeof(len));
+        p += sizeof(len);
+        memcpy(p, blocks[i]->url, len[0]);
+        p += len[0];
+        memcpy(p, blocks[i]->content, len[1]);
+        p += len[1];
+    }
+    for (int c = 0; c < ncaches; c++)
+        V(&caches[c].w);
+    Munmap(map, total);
+    Free(blocks);
+    return fd;
+}
+
+/* cache_export 로 만든 공유 메모리에서 캐시를 채운다. 형식이 맞지 않으면 버린다 */
+void cache_import(cache_t *cache, int fd) {
+    struct stat st;
+    char *map, *p, *end, url[MAXLINE], *content;
+    uint32_t hdr[2], len[2], i;
+
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(hdr) ||
+        (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return;
+    end = map + st.st_size;
+    memcpy(hdr, map, sizeof(hdr));
+    p = map + sizeof(hdr);
+    for (i = 0; hdr[0] == CACHE_MAGIC && i < hdr[1]; i++) {
+        if (end - p < sizeof(len))
+            break;
+        memcpy(len, p, sizeof(len));
+        p += sizeof(len);
+        if (len[0] >= MAXLINE || end - p < (long long)len[0] + len[1])
+            break;
+        memcpy(url, p, len[0]);
+        url[len[0]] = '\0';
+        p += len[0];
+        content = Malloc(len[1]);
+        memcpy(content, p, len[1]);
+        p += len[1];
+        P(&cache->w);
+        cache_insert(cache, url, content, len[1]);
+        V(&cache->w);
+    }
+    printf("Inherited %u cached objects\n", i);
+    Munmap(map, st.st_size);
 }
\ No newline at end of file
@@ -39,7 +39,7 @@ sbuf_t sbuf;
 
 /* Function prototypes */
 void doit(int fd);
-void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname);
+int read_requesthdrs(rio_t *rp, char *request_buf, char *hostname);
 int parse_uri(char *uri, char *hostname, char *port, char *path);
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg,
                  char *longmsg);
@@ -81,9 +81,13 @@ int main(int argc, char **argv) {
 
   while (1) {
     clientlen = sizeof(clientaddr);
-    connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-    
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
+    /* Not Accept(): ECONNABORTED etc. cost only that connection */
+    connfd = accept(listenfd, (SA *)&clientaddr, &clientlen);
+    if (connfd < 0)
+      continue;
+
+    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
+                NI_NUMERICHOST | NI_NUMERICSERV);
     printf("Accepted connection from (%s, %s)\n", hostname, port);
     
     /* --- This is now concurrent --- */
@@ -125,8 +129,8 @@ void doit(int fd) {
   rio_t rio_server;          /* RIO buffer for server connection */
 
   /* 1. Read request line from browser */
-  Rio_readinitb(&rio_browser, fd);
-  if (!Rio_readlineb(&rio_browser, buf, MAXLINE))
+  rio_readinitb(&rio_browser, fd);
+  if (rio_readlineb(&rio_browser, buf, MAXLINE) <= 0)
     return;
   
   printf("Request from browser:\n%s", buf);
@@ -150,10 +154,11 @@ void doit(int fd) {
   sprintf(request_buf, "GET %s HTTP/1.0\r\n", path);
 
   /* 4. Read headers from browser and add required headers */
-  read_requesthdrs(&rio_browser, request_buf, hostname);
+  if (read_requesthdrs(&rio_browser, request_buf, hostname) < 0)
+    return;
 
   /* 5. Connect to the origin server (Proxy acts as a client) */
-  server_fd = Open_clientfd(hostname, port);
+  server_fd = open_clientfd(hostname, port); /* Not Open_clientfd: no exit */
   if (server_fd < 0) {
     clienterror(fd, hostname, "502", "Bad Gateway",
                 "Proxy couldn't connect to the server");
@@ -163,16 +168,21 @@ void doit(int fd) {
   printf("--- Forwarding request to %s:%s ---\n%s", hostname, port, request_buf);
 
   /* 6. Send the modified request to the origin server */
-  Rio_writen(server_fd, request_buf, strlen(request_buf));
+  if (rio_writen(server_fd, request_buf, strlen(request_buf)) < 0) {
+    Close(server_fd);
+    return;
+  }
 
   /*
    * 7. Relay the response from the origin server back to the browser
-   * Read from server_fd, write to fd (browser)
+   * Read from server_fd, write to fd (browser). An I/O error on either
+   * side ends only this transfer, so the unix_error() wrappers are not used.
    */
-  Rio_readinitb(&rio_server, server_fd);
+  rio_readinitb(&rio_server, server_fd);
   ssize_t n;
-  while ((n = Rio_readnb(&rio_server, buf, MAXLINE)) > 0) {
-    Rio_writen(fd, buf, n);
+  while ((n = rio_readnb(&rio_server, buf, MAXLINE)) > 0) {
+    if (rio_writen(fd, buf, n) != n)
+      break;
   }
 
   /* 8. Clean up */
@@ -182,13 +192,15 @@ void doit(int fd) {
 /*
  * read_requesthdrs - Read HTTP headers from browser (rp) and
  * build the new request (request_buf) to be
- * sent to the origin server.
+ * sent to the origin server. Returns -1 on EOF or error before the
+ * blank line.
  */
-void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname) {
+int read_requesthdrs(rio_t *rp, char *request_buf, char *hostname) {
   char buf[MAXLINE];
   int host_header_found = 0;
 
-  Rio_readlineb(rp, buf, MAXLINE);
+  if (rio_readlineb(rp, buf, MAXLINE) <= 0)
+    return -1;
   printf("%s", buf);
 
   while (strcmp(buf, "\r\n")) {
@@ -206,7 +218,8 @@ void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname) {
     else {
       strcat(request_buf, buf);
     }
-    Rio_readlineb(rp, buf, MAXLINE);
+    if (rio_readlineb(rp, buf, MAXLINE) <= 0)
+      return -1;
     printf("%s", buf);
   }
 
@@ -221,7 +234,7 @@ void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname) {
 
   /* Add the final blank line */
   strcat(request_buf, "\r\n");
-  return;
+  return 0;
 }
 
 /*
@@ -285,14 +298,14 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg,
   sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
   sprintf(body, "%s<hr><em>The Concurrent Proxy Server</em>\r\n", body);
 
-  /* Print the HTTP response */
+  /* Print the HTTP response (write errors: the browser is gone) */
   sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
+  rio_writen(fd, buf, strlen(buf));
   sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  rio_writen(fd, buf, strlen(buf));
   sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  rio_writen(fd, buf, strlen(buf));
+  rio_writen(fd, body, strlen(body));
 }
 
 /* ============================================ */
@@ -10,7 +10,7 @@ static const char *conn_hdr = "Connection: close\r\n";
 static const char *proxy_conn_hdr = "Proxy-Connection: close\r\n";
 
 void doit(int fd);
-void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname);
+int read_requesthdrs(rio_t *rp, char *request_buf, char *hostname);
 int parse_uri(char *uri, char *hostname, char *port, char *path);
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
 
@@ -25,13 +25,19 @@ int main(int argc, char **argv)
     fprintf(stderr, "usage: %s <port>\n", argv[0]);
     exit(1);
   }
+  // 응답 중에 브라우저가 끊어도 SIGPIPE 로 프록시가 죽지 않게
+  Signal(SIGPIPE, SIG_IGN);
   // 먼저 proxy 서버 열고
   listenfd = Open_listenfd(argv[1]);
   while (1) {
     clientlen = sizeof(clientaddr);
-    // 클라이언트가 프록시 서버에 연결 요청 
-    connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
+    // 클라이언트가 프록시 서버에 연결 요청 (Accept 말고 accept - 실패해도 그 연결만 버림)
+    connfd = accept(listenfd, (SA *)&clientaddr, &clientlen);
+    if (connfd < 0)
+      continue;
+    // 역방향 DNS 조회 없이 숫자 주소만 (조회가 느리면 accept 루프 전체가 멈춤)
+    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
+                NI_NUMERICHOST | NI_NUMERICSERV);
     printf("Accepted connection from (%s, %s)\n", hostname, port);
     // doit 함수 호출
     doit(connfd);
@@ -49,9 +55,9 @@ void doit(int fd)
   rio_t rio_browser;
   rio_t rio_server;
   // rio 구조체 초기화 해주고, fd에 연결
-  Rio_readinitb(&rio_browser, fd);
-  // rio 구조체 읽었는데 없어? -> 데이터 안 들어온거니까 return
-  if (!Rio_readlineb(&rio_browser, buf, MAXLINE))
+  rio_readinitb(&rio_browser, fd);
+  // rio 구조체 읽었는데 없어? (또는 읽기 에러) -> 데이터 안 들어온거니까 return
+  if (rio_readlineb(&rio_browser, buf, MAXLINE) <= 0)
     return;
 
   printf("Request from browser:\n%s", buf);
@@ -70,10 +76,13 @@ void doit(int fd)
   }
 
   sprintf(request_buf, "GET %s HTTP/1.0\r\n", path);
-  read_requesthdrs(&rio_browser, request_buf, hostname);
+  // 헤더 다 읽기 전에 끊기면 보낼 게 없으니 종료
+  if (read_requesthdrs(&rio_browser, request_buf, hostname) < 0)
+    return;
 
   // 이번엔 프록시가 클라이언트가 되는거임 -> tiny 서버에 연결 요청 -> 받은 fd 저장
-  server_fd = Open_clientfd(hostname, port);
+  // (Open_clientfd 는 실패하면 프록시를 exit 시키니까 open_clientfd)
+  server_fd = open_clientfd(hostname, port);
   // 받은 fd 가 0 이면? -> 서버랑 연결 안 됐다는 뜻, 에러문 띄우고 종료시켜
   if (server_fd < 0) {
     clienterror(fd, hostname, "502", "Bad Gateway", "Proxy couldn't connect to the server");
@@ -82,25 +91,32 @@ void doit(int fd)
 
   printf("--- Forwarding request to %s:%s ---\n%s", hostname, port, request_buf);
   // tiny 서버에 연결됐으니, 요청 보내
-  Rio_writen(server_fd, request_buf, strlen(request_buf));
+  if (rio_writen(server_fd, request_buf, strlen(request_buf)) < 0) {
+    Close(server_fd);
+    return;
+  }
 
   // tiny 서버에서 돌아온 응답값 받을 rio 버퍼 초기화하고, 연결
-  Rio_readinitb(&rio_server, server_fd);
+  rio_readinitb(&rio_server, server_fd);
   ssize_t n;
   // tiny 서버에서 돌아온 응답값 읽어서 클라이언트로 보내
-  while ((n = Rio_readnb(&rio_server, buf, MAXLINE)) > 0) {
-    Rio_writen(fd, buf, n);
+  // 어느 쪽이든 I/O 에러면 이 전송만 끝냄 (Rio_* 래퍼는 프록시를 exit 시킴)
+  while ((n = rio_readnb(&rio_server, buf, MAXLINE)) > 0) {
+    if (rio_writen(fd, buf, n) != n)
+      break;
   }
   // 연결 끝났으니 닫아줘야겠지?
   Close(server_fd);
 }
 
 // 이건 아직 왜 있는지 잘 모르겠음..;
-void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname) 
+// 빈 줄 전에 EOF 나 에러면 -1
+int read_requesthdrs(rio_t *rp, char *request_buf, char *hostname) 
 {
   char buf[MAXLINE];
   int host_header_found = 0;
-  Rio_readlineb(rp, buf, MAXLINE);
+  if (rio_readlineb(rp, buf, MAXLINE) <= 0)
+    return -1;
   printf("%s", buf);
 
   while (strcmp(buf, "\r\n")) {
@@ -111,7 +127,8 @@ void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname)
     } else {
       strcat(request_buf, buf);
     }
-    Rio_readlineb(rp, buf, MAXLINE);
+    if (rio_readlineb(rp, buf, MAXLINE) <= 0)
+      return -1;
     printf("%s", buf);
   }
 
@@ -123,7 +140,7 @@ void read_requesthdrs(rio_t *rp, char *request_buf, char *hostname)
   strcat(request_buf, conn_hdr);
   strcat(request_buf, proxy_conn_hdr);
   strcat(request_buf, "\r\n");
-  return;
+  return 0;
 }
 
 // uri 짜르는 부분 -> uri 기본형 (hostname, port, path 다 있는 경우로 우선 생각)
@@ -181,13 +198,14 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
   sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
   sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
   sprintf(body, "%s<hr><em>The Simple Proxy Server</em>\r\n", body);
+  // 브라우저가 이미 끊었어도 프록시는 계속 - 쓰기 에러는 무시
   sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
+  rio_writen(fd, buf, strlen(buf));
   sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  rio_writen(fd, buf, strlen(buf));
   sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  rio_writen(fd, buf, strlen(buf));
+  rio_writen(fd, body, strlen(body));
 }
 
 
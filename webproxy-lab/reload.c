@@ -0,0 +1,146 @@
+/*
+ * reload.c - 무중단 재시작
+ *
+ * 옛 프로세스는 UNIX 소켓 쌍을 만들고 같은 argv 로 자신을 fork + exec 한다.
+ * 새 프로세스는 RELOAD_ENV 로 받은 채널에서 리슨 소켓 등을 SCM_RIGHTS 로
+ * 받아 바로 accept 를 시작하고, 준비가 끝나면 1 바이트로 알린다. 옛 프로세스는
+ * 그 답을 받은 뒤에야 accept 를 멈추므로 그 사이에 들어온 연결은 둘 중 하나가
+ * 받는다 (같은 소켓이라 백로그도 하나). 새 프로세스가 죽거나 답이 없으면 옛
+ * 프로세스가 그대로 계속 서비스한다.
+ *
+ * 실행 파일은 argv[0] 로 다시 찾으므로 디스크에서 바뀐 새 바이너리가 뜬다
+ * (/proc/self/exe 는 지워진 옛 파일을 가리킨다).
+ */
+#define _GNU_SOURCE   /* execvpe, MSG_CMSG_CLOEXEC */
+#include <poll.h>
+#include "csapp.h"
+#include "reload.h"
+
+static int chan = -1;   /* 새 프로세스: 옛 프로세스에 준비를 알릴 채널 */
+
+/* environ 에서 RELOAD_ENV 를 빼고 var 를 붙인 사본 (fork 전에 만든다) */
+static char **child_env(char *var) {
+    char **envp;
+    int n = 0, k = 0;
+
+    while (environ[n])
+        n++;
+    envp = Malloc((n + 2) * sizeof(char *));
+    for (int i = 0; i < n; i++)
+        if (strncmp(environ[i], RELOAD_ENV "=", sizeof(RELOAD_ENV)))
+            envp[k++] = environ[i];
+    envp[k++] = var;
+    envp[k] = NULL;
+    return envp;
+}
+
+/*
+ * reload_spawn - 자신을 다시 실행하고 fds 를 넘긴다. 새 프로세스가 RELOAD_ACK_MS
+ *     안에 준비됐다고 답하면 0 (이제 accept 를 멈추고 빠져도 된다), 아니면 그
+ *     프로세스를 정리하고 -1.
+ */
+int reload_spawn(char **argv, int *fds, int nfds) {
+    char var[64], one = 1, cbuf[CMSG_SPACE(sizeof(int) * RELOAD_MAXFDS)];
+    char **envp;
+    int sv[2], rc = -1, n;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    struct pollfd pfd;
+    pid_t pid;
+
+    if (nfds > RELOAD_MAXFDS || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+        return -1;
+    snprintf(var, sizeof(var), "%s=%d", RELOAD_ENV, sv[1]);
+    envp = child_env(var);
+
+    if ((pid = fork()) == 0) {
+        fcntl(sv[1], F_SETFD, 0);   /* 이 fd 만 exec 너머로 */
+        execvpe(argv[0], argv, envp);
+        _exit(127);
+    }
+    Free(envp);
+    Close(sv[1]);
+    if (pid < 0) {
+        Close(sv[0]);
+        return -1;
+    }
+
+    /* 데이터 1 바이트 (fd 개수) 에 fd 들을 실어 보낸다 */
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    one = nfds;
+    iov.iov_base = &one;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+
+    if (sendmsg(sv[0], &msg, MSG_NOSIGNAL) == 1) {
+        pfd.fd = sv[0];
+        pfd.events = POLLIN;
+        while ((n = poll(&pfd, 1, RELOAD_ACK_MS)) < 0 && errno == EINTR)
+            ;
+        if (n > 0 && read(sv[0], &one, 1) == 1)
+            rc = 0;
+    }
+    Close(sv[0]);
+    if (rc < 0) {               /* 죽었거나 답이 없다 - 두 벌이 돌지 않게 정리 */
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    return rc;
+}
+
+/*
+ * reload_inherit - 재시작으로 뜬 프로세스면 옛 프로세스가 보낸 fd 들을 fds 에
+ *     받고 그 수를 돌려준다. 처음 뜬 프로세스면 0. 받은 뒤 서비스할 준비가
+ *     되면 reload_ready 를 불러야 한다.
+ */
+int reload_inherit(int *fds, int maxfds) {
+    char *s = getenv(RELOAD_ENV), nb, cbuf[CMSG_SPACE(sizeof(int) * RELOAD_MAXFDS)];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    int n;
+
+    if (!s)
+        return 0;
+    chan = atoi(s);
+    unsetenv(RELOAD_ENV);
+    fcntl(chan, F_SETFD, FD_CLOEXEC);
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &nb;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if (recvmsg(chan, &msg, MSG_CMSG_CLOEXEC) != 1 || !(cm = CMSG_FIRSTHDR(&msg)) ||
+        cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+        app_error("reload: no descriptors from the old process");
+    n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (n > maxfds)
+        app_error("reload: too many descriptors");
+    memcpy(fds, CMSG_DATA(cm), sizeof(int) * n);
+    return n;
+}
+
+/* 옛 프로세스에 이제 accept 하고 있다고 알린다 (처음 뜬 프로세스면 아무것도 안 한다) */
+void reload_ready(void) {
+    char one = 1;
+
+    if (chan < 0)
+        return;
+    if (write(chan, &one, 1) != 1)
+        fprintf(stderr, "reload: could not notify the old process\n");
+    Close(chan);
+    chan = -1;
+}
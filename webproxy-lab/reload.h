@@ -0,0 +1,16 @@
+/*
+ * reload.h - 무중단 재시작: 새로 exec 한 프로세스에 리슨 소켓 (과 캐시 사본)
+ *     을 UNIX 소켓의 SCM_RIGHTS 로 넘긴다
+ */
+#ifndef __RELOAD_H__
+#define __RELOAD_H__
+
+#define RELOAD_ENV "PROXY_RELOAD_FD"   /* 새 프로세스가 넘겨받을 채널 fd 번호 */
+#define RELOAD_ACK_MS 5000             /* 새 프로세스가 준비됐다고 알려 올 때까지 */
+#define RELOAD_MAXFDS 4
+
+int reload_spawn(char **argv, int *fds, int nfds);
+int reload_inherit(int *fds, int maxfds);
+void reload_ready(void);
+
+#endif /* __RELOAD_H__ */
@@ -0,0 +1,178 @@
+/*
+ * scan.c - 구분자 찾기 커널 (scalar, SSE4.2, AVX2)
+ *
+ * 요청 파싱에서 남은 뜨거운 루프는 CR/LF, ':', 공백, '?' 같은 구분자를 찾는
+ * 것이다. 같은 일을 하는 커널 셋 중 CPU 가 지원하는 가장 넓은 것을 시작할 때
+ * (CPUID, __builtin_cpu_supports) 골라 함수 포인터에 걸어 둔다.
+ *
+ *   scalar  한 바이트씩 (구분자가 여럿이면 256 비트 표로)
+ *   sse42   pcmpestri 로 16 바이트와 구분자 집합을 한 번에 비교 (EQUAL_ANY).
+ *           pcmpistri 는 NUL 에서 멈추므로 (요청에 NUL 이 섞여 오면 그 뒤를
+ *           건너뛴다) 길이를 주는 쪽을 쓴다.
+ *   avx2    구분자마다 32 바이트 pcmpeqb 를 OR 해서 movemask
+ *
+ * 헤더 줄은 대개 한두 블록이라 끝 처리가 속도를 좌우한다. 컴파일 플래그 없이도
+ * 되도록 SIMD 커널은 함수마다 target 속성을 붙인다.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+typedef size_t scan_fn(const char *p, size_t n, const char *set, size_t k);
+
+/*
+ * 끝에 남은 한 블록이 안 되는 바이트도 읽는 곳이 페이지를 넘지 않으면 한 블록을
+ * 통째로 읽고 n 뒤의 결과는 버린다 (페이지 안이면 읽어도 폴트가 나지 않는다).
+ */
+#define PAGE_SAFE(p, w) (((uintptr_t)(p) & 4095) <= 4096 - (w))
+
+static size_t scan_scalar(const char *p, size_t n, const char *set, size_t k) {
+    unsigned char map[256 / 8] = {0}, c;
+
+    if (k == 1) {
+        for (size_t i = 0; i < n; i++)
+            if (p[i] == set[0])
+                return i;
+        return n;
+    }
+    for (size_t j = 0; j < k; j++) {
+        c = set[j];
+        map[c >> 3] |= 1 << (c & 7);
+    }
+    for (size_t i = 0; i < n; i++) {
+        c = p[i];
+        if (map[c >> 3] & (1 << (c & 7)))
+            return i;
+    }
+    return n;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse4.2")))
+static size_t scan_sse42(const char *p, size_t n, const char *set, size_t k) {
+    char nb[16] = {0};
+    __m128i needle;
+    size_t i, left;
+    int idx;
+
+    memcpy(nb, set, k);
+    needle = _mm_loadu_si128((const __m128i *)nb);
+    for (i = 0; i < n; i += 16) {
+        left = n - i;
+        if (left < 16 && !PAGE_SAFE(p + i, 16))
+            return i + scan_scalar(p + i, left, set, k);
+        /* 길이를 주므로 left 뒤의 바이트는 비교하지 않는다 */
+        idx = _mm_cmpestri(needle, k, _mm_loadu_si128((const __m128i *)(p + i)),
+                           left < 16 ? left : 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16)
+            return i + idx;
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *p, size_t n, const char *set, size_t k) {
+    __m256i w0, w1, w2, w3, chunk, hit;
+    size_t i, left;
+    unsigned mask;
+
+    if (k > 4) {
+        _mm256_zeroupper();
+        return scan_sse42(p, n, set, k);
+    }
+    /* 구분자 넷까지는 레지스터에 - 모자라면 마지막 것을 되풀이한다 */
+    w0 = _mm256_set1_epi8(set[0]);
+    w1 = _mm256_set1_epi8(set[k > 1 ? 1 : 0]);
+    w2 = _mm256_set1_epi8(set[k > 2 ? 2 : k - 1]);
+    w3 = _mm256_set1_epi8(set[k > 3 ? 3 : k - 1]);
+    for (i = 0; i < n; i += 32) {
+        left = n - i;
+        if (left < 32 && !PAGE_SAFE(p + i, 32)) {
+            _mm256_zeroupper();     /* SSE 코드로 돌아가기 전에 (전환 비용) */
+            return i + scan_scalar(p + i, left, set, k);
+        }
+        chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+        hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, w0),
+                                              _mm256_cmpeq_epi8(chunk, w1)),
+                              _mm256_or_si256(_mm256_cmpeq_epi8(chunk, w2),
+                                              _mm256_cmpeq_epi8(chunk, w3)));
+        mask = _mm256_movemask_epi8(hit);
+        if (left < 32)
+            mask &= (1u << left) - 1;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return n;
+}
+#endif
+
+static const struct {
+    const char *name;
+    scan_fn *fn;
+} kernels[] = {
+    { "scalar", scan_scalar },
+#ifdef SCAN_X86
+    { "sse42", scan_sse42 },
+    { "avx2", scan_avx2 },
+#endif
+};
+
+static scan_fn *scan_impl = scan_scalar;
+static const char *scan_name = "scalar";
+
+/* 이 CPU 에서 kernel 을 쓸 수 있는가 */
+static int supported(const char *kernel) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (!strcmp(kernel, "sse42"))
+        return __builtin_cpu_supports("sse4.2");
+    if (!strcmp(kernel, "avx2"))
+        return __builtin_cpu_supports("avx2");
+#endif
+    return !strcmp(kernel, "scalar");
+}
+
+/*
+ * scan_use - 커널을 바꾼다 (벤치마크용). 없는 이름이거나 이 CPU 가 지원하지
+ *     않으면 -1. 다른 스레드가 스캔하는 도중에 바꾸지 않는다.
+ */
+int scan_use(const char *kernel) {
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (!strcmp(kernels[i].name, kernel) && supported(kernel)) {
+            scan_impl = kernels[i].fn;
+            scan_name = kernels[i].name;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *scan_kernel(void) {
+    return scan_name;
+}
+
+/* 시작할 때 가장 넓은 커널을 고른다 (main 전에 - 스레드가 생기기 전) */
+__attribute__((constructor))
+static void scan_pick(void) {
+    if (scan_use("avx2") < 0)
+        scan_use("sse42");
+}
+
+/*
+ * scan_any - p[0..n) 에서 set (NUL 로 끝나는 SCAN_SETMAX 자 이하의 구분자) 중
+ *     하나가 처음 나오는 위치, 없으면 n
+ */
+size_t scan_any(const char *p, size_t n, const char *set) {
+    return scan_impl(p, n, set, strlen(set));
+}
+
+/* 첫 '\n' 의 위치, 없으면 n */
+size_t scan_line(const char *p, size_t n) {
+    return scan_impl(p, n, "\n", 1);
+}
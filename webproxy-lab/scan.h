@@ -0,0 +1,17 @@
+/*
+ * scan.h - 요청 바이트에서 구분자 (줄 끝, ':', 공백, '?' 등) 를 찾는 커널
+ *     (httpreq 와 rio_readlineb 가 쓴다)
+ */
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <stddef.h>
+
+#define SCAN_SETMAX 16             /* 한 번에 찾을 수 있는 구분자 수 (pcmpestri 한 번) */
+
+size_t scan_any(const char *p, size_t n, const char *set);
+size_t scan_line(const char *p, size_t n);
+int scan_use(const char *kernel);
+const char *scan_kernel(void);
+
+#endif /* __SCAN_H__ */
@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+#
+# cachebypass.py - proxy_cache 의 캐시 우회 시험
+#
+#     python3 tests/cachebypass.py [./proxy_cache]
+#
+# Authorization, Cache-Control 이나 조건부 헤더 (If-*, Range) 가 붙은 요청은
+# 캐시로 답하지 않고 그 응답을 넣지도 않는다. origin 이 받은 요청 수로 본다.
+# 그런 요청은 캐시에 있는 URL 이라도 분류기가 빠른 (hit) 차선에 넣지 않으므로,
+# 느린 origin 을 기다리는 우회 요청이 hit 차선 워커를 모두 붙잡고 있어도 뒤따르는
+# hit 은 바로 답을 받는다.
+import http.server
+import socket
+import socketserver
+import subprocess
+import sys
+import threading
+import time
+
+BIN = sys.argv[1] if len(sys.argv) > 1 else "./proxy_cache"
+HIT_THREADS = 2                 # proxy_cache.c 의 HIT_THREADS
+SLOW_S = 2.0                    # /slow 가 두 번째부터 답하기까지
+hits = {}
+
+
+class Origin(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        hits[self.path] = hits.get(self.path, 0) + 1
+        if self.path == "/slow" and hits[self.path] > 1:
+            time.sleep(SLOW_S)
+        body = self.path.encode()
+        self.send_response(200)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(("127.0.0.1", 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def get(port, url, extra=b""):
+    """새 연결로 요청 하나를 보내고 응답 전체를 돌려준다"""
+    for _ in range(50):
+        try:
+            sock = socket.create_connection(("127.0.0.1", port))
+            break
+        except ConnectionRefusedError:
+            time.sleep(0.1)
+    else:
+        raise SystemExit("proxy did not start")
+    sock.sendall(b"GET %s HTTP/1.0\r\nHost: x\r\n%s\r\n" % (url, extra))
+    data = b""
+    while True:
+        chunk = sock.recv(4096)
+        if not chunk:
+            break
+        data += chunk
+    sock.close()
+    return data
+
+
+def main():
+    origin = Server(("127.0.0.1", 0), Origin)
+    threading.Thread(target=origin.serve_forever, daemon=True).start()
+    base = b"http://127.0.0.1:%d" % origin.server_address[1]
+    port = free_port()
+    proxy = subprocess.Popen([BIN, str(port)], stdout=subprocess.DEVNULL,
+                             stderr=subprocess.DEVNULL)
+    # (경로, 붙일 헤더, origin 이 받아야 할 요청 수) - 각각 두 번 요청한다
+    cases = [
+        ("/plain", b"", 1),
+        ("/auth", b"Authorization: Basic dTpw\r\n", 2),
+        ("/inm", b"If-None-Match: \"x\"\r\n", 2),
+        ("/nocache", b"Cache-Control: no-cache\r\n", 2),
+    ]
+    failed = 0
+    try:
+        for path, extra, want in cases:
+            for _ in range(2):
+                if not get(port, base + path.encode(), extra).endswith(path.encode()):
+                    print("FAIL %s: bad response" % path)
+                    failed = 1
+            if hits.get(path, 0) != want:
+                print("FAIL %s: origin saw %d requests, want %d"
+                      % (path, hits.get(path, 0), want))
+                failed = 1
+
+        # 우회한 요청이 캐시에 넣지 않았는지 - 뒤따르는 평범한 GET 은 origin 으로 간다
+        get(port, base + b"/auth")
+        if hits.get("/auth") != 3:
+            print("FAIL /auth: bypassed response was cached")
+            failed = 1
+        # 캐시에 있는 URL 이라도 조건부 요청은 origin 으로 간다
+        get(port, base + b"/plain", b"If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n")
+        if hits.get("/plain") != 2:
+            print("FAIL /plain: conditional request answered from the cache")
+            failed = 1
+
+        # 캐시에 있는 /slow 를 우회하는 요청들이 origin 을 기다리는 동안의 hit
+        get(port, base + b"/slow")
+        slow = [threading.Thread(target=get, args=(port, base + b"/slow",
+                                                   b"Cache-Control: no-cache\r\n"))
+                for _ in range(HIT_THREADS)]
+        for t in slow:
+            t.start()
+        time.sleep(0.3)
+        start = time.time()
+        get(port, base + b"/plain")
+        took = time.time() - start
+        for t in slow:
+            t.join()
+        if took > SLOW_S / 2:
+            print("FAIL lanes: hit took %.2fs behind bypassed requests" % took)
+            failed = 1
+    finally:
+        proxy.kill()
+        proxy.wait()
+        origin.shutdown()
+    print("cachebypass: %s" % ("FAIL" if failed else "OK"))
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+#
+# corostack.py - 코루틴 스택을 얼마나 깊이 쓰는지 재는 시험
+#
+#     python3 tests/corostack.py [./tests/proxy_cache_stk]
+#
+# CORO_STACK_CHECK 로 빌드한 proxy_cache 를 -m coro 로 띄워 깊은 경로들
+# (miss 의 길이/chunked/EOF 릴레이, 요청 본문 흘려 보내기, hit, HEAD, CONNECT,
+# 파이프라인, 이름 풀이 실패) 을 한 번씩 지나가게 한 뒤 SIGTERM 으로 끝내고,
+# 종료할 때 찍는 최대 사용량이 스택의 3/4 를 넘지 않는지 본다.
+import re
+import signal
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+BIN = sys.argv[1] if len(sys.argv) > 1 else "./tests/proxy_cache_stk"
+BIG = 1 << 20
+
+
+def read_head(sock):
+    data = b""
+    while b"\r\n\r\n" not in data:
+        chunk = sock.recv(4096)
+        if not chunk:
+            return None, b""
+        data += chunk
+    head, rest = data.split(b"\r\n\r\n", 1)
+    return head.decode("latin-1"), rest
+
+
+def read_body(sock, head, rest):
+    """요청 본문을 (Content-Length 든 chunked 든) 끝까지 읽는다"""
+    m = re.search(r"(?i)content-length: *(\d+)", head)
+    if m:
+        want = int(m.group(1))
+        while len(rest) < want:
+            rest += sock.recv(65536)
+        return rest[:want]
+    if re.search(r"(?i)transfer-encoding: *chunked", head):
+        while not rest.endswith(b"0\r\n\r\n"):
+            rest += sock.recv(65536)
+    return rest
+
+
+def origin(sock):
+    """경로에 따라 길이/chunked/EOF 응답을 하나 보내고 닫는다"""
+    head, rest = read_head(sock)
+    if head is None:
+        sock.close()
+        return
+    method, path = head.split(" ")[:2]
+    if "100-continue" in head.lower():
+        pass                    # 프록시가 대신 100 을 보낸다
+    body = read_body(sock, head, rest) if method == "POST" else b""
+    if path.startswith("/chunked"):
+        sock.sendall(b"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n")
+        for _ in range(16):
+            sock.sendall(b"%x\r\n%s\r\n" % (4096, b"c" * 4096))
+        sock.sendall(b"0\r\n\r\n")
+    elif path.startswith("/eof"):
+        sock.sendall(b"HTTP/1.0 200 OK\r\n\r\n" + b"e" * 65536)
+    else:
+        out = body or (b"b" * (BIG if path.startswith("/big") else 100))
+        sock.sendall(b"HTTP/1.1 200 OK\r\nContent-Length: %d\r\nConnection: close\r\n\r\n"
+                     % len(out) + (out if method != "HEAD" else b""))
+    sock.close()
+
+
+def serve(lsock):
+    while True:
+        conn, _ = lsock.accept()
+        threading.Thread(target=origin, args=(conn,), daemon=True).start()
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(("127.0.0.1", 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def exchange(port, data):
+    """새 연결로 data 를 보내고 프록시가 닫을 때까지 받는다"""
+    for _ in range(50):
+        try:
+            sock = socket.create_connection(("127.0.0.1", port))
+            break
+        except ConnectionRefusedError:
+            time.sleep(0.1)
+    else:
+        raise SystemExit("proxy did not start")
+    sock.settimeout(10)
+    sock.sendall(data)
+    out = b""
+    try:
+        while True:
+            chunk = sock.recv(65536)
+            if not chunk:
+                break
+            out += chunk
+    except socket.timeout:
+        pass
+    sock.close()
+    return out
+
+
+def main():
+    lsock = socket.socket()
+    lsock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    lsock.bind(("127.0.0.1", 0))
+    lsock.listen(64)
+    threading.Thread(target=serve, args=(lsock,), daemon=True).start()
+    oport = lsock.getsockname()[1]
+    base = b"http://127.0.0.1:%d" % oport
+    port = free_port()
+    proxy = subprocess.Popen([BIN, str(port), "-m", "coro"], stdout=subprocess.PIPE,
+                             stderr=subprocess.DEVNULL)
+    chunked_body = b"".join(b"%x\r\n%s\r\n" % (8192, b"p" * 8192) for _ in range(4)) + b"0\r\n\r\n"
+    cases = [
+        b"GET %s/big HTTP/1.0\r\n\r\n" % base,
+        b"GET %s/big HTTP/1.0\r\n\r\n" % base,                      # hit
+        b"HEAD %s/small HTTP/1.0\r\n\r\n" % base,
+        b"GET %s/chunked HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n" % base,
+        b"GET %s/chunked2 HTTP/1.0\r\n\r\n" % base,                 # 풀어서
+        b"GET %s/eof HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n" % base,  # 청크로 감싸
+        b"POST %s/post HTTP/1.0\r\nContent-Length: %d\r\n\r\n%s" % (base, 65536, b"q" * 65536),
+        b"POST %s/postc HTTP/1.1\r\nHost: x\r\nConnection: close\r\nExpect: 100-continue\r\n"
+        b"Transfer-Encoding: chunked\r\n\r\n%s" % (base, chunked_body),
+        b"GET %s/p1 HTTP/1.1\r\nHost: x\r\n\r\nGET %s/p2 HTTP/1.1\r\nHost: x\r\n\r\n"
+        b"GET %s/p3 HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n" % (base, base, base),
+        b"GET http://no-such-host.invalid/ HTTP/1.0\r\n\r\n",
+        b"CONNECT 127.0.0.1:%d HTTP/1.1\r\nHost: x\r\n\r\nGET /small HTTP/1.0\r\n\r\n" % oport,
+    ]
+    failed = 0
+    try:
+        for req in cases:
+            if not exchange(port, req).startswith(b"HTTP/1."):
+                print("FAIL %r: no response" % req.split(b"\r\n")[0])
+                failed = 1
+    finally:
+        time.sleep(0.2)
+        proxy.send_signal(signal.SIGTERM)
+        out = proxy.communicate(timeout=30)[0].decode()
+    m = re.search(r"Coro stack peak: (\d+) of (\d+) bytes", out)
+    if not m:
+        print("FAIL: no stack peak in the output")
+        failed = 1
+    else:
+        peak, size = int(m.group(1)), int(m.group(2))
+        print("coro stack peak: %d of %d bytes" % (peak, size))
+        if peak == 0 or peak > size * 3 // 4:
+            print("FAIL: peak outside (0, %d]" % (size * 3 // 4))
+            failed = 1
+    print("corostack: %s" % ("FAIL" if failed else "OK"))
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(main())
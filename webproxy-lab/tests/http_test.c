@@ -0,0 +1,72 @@
+/*
+ * http_test.c - http.c 의 응답 머리 해석 시험 (프레이밍)
+ *
+ *     make tests/http_test && ./tests/http_test
+ *
+ * Content-Length 는 요청 쪽과 같은 규칙 - 숫자만 받고, 부호, 뒤에 붙은 글자,
+ * 넘치는 값, 서로 다른 중복은 응답을 버린다 (resp.bad). 상태 줄의 이유 문구
+ * 자리는 1.0 응답을 청크로 감쌀 때 상태 줄을 다시 쓰는 데 쓰인다.
+ */
+#include "csapp.h"
+#include "http.h"
+
+static int failed;
+
+/* head 를 해석해 bad 와 (bad 가 아니면) 본문 길이를 맞춰 본다 */
+static void expect(const char *name, const char *head, int bad, long long len) {
+    http_resp_t resp;
+    ssize_t n = http_parse_head(head, strlen(head), &resp);
+
+    if (n != (ssize_t)strlen(head) || resp.bad != bad ||
+        (!bad && resp.content_length != len) ||
+        (bad && (http_resp_reusable(&resp) || http_resp_cacheable(&resp, n, 1 << 20)))) {
+        printf("FAIL %s: n=%zd bad=%d len=%lld\n", name, n, resp.bad, resp.content_length);
+        failed = 1;
+    }
+}
+
+/* 상태 줄을 해석해 버전, 상태 코드, 이유 문구를 맞춰 본다 */
+static void expect_status(const char *name, const char *line, int version, int status,
+                          const char *reason) {
+    http_resp_t resp;
+
+    if (http_parse_status_line(line, &resp) < 0 || resp.version != version ||
+        resp.status != status || resp.reason_len != (int)strlen(reason) ||
+        strncmp(line + resp.reason, reason, resp.reason_len)) {
+        printf("FAIL %s: version=%d status=%d reason=%.*s\n", name, resp.version,
+               resp.status, resp.reason_len, line + resp.reason);
+        failed = 1;
+    }
+}
+
+int main(void) {
+    expect("plain", "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n", 0, 5);
+    expect("zero", "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", 0, 0);
+    expect("trailing space", "HTTP/1.1 200 OK\r\nContent-Length: 12 \r\n\r\n", 0, 12);
+    expect("same duplicate",
+           "HTTP/1.1 200 OK\r\nContent-Length: 7\r\ncontent-length: 7\r\n\r\n", 0, 7);
+    expect("no length", "HTTP/1.1 200 OK\r\n\r\n", 0, -1);
+
+    expect("plus sign", "HTTP/1.1 200 OK\r\nContent-Length: +5\r\n\r\n", 1, 0);
+    expect("minus sign", "HTTP/1.1 200 OK\r\nContent-Length: -1\r\n\r\n", 1, 0);
+    expect("trailing junk", "HTTP/1.1 200 OK\r\nContent-Length: 5x\r\n\r\n", 1, 0);
+    expect("two values", "HTTP/1.1 200 OK\r\nContent-Length: 5 5\r\n\r\n", 1, 0);
+    expect("list", "HTTP/1.1 200 OK\r\nContent-Length: 5, 5\r\n\r\n", 1, 0);
+    expect("empty", "HTTP/1.1 200 OK\r\nContent-Length: \r\n\r\n", 1, 0);
+    expect("hex", "HTTP/1.1 200 OK\r\nContent-Length: 0x10\r\n\r\n", 1, 0);
+    expect("overflow",
+           "HTTP/1.1 200 OK\r\nContent-Length: 99999999999999999999\r\n\r\n", 1, 0);
+    expect("conflicting duplicate",
+           "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nContent-Length: 50\r\n\r\n", 1, 0);
+    expect("bad then good",
+           "HTTP/1.1 200 OK\r\nContent-Length: 5x\r\nContent-Length: 5\r\n\r\n", 1, 0);
+
+    expect_status("status 1.1", "HTTP/1.1 200 OK\r\n", 11, 200, "OK");
+    expect_status("status 1.0", "HTTP/1.0 404 Not Found\r\n", 10, 404, "Not Found");
+    expect_status("status spaces", "HTTP/1.0  200   Fine  thanks\n", 10, 200, "Fine  thanks");
+    expect_status("status no reason", "HTTP/1.0 204\r\n", 10, 204, "");
+    expect_status("status zero minor", "HTTP/01.00 200 OK\r\n", 10, 200, "OK");
+
+    printf("http_test: %s\n", failed ? "FAIL" : "OK");
+    return failed;
+}
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+#
+# keepalive.py - proxy_cache 의 클라이언트 keep-alive 시험
+#
+#     python3 tests/keepalive.py [./proxy_cache]
+#
+# 연결 하나를 CLIENT_MAX_REQS 개 요청으로 끝까지 쓴 뒤 닫고, 새 연결을 연다.
+# 새 연결은 닫힌 연결의 fd 번호를 다시 받으므로 요청 수가 이어지면 첫 응답부터
+# Connection: close 가 된다. 분류기가 있는 워커 스레드 모드에서 본다.
+import http.server
+import socket
+import socketserver
+import subprocess
+import sys
+import threading
+import time
+
+BIN = sys.argv[1] if len(sys.argv) > 1 else "./proxy_cache"
+MAX_REQS = 100                  # proxy_cache.c 의 CLIENT_MAX_REQS
+
+
+class Origin(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        body = self.path.encode()
+        self.send_response(200)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(("127.0.0.1", 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def get(f, sock, url):
+    """요청 하나를 보내고 (keep 여부, 본문) 을 돌려준다"""
+    sock.sendall(b"GET %s HTTP/1.1\r\nHost: x\r\n\r\n" % url)
+    status = f.readline()
+    if not status:
+        return None, None
+    keep, length = True, 0
+    while True:
+        line = f.readline()
+        if line in (b"\r\n", b""):
+            break
+        name, _, value = line.partition(b":")
+        name, value = name.strip().lower(), value.strip().lower()
+        if name == b"content-length":
+            length = int(value)
+        elif name == b"connection" and value == b"close":
+            keep = False
+    return keep, f.read(length)
+
+
+def connect(port):
+    for _ in range(50):
+        try:
+            return socket.create_connection(("127.0.0.1", port))
+        except ConnectionRefusedError:
+            time.sleep(0.1)
+    raise SystemExit("proxy did not start")
+
+
+def main():
+    origin = Server(("127.0.0.1", 0), Origin)
+    threading.Thread(target=origin.serve_forever, daemon=True).start()
+    url = b"http://127.0.0.1:%d/ka" % origin.server_address[1]
+    port = free_port()
+    proxy = subprocess.Popen([BIN, str(port)], stdout=subprocess.DEVNULL,
+                             stderr=subprocess.DEVNULL)
+    failed = 0
+    try:
+        # 첫 연결 - MAX_REQS 번째 응답에서만 닫혀야 한다
+        sock = connect(port)
+        f = sock.makefile("rb")
+        for i in range(1, MAX_REQS + 1):
+            keep, body = get(f, sock, url)
+            if body != b"/ka" or keep != (i < MAX_REQS):
+                print("FAIL first connection: request %d keep=%s" % (i, keep))
+                failed = 1
+                break
+        sock.close()
+        time.sleep(0.2)
+
+        # 같은 fd 를 다시 받는 연결들 - 요청 수는 처음부터
+        for n in range(2):
+            sock = connect(port)
+            f = sock.makefile("rb")
+            for i in range(1, 4):
+                keep, body = get(f, sock, url)
+                if body != b"/ka" or not keep:
+                    print("FAIL reused fd %d: request %d keep=%s" % (n, i, keep))
+                    failed = 1
+                    break
+            sock.close()
+            time.sleep(0.2)
+    finally:
+        proxy.kill()
+        proxy.wait()
+        origin.shutdown()
+    print("keepalive: %s" % ("FAIL" if failed else "OK"))
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,100 @@
+/*
+ * rio_test.c - csapp.c 의 논블로킹 Rio 시험
+ *
+ *     make tests/rio_test && ./tests/rio_test
+ *
+ * 논블로킹 socketpair 에 조금씩 써 넣으면서 rio_readlineb_nb 가 쪼개진 줄을
+ * 이어 읽는지, rio_readnb_nb 와 rio_writen_nb 가 EAGAIN 에서 진행한 바이트를
+ * *done 에 남기는지, 어느 것도 exit 하지 않는지 본다.
+ */
+#include "csapp.h"
+
+static int failed;
+
+static void check(const char *name, int ok) {
+    if (!ok) {
+        printf("FAIL %s\n", name);
+        failed = 1;
+    }
+}
+
+int main(void) {
+    int sv[2];
+    char line[64], buf[64], big[1 << 16];
+    size_t done = 0;
+    ssize_t rc;
+    rio_t rio;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) < 0)
+        unix_error("socketpair error");
+    rio_readinitb(&rio, sv[0]);
+
+    /* 줄이 아직 안 왔다 */
+    rc = rio_readlineb_nb(&rio, line, sizeof(line), &done);
+    check("line: empty -> EAGAIN", rc < 0 && errno == EAGAIN && done == 0);
+
+    /* 줄 앞부분만 - 읽은 만큼은 line 에 남고 EAGAIN */
+    write(sv[1], "GET / HT", 8);
+    rc = rio_readlineb_nb(&rio, line, sizeof(line), &done);
+    check("line: partial -> EAGAIN", rc < 0 && errno == EAGAIN && done == 8 &&
+          !memcmp(line, "GET / HT", 8));
+
+    /* 나머지와 다음 줄 - 첫 줄만 돌려주고 다음 줄은 Rio 버퍼에 */
+    write(sv[1], "TP/1.0\r\nHost: x\r\n", 17);
+    rc = rio_readlineb_nb(&rio, line, sizeof(line), &done);
+    check("line: resumed", rc == 16 && !strcmp(line, "GET / HTTP/1.0\r\n"));
+    done = 0;
+    rc = rio_readlineb_nb(&rio, line, sizeof(line), &done);
+    check("line: buffered", rc == 9 && !strcmp(line, "Host: x\r\n"));
+
+    /* 줄이 maxlen 보다 길면 maxlen-1 바이트에서 끊는다 */
+    write(sv[1], "0123456789\n", 11);
+    done = 0;
+    rc = rio_readlineb_nb(&rio, line, 5, &done);
+    check("line: maxlen", rc == 4 && !strcmp(line, "0123"));
+    done = 0;
+    rc = rio_readlineb_nb(&rio, line, sizeof(line), &done);
+    check("line: after maxlen", rc == 7 && !strcmp(line, "456789\n"));
+
+    /* n 바이트 중 일부만 왔다 - 진행은 done 에 */
+    write(sv[1], "abcde", 5);
+    done = 0;
+    rc = rio_readnb_nb(&rio, buf, 10, &done);
+    check("readn: partial -> EAGAIN", rc < 0 && errno == EAGAIN && done == 5);
+    write(sv[1], "fghijklm", 8);
+    rc = rio_readnb_nb(&rio, buf, 10, &done);
+    check("readn: resumed", rc == 10 && done == 10 && !memcmp(buf, "abcdefghij", 10));
+
+    /* EOF - 남은 것만 돌려주고 (짧다) 그 다음은 0 */
+    close(sv[1]);
+    done = 0;
+    rc = rio_readnb_nb(&rio, buf, 10, &done);
+    check("readn: short at EOF", rc == 3 && !memcmp(buf, "klm", 3));
+    done = 0;
+    rc = rio_readlineb_nb(&rio, line, sizeof(line), &done);
+    check("line: EOF", rc == 0 && done == 0);
+    close(sv[0]);
+
+    /* 받는 쪽이 읽지 않으면 쓰기는 EAGAIN 에서 멈추고, 읽어 주면 이어 쓴다 */
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) < 0)
+        unix_error("socketpair error");
+    memset(big, 'x', sizeof(big));
+    done = 0;
+    for (int i = 0; i < 64 && (rc = rio_writen_nb(sv[0], big, sizeof(big), &done)) >= 0; i++)
+        done = 0;
+    check("writen: full -> EAGAIN", rc < 0 && errno == EAGAIN && done < sizeof(big));
+    while (read(sv[1], big, sizeof(big)) > 0)
+        ;
+    rc = rio_writen_nb(sv[0], big, sizeof(big), &done);
+    check("writen: resumed", rc == (ssize_t)sizeof(big) && done == sizeof(big));
+
+    /* 끊긴 상대에게 쓰면 SIGPIPE 없이 EPIPE */
+    close(sv[1]);
+    done = 0;
+    rc = rio_writen_nb(sv[0], big, 16, &done);
+    check("writen: EPIPE", rc < 0 && errno == EPIPE);
+    close(sv[0]);
+
+    printf("rio_test: %s\n", failed ? "FAIL" : "OK");
+    return failed;
+}
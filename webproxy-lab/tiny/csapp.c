@@ -23,6 +23,7 @@
  */
 /* $begin csapp.c */
 #include "csapp.h"
+#include "scan.h"
 
 /************************** 
  * Error-handling functions
@@ -742,6 +743,21 @@ void V(sem_t *sem)
  * The Rio package - Robust I/O functions
  ****************************************/
 
+/* $begin rio_wait */
+__thread rio_wait_fn *rio_wait_hook = NULL;
+
+/*
+ * rio_wait - If the last call failed with EAGAIN and this thread has a
+ *     wait hook, park until fd is ready. Returns 0 to retry, -1 otherwise.
+ */
+static int rio_wait(int fd, int events)
+{
+    if ((errno != EAGAIN && errno != EWOULDBLOCK) || !rio_wait_hook)
+	return -1;
+    return rio_wait_hook(fd, events);
+}
+/* $end rio_wait */
+
 /*
  * rio_readn - Robustly read n bytes (unbuffered)
  */
@@ -756,6 +772,8 @@ ssize_t rio_readn(int fd, void *usrbuf, size_t n)
 	if ((nread = read(fd, bufp, nleft)) < 0) {
 	    if (errno == EINTR) /* Interrupted by sig handler return */
 		nread = 0;      /* and call read() again */
+	    else if (rio_wait(fd, POLLIN) == 0)
+		nread = 0;      /* Would block: retry once readable */
 	    else
 		return -1;      /* errno set by read() */ 
 	} 
@@ -782,6 +800,8 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 	if ((nwritten = write(fd, bufp, nleft)) <= 0) {
 	    if (errno == EINTR)  /* Interrupted by sig handler return */
 		nwritten = 0;    /* and call write() again */
+	    else if (rio_wait(fd, POLLOUT) == 0)
+		nwritten = 0;    /* Would block: retry once writable */
 	    else
 		return -1;       /* errno set by write() */
 	}
@@ -792,6 +812,58 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write a gather list (unbuffered)
+ *    One writev() per call in the common case. Non-zero flags (MSG_MORE)
+ *    go through sendmsg() so the kernel holds a short head for the data
+ *    that follows; non-sockets fall back to writev(). Advances iov past
+ *    what was written, so the caller's array is consumed.
+ */
+/* $begin rio_writev */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt, int flags)
+{
+    struct msghdr msg;
+    size_t n = 0;
+    ssize_t nwritten = 0;
+
+    while (1) {
+	/* Skip what was written (and empty fragments) */
+	while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt == 0)
+	    break;
+	iov->iov_base = (char *)iov->iov_base + nwritten;
+	iov->iov_len -= nwritten;
+
+	if (flags) {
+	    memset(&msg, 0, sizeof(msg));
+	    msg.msg_iov = iov;
+	    msg.msg_iovlen = iovcnt;
+	    nwritten = sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+	    if (nwritten < 0 && errno == ENOTSOCK) {
+		flags = 0;       /* Pipe (or file): plain writev */
+		nwritten = 0;
+		continue;
+	    }
+	} else
+	    nwritten = writev(fd, iov, iovcnt);
+	if (nwritten <= 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nwritten = 0;    /* and call writev() again */
+	    else if (rio_wait(fd, POLLOUT) == 0)
+		nwritten = 0;    /* Would block: retry once writable */
+	    else
+		return -1;       /* errno set by writev() */
+	}
+	n += nwritten;
+    }
+    return n;
+}
+/* $end rio_writev */
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -807,10 +879,10 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
     int cnt;
 
     while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
+	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, rp->rio_size);
 	if (rp->rio_cnt < 0) {
-	    if (errno != EINTR) /* Interrupted by sig handler return */
+	    if (errno != EINTR && /* Interrupted by sig handler return */
+		rio_wait(rp->rio_fd, POLLIN) < 0)
 		return -1;
 	}
 	else if (rp->rio_cnt == 0)  /* EOF */
@@ -836,14 +908,29 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 /* $begin rio_readinitb */
 void rio_readinitb(rio_t *rp, int fd) 
 {
-    rp->rio_fd = fd;  
-    rp->rio_cnt = 0;  
-    rp->rio_bufptr = rp->rio_buf;
+    rio_readinitb_buf(rp, fd, rp->rio_ibuf, RIO_BUFSIZE);
 }
 /* $end rio_readinitb */
 
+/*
+ * rio_readinitb_buf - Like rio_readinitb, but read through the caller's
+ *    buffer buf[0..size): large for bulk relays (fewer read() calls),
+ *    small for control connections. The buffer must outlive rp.
+ */
+void rio_readinitb_buf(rio_t *rp, int fd, char *buf, size_t size)
+{
+    rp->rio_fd = fd;
+    rp->rio_cnt = 0;
+    rp->rio_buf = buf;
+    rp->rio_size = size;
+    rp->rio_bufptr = buf;
+}
+
+
 /*
  * rio_readnb - Robustly read n bytes (buffered)
+ *    Once the buffer is empty, a request at least as large as the buffer
+ *    is read straight into usrbuf (no copy through a small buffer).
  */
 /* $begin rio_readnb */
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) 
@@ -853,9 +940,16 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
     char *bufp = usrbuf;
     
     while (nleft > 0) {
-	if ((nread = rio_read(rp, bufp, nleft)) < 0) 
+	if (rp->rio_cnt <= 0 && nleft >= rp->rio_size) {
+	    if ((nread = read(rp->rio_fd, bufp, nleft)) < 0) {
+		if (errno == EINTR || rio_wait(rp->rio_fd, POLLIN) == 0)
+		    continue;   /* Interrupted, or would block: retry */
+		return -1;      /* errno set by read() */
+	    }
+	}
+	else if ((nread = rio_read(rp, bufp, nleft)) < 0) 
             return -1;          /* errno set by read() */ 
-	else if (nread == 0)
+	if (nread == 0)
 	    break;              /* EOF */
 	nleft -= nread;
 	bufp += nread;
@@ -866,33 +960,178 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 
 /* 
  * rio_readlineb - Robustly read a text line (buffered)
+ *    Searches the buffered window for '\n' with scan_line() and copies
+ *    the line out with one memcpy instead of one rio_read() per byte.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+    size_t n = 0, cnt, len;
+    int rc, found;
+    char *bufp = usrbuf;
+
+    while (n + 1 < maxlen) {
+	if (rp->rio_cnt <= 0) {   /* Empty: let rio_read refill (and wait) */
+	    if ((rc = rio_read(rp, bufp + n, 1)) < 0)
+		return -1;	  /* Error */
+	    if (rc == 0)
+		break;		  /* EOF */
+	    if (bufp[n++] == '\n')
+		break;
+	    continue;
+	}
+	cnt = maxlen - 1 - n;
+	if (cnt > rp->rio_cnt)
+	    cnt = rp->rio_cnt;
+	len = scan_line(rp->rio_bufptr, cnt);
+	if ((found = len < cnt))
+	    len++;		  /* Include the '\n' */
+	memcpy(bufp + n, rp->rio_bufptr, len);
+	rp->rio_bufptr += len;
+	rp->rio_cnt -= len;
+	n += len;
+	if (found)
+	    break;
     }
-    *bufp = 0;
-    return n-1;
+    bufp[n] = 0;
+    return n;
 }
 /* $end rio_readlineb */
 
+/*
+ * Non-blocking Rio - for event loops driving O_NONBLOCK descriptors.
+ *    These never wait (not even through rio_wait_hook) and never exit.
+ *    Progress is kept in *done, so a call that fails with EAGAIN can be
+ *    repeated with the same arguments once the descriptor is ready:
+ *        >= 0  finished: all n bytes (or fewer at EOF), or one line
+ *        -1    errno == EAGAIN: *done bytes so far, call again later;
+ *              any other errno: this connection is broken
+ */
+
+/* read() that restarts after a signal handler */
+static ssize_t read_nointr(int fd, void *buf, size_t n)
+{
+    ssize_t rc;
+
+    while ((rc = read(fd, buf, n)) < 0 && errno == EINTR)
+	;
+    return rc;
+}
+
+/* rio_fill_nb - Refill an empty buffer: >0 bytes, 0 at EOF, -1 on error */
+static ssize_t rio_fill_nb(rio_t *rp)
+{
+    ssize_t rc;
+
+    if ((rc = read_nointr(rp->rio_fd, rp->rio_buf, rp->rio_size)) > 0) {
+	rp->rio_cnt = rc;
+	rp->rio_bufptr = rp->rio_buf;
+    }
+    return rc;
+}
+
+/*
+ * rio_writen_nb - Write usrbuf[*done..n). Uses MSG_NOSIGNAL on sockets, so
+ *    a peer that reset the connection yields EPIPE instead of SIGPIPE.
+ */
+/* $begin rio_writen_nb */
+ssize_t rio_writen_nb(int fd, void *usrbuf, size_t n, size_t *done)
+{
+    ssize_t nwritten;
+    char *bufp = usrbuf;
+
+    while (*done < n) {
+	nwritten = send(fd, bufp + *done, n - *done, MSG_NOSIGNAL);
+	if (nwritten < 0 && errno == ENOTSOCK)
+	    nwritten = write(fd, bufp + *done, n - *done);
+	if (nwritten < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		continue;
+	    return -1;           /* EAGAIN: come back when writable */
+	}
+	*done += nwritten;
+    }
+    return n;
+}
+/* $end rio_writen_nb */
+
+/*
+ * rio_readnb_nb - Read usrbuf[*done..n) through rp (buffered, like
+ *    rio_readnb). Returns *done, which is short of n only at EOF.
+ */
+/* $begin rio_readnb_nb */
+ssize_t rio_readnb_nb(rio_t *rp, void *usrbuf, size_t n, size_t *done)
+{
+    ssize_t nread;
+    size_t cnt;
+    char *bufp = usrbuf;
+
+    while (*done < n) {
+	if (rp->rio_cnt <= 0) {
+	    if (n - *done >= rp->rio_size) { /* Large: straight into usrbuf */
+		if ((nread = read_nointr(rp->rio_fd, bufp + *done, n - *done)) > 0) {
+		    *done += nread;
+		    continue;
+		}
+	    }
+	    else
+		nread = rio_fill_nb(rp);
+	    if (nread < 0)
+		return -1;      /* EAGAIN: *done bytes so far */
+	    if (nread == 0)
+		break;          /* EOF */
+	}
+	cnt = n - *done;
+	if (cnt > rp->rio_cnt)
+	    cnt = rp->rio_cnt;
+	memcpy(bufp + *done, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	*done += cnt;
+    }
+    return *done;
+}
+/* $end rio_readnb_nb */
+
+/*
+ * rio_readlineb_nb - Read a text line into usrbuf (buffered, like
+ *    rio_readlineb). The part of the line read so far stays in
+ *    usrbuf[0..*done), so the line resumes where it stopped; set *done
+ *    to 0 before each new line. Returns the line length (0 at EOF).
+ */
+/* $begin rio_readlineb_nb */
+ssize_t rio_readlineb_nb(rio_t *rp, void *usrbuf, size_t maxlen, size_t *done)
+{
+    size_t cnt, len;
+    ssize_t rc;
+    int found;
+    char *bufp = usrbuf;
+
+    while (*done + 1 < maxlen) {
+	if (rp->rio_cnt <= 0) {
+	    if ((rc = rio_fill_nb(rp)) < 0)
+		return -1;	  /* EAGAIN: partial line kept in usrbuf */
+	    if (rc == 0)
+		break;		  /* EOF */
+	}
+	cnt = maxlen - 1 - *done;
+	if (cnt > rp->rio_cnt)
+	    cnt = rp->rio_cnt;
+	len = scan_line(rp->rio_bufptr, cnt);
+	if ((found = len < cnt))
+	    len++;		  /* Include the '\n' */
+	memcpy(bufp + *done, rp->rio_bufptr, len);
+	rp->rio_bufptr += len;
+	rp->rio_cnt -= len;
+	*done += len;
+	if (found)
+	    break;
+    }
+    bufp[*done] = 0;
+    return *done;
+}
+/* $end rio_readlineb_nb */
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -946,6 +1185,29 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
  *       -2 for getaddrinfo error
  *       -1 with errno set for other errors.
  */
+/*
+ * connect_wait - Finish a non-blocking connect by parking on the wait hook
+ *     until the socket is writable, then collect the result.
+ */
+static int connect_wait(int clientfd)
+{
+    int err;
+    socklen_t len = sizeof(err);
+
+    if (errno != EINPROGRESS || !rio_wait_hook)
+	return -1;
+    errno = EAGAIN;
+    if (rio_wait(clientfd, POLLOUT) < 0)
+	return -1;
+    if (getsockopt(clientfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+	return -1;
+    if (err) {
+	errno = err;
+	return -1;
+    }
+    return 0;
+}
+
 /* $begin open_clientfd */
 int open_clientfd(char *hostname, char *port) {
     int clientfd, rc;
@@ -963,13 +1225,17 @@ int open_clientfd(char *hostname, char *port) {
   
     /* Walk the list for one that we can successfully connect to */
     for (p = listp; p; p = p->ai_next) {
-        /* Create a socket descriptor */
-        if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) 
+        /* Create a socket descriptor (non-blocking under a wait hook) */
+        if ((clientfd = socket(p->ai_family,
+                               p->ai_socktype | (rio_wait_hook ? SOCK_NONBLOCK : 0),
+                               p->ai_protocol)) < 0) 
             continue; /* Socket failed, try the next */
 
         /* Connect to the server */
         if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) 
             break; /* Success */
+        if (connect_wait(clientfd) == 0)
+            break; /* Non-blocking connect completed */
         if (close(clientfd) < 0) { /* Connect failed, try another */  //line:netp:openclientfd:closefd
             fprintf(stderr, "open_clientfd: close failed: %s\n", strerror(errno));
             return -1;
@@ -0,0 +1,54 @@
+/* hdrtab.h - hdrgen.py 가 만든 것 (고치지 말 것) */
+#define HDRTAB_SLOTS 64
+#define HDRTAB_MINLEN 2
+#define HDRTAB_MAXLEN 19
+
+static const unsigned char hdrtab_asso[256] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0, 46,  0, 57, 22, 23, 13, 44, 42, 20,  0, 12, 14,  0, 58, 57,
+    51,  0, 59, 24,  9, 10, 35,  0, 38, 56,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+};
+
+static const unsigned char hdrtab_slot[HDRTAB_SLOTS] = {
+    [0] = HDR_IF_RANGE,
+    [1] = HDR_TRANSFER_ENCODING,
+    [2] = HDR_CACHE_CONTROL,
+    [4] = HDR_KEEP_ALIVE,
+    [5] = HDR_RANGE,
+    [6] = HDR_TRAILER,
+    [9] = HDR_IF_MODIFIED_SINCE,
+    [11] = HDR_IF_UNMODIFIED_SINCE,
+    [12] = HDR_EXPECT,
+    [13] = HDR_VARY,
+    [16] = HDR_ETAG,
+    [19] = HDR_IF_MATCH,
+    [21] = HDR_CONTENT_TYPE,
+    [23] = HDR_PROXY_AUTHENTICATE,
+    [24] = HDR_IF_NONE_MATCH,
+    [27] = HDR_UPGRADE,
+    [28] = HDR_EXPIRES,
+    [31] = HDR_LAST_MODIFIED,
+    [34] = HDR_PRAGMA,
+    [42] = HDR_CONTENT_LENGTH,
+    [48] = HDR_HOST,
+    [52] = HDR_AGE,
+    [53] = HDR_USER_AGENT,
+    [54] = HDR_CONNECTION,
+    [56] = HDR_PROXY_CONNECTION,
+    [57] = HDR_TE,
+    [59] = HDR_PROXY_AUTHORIZATION,
+    [63] = HDR_AUTHORIZATION,
+};
@@ -0,0 +1,202 @@
+/*
+ * httpreq.c - HTTP 요청 파서
+ *
+ * 읽은 바이트를 쌓아 둔 버퍼를 그대로 두고 method, 대상과 그 구성 요소,
+ * 헤더 이름/값의 위치만 기록한다 (복사도, NUL 도 쓰지 않는다). 줄 단위로
+ * 진행하고 어디까지 봤는지 hreq_t 에 남기므로 논블로킹 소켓에서 조금씩 받을
+ * 때마다 같은 버퍼 (앞부분은 그대로, 뒤에 이어 붙인 것) 로 다시 부르면 된다.
+ * 새로 받은 바이트만 보므로 전체는 요청 길이에 비례한다. 구분자는 scan.c 의
+ * SIMD 커널로 찾는다. 헤더 이름은 그 자리에서 번호 (hdrname.h) 로 바꿔 두므로
+ * 쓰는 쪽은 이름을 다시 비교하지 않고 번호로 고른다.
+ */
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include "httpreq.h"
+#include "scan.h"
+
+#define ST_LINE 0      /* 요청 줄을 기다린다 */
+#define ST_HDRS 1
+#define ST_DONE 2
+
+static int is_ws(char c) {
+    return c == ' ' || c == '\t';
+}
+
+void hreq_init(hreq_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->minor = -1;
+}
+
+/* [*p, end) 에서 공백 전까지를 조각으로 떼고 *p 를 그 다음 공백 뒤로 */
+static hslice_t take_word(const char *buf, size_t *p, size_t end) {
+    hslice_t s;
+
+    while (*p < end && is_ws(buf[*p]))
+        (*p)++;
+    s.off = *p;
+    s.len = scan_any(buf + *p, end - *p, " \t");
+    *p += s.len;
+    return s;
+}
+
+/*
+ * hreq_split_uri - 요청 대상을 나눈다. "http://host:port/path?q", "host:port/path"
+ *     (예전 프록시가 받던 꼴), "/path?q" 를 알아본다. IPv6 주소는 [ ] 로 감싼다.
+ */
+void hreq_split_uri(const char *buf, hslice_t target, hreq_uri_t *u) {
+    size_t p = target.off, end = target.off + target.len, a, colon = 0;
+
+    memset(u, 0, sizeof(*u));
+    if (p < end && buf[p] != '/') {
+        /* scheme 은 영숫자와 "+-." 뿐이다 - 쿼리 안의 "://" 에 속지 않도록 */
+        a = p;
+        while (a < end && (isalnum((unsigned char)buf[a]) || buf[a] == '+' ||
+                           buf[a] == '-' || buf[a] == '.'))
+            a++;
+        if (a + 3 <= end && !strncmp(buf + a, "://", 3))
+            p = a + 3;
+        /* authority - 경로나 쿼리 전까지 */
+        a = p;
+        if (p < end && buf[p] == '[') {
+            while (p < end && buf[p] != ']')
+                p++;
+            u->host.off = a + 1;
+            u->host.len = p - a - 1;
+            if (p < end)
+                p++;
+            if (p < end && buf[p] == ':')
+                colon = p;
+        } else {
+            p += scan_any(buf + p, end - p, "/?");
+            for (colon = p; colon > a && buf[colon - 1] != ':'; colon--)
+                ;
+            colon = colon > a ? colon - 1 : 0;
+            u->host.off = a;
+            u->host.len = (colon ? colon : p) - a;
+        }
+        p += scan_any(buf + p, end - p, "/?");
+        if (colon) {
+            u->port.off = colon + 1;
+            u->port.len = p - colon - 1;
+        }
+    }
+    u->path.off = p;
+    u->path.len = end - p;
+    p += scan_any(buf + p, end - p, "?");
+    if (p < end) {
+        u->query.off = p + 1;
+        u->query.len = end - p - 1;
+    }
+}
+
+/* "METHOD target HTTP/1.x" */
+static int parse_request_line(hreq_t *r, const char *buf, size_t start, size_t end) {
+    size_t p = start;
+
+    r->method = take_word(buf, &p, end);
+    r->target = take_word(buf, &p, end);
+    r->version = take_word(buf, &p, end);
+    while (p < end && is_ws(buf[p]))
+        p++;
+    if (r->method.len == 0 || r->target.len == 0 || p != end)
+        return -1;
+    if (r->version.len == 8 && !strncmp(buf + r->version.off, "HTTP/1.", 7) &&
+        buf[r->version.off + 7] >= '0' && buf[r->version.off + 7] <= '9')
+        r->minor = buf[r->version.off + 7] - '0';
+    hreq_split_uri(buf, r->target, &r->uri);
+    return 0;
+}
+
+/* "Name: value" - 이름 앞뒤 공백과 접힌 줄 (obs-fold) 은 받지 않는다 (RFC 9112 5) */
+static int parse_header(hreq_t *r, const char *buf, size_t start, size_t end) {
+    size_t colon = start + scan_any(buf + start, end - start, ":"), v;
+    hreq_hdr_t *h;
+
+    if (is_ws(buf[start]) || colon == end || colon == start || is_ws(buf[colon - 1]))
+        return HREQ_ERROR;
+    if (r->nhdrs == HREQ_MAXHDRS)
+        return HREQ_TOOBIG;
+    h = &r->hdrs[r->nhdrs++];
+    h->name.off = start;
+    h->name.len = colon - start;
+    h->id = hdr_lookup(buf + start, colon - start);
+    v = colon + 1;
+    while (v < end && is_ws(buf[v]))
+        v++;
+    while (end > v && is_ws(buf[end - 1]))
+        end--;
+    h->value.off = v;
+    h->value.len = end - v;
+    return 0;
+}
+
+/*
+ * hreq_parse - buf[0..len) 에서 지난번에 멈춘 곳부터 이어서 본다. 빈 줄까지
+ *     왔으면 HREQ_DONE (r->end 가 요청 헤더 길이 - 그 뒤는 다음 요청이나 본문),
+ *     줄이 덜 왔으면 HREQ_AGAIN, 틀린 요청이면 HREQ_ERROR / HREQ_TOOBIG.
+ *     줄 끝은 CRLF 와 LF 를 모두 받는다.
+ */
+int hreq_parse(hreq_t *r, const char *buf, size_t len) {
+    size_t eol;
+    int rc;
+
+    while (r->state != ST_DONE) {
+        if (r->pos >= len || (eol = r->pos + scan_line(buf + r->pos, len - r->pos)) == len) {
+            r->pos = len;
+            return HREQ_AGAIN;
+        }
+        r->pos = eol + 1;
+        if (eol > r->line && buf[eol - 1] == '\r')
+            eol--;
+
+        if (r->state == ST_LINE) {
+            if (eol > r->line) {    /* 요청 앞의 빈 줄은 건너뛴다 (RFC 9112 2.2) */
+                if (parse_request_line(r, buf, r->line, eol) < 0)
+                    return HREQ_ERROR;
+                r->hdr_start = r->pos;
+                r->state = ST_HDRS;
+            }
+        } else if (eol == r->line) {
+            r->end = r->pos;
+            r->state = ST_DONE;
+        } else if ((rc = parse_header(r, buf, r->line, eol)) < 0) {
+            return rc;
+        }
+        r->line = r->pos;
+    }
+    return HREQ_DONE;
+}
+
+/* 조각이 str 과 같은가 (대소문자 무시) */
+int hreq_is(const char *buf, hslice_t s, const char *str) {
+    return strlen(str) == s.len && !strncasecmp(buf + s.off, str, s.len);
+}
+
+/* 이름 번호가 id 인 마지막 헤더의 자리, 없으면 -1 */
+int hreq_find(const hreq_t *r, hdr_id_t id) {
+    for (int i = r->nhdrs - 1; i >= 0; i--)
+        if (r->hdrs[i].id == id)
+            return i;
+    return -1;
+}
+
+/* 쉼표로 나뉜 값 안에 token 이 있는가 (대소문자 무시) */
+int hreq_has_token(const char *buf, hslice_t value, const char *token) {
+    size_t p = value.off, end = value.off + value.len, t, n = strlen(token);
+
+    while (p < end) {
+        while (p < end && (is_ws(buf[p]) || buf[p] == ','))
+            p++;
+        t = p;
+        while (p < end && buf[p] != ',')
+            p++;
+        while (p > t && is_ws(buf[p - 1]))
+            p--;
+        if (p - t == n && !strncasecmp(buf + t, token, n))
+            return 1;
+        while (p < end && buf[p] != ',')
+            p++;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * httpreq.h - HTTP 요청 줄과 헤더를 읽은 버퍼 그대로 나누는 점진 파서
+ *     (proxy, proxy_cache, tiny 가 같이 쓴다)
+ */
+#ifndef __HTTPREQ_H__
+#define __HTTPREQ_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hdrname.h"
+
+#define HREQ_MAXHDRS 100
+
+/* hreq_parse 결과 */
+#define HREQ_DONE     1    /* 빈 줄까지 왔다 */
+#define HREQ_AGAIN    0    /* 더 받아서 다시 부르면 이어서 본다 */
+#define HREQ_ERROR   -1    /* 형식 오류 (400) */
+#define HREQ_TOOBIG  -2    /* 헤더가 HREQ_MAXHDRS 개보다 많다 (431) */
+
+/* 버퍼 안의 조각 - 버퍼가 Realloc 으로 옮겨 가도 맞도록 위치와 길이로 */
+typedef struct {
+    uint32_t off, len;
+} hslice_t;
+
+/* 요청 대상의 구성 요소. origin-form ("/a?b") 이면 host 와 port 는 비어 있다 */
+typedef struct {
+    hslice_t host;                 /* [ ] 는 뺀다 */
+    hslice_t port;
+    hslice_t path;                 /* 경로와 쿼리 ("/a?b") - origin 에 보낼 대상 */
+    hslice_t query;                /* '?' 뒤 */
+} hreq_uri_t;
+
+typedef struct {
+    hslice_t name, value;          /* value 는 앞뒤 공백을 뺀 것 */
+    hdr_id_t id;                   /* 파싱할 때 한 번 찾아 둔 이름 번호 */
+} hreq_hdr_t;
+
+typedef struct {
+    /* 결과 */
+    hslice_t method, target, version;
+    hreq_uri_t uri;
+    int minor;                     /* HTTP/1.x 의 x, 버전이 없거나 1.x 가 아니면 -1 */
+    int nhdrs;
+    hreq_hdr_t hdrs[HREQ_MAXHDRS];
+    size_t hdr_start;              /* 첫 헤더 줄의 시작 */
+    size_t end;                    /* 빈 줄 다음 - 요청 헤더 전체 길이 */
+    /* 이어서 보기 위한 상태 */
+    int state;
+    size_t pos;                    /* 아직 보지 않은 첫 바이트 */
+    size_t line;                   /* 지금 줄의 시작 */
+} hreq_t;
+
+void hreq_init(hreq_t *r);
+int hreq_parse(hreq_t *r, const char *buf, size_t len);
+void hreq_split_uri(const char *buf, hslice_t target, hreq_uri_t *u);
+int hreq_is(const char *buf, hslice_t s, const char *str);
+int hreq_find(const hreq_t *r, hdr_id_t id);
+int hreq_has_token(const char *buf, hslice_t value, const char *token);
+
+#endif /* __HTTPREQ_H__ */
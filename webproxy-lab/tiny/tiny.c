@@ -7,10 +7,19 @@
  *   - Fixed sprintf() aliasing issue in serve_static(), and clienterror().
  */
 #include "csapp.h"
+#include "twheel.h"
+#include "httpreq.h"
+#include "outv.h"
+
+#define HEADER_MS 10000      /* 요청 줄과 헤더를 다 받을 때까지 */
+#define WRITE_STALL_MS 30000 /* 응답 하나를 다 보낼 때까지 */
+
+// 반복 서버라 연결은 한 번에 하나 -> 감시도 하나면 충분
+static tw_watch_t watch;
 
 void doit(int fd);
-void read_requesthdrs(rio_t *rp);
-int parse_uri(char *uri, char *filename, char *cgiargs);
+int read_request(int fd, char *buf, size_t size, hreq_t *hr);
+int parse_uri(char *buf, hreq_uri_t *u, char *filename, char *cgiargs);
 void serve_static(int fd, char *filename, int filesize);
 void get_filetype(char *filename, char *filetype);
 void serve_dynamic(int fd, char *filename, char *cgiargs);
@@ -30,6 +39,9 @@ int main(int argc, char **argv)
     exit(1);
   }
 
+  // watchdog 이 shutdown 한 소켓에 쓰다가 SIGPIPE 로 죽지 않도록
+  Signal(SIGPIPE, SIG_IGN);
+  tw_watchdog_start();
   listenfd = Open_listenfd(argv[1]);
   while (1)
   {
@@ -37,32 +49,39 @@ int main(int argc, char **argv)
     connfd = Accept(listenfd, (SA *)&clientaddr,
                     &clientlen); // line:netp:tiny:accept
     Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
-                0);
+                NI_NUMERICHOST | NI_NUMERICSERV);
     printf("Accepted connection from (%s, %s)\n", hostname, port);
     doit(connfd);  // line:netp:tiny:doit
+    tw_unwatch(&watch);  // fd 번호가 재사용되기 전에
     Close(connfd); // line:netp:tiny:close
   }
 }
 
 void doit(int fd) 
 {
-  int is_static;
-  rio_t rio;
+  int is_static, rc;
   struct stat sbuf;
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  char filename[MAXLINE], cgiargs[MAXLINE];
-
-  Rio_readinitb(&rio, fd);
-  Rio_readlineb(&rio, buf, MAXLINE);
-  printf("Request line: %s\n", buf);
-  sscanf(buf, "%s %s %s", method, uri, version);  
-  if(strcasecmp(method, "GET")) {
-    clienterror(fd, method, "501", "Not Implemented", "Tiny does bot implement this method");
+  char buf[MAXBUF], filename[MAXLINE], cgiargs[MAXLINE];
+  hreq_t hr;
+
+  // 반쯤 보낸 요청 줄로 서버 전체를 붙잡지 못하게 헤더 읽기에 시간 제한
+  tw_watch(&watch, fd, HEADER_MS);
+  if((rc = read_request(fd, buf, sizeof(buf), &hr)) == 0) return;
+  // 여기부터는 응답 쓰기 - 받지 않는 클라이언트도 시간 안에 끊는다
+  tw_watch(&watch, fd, WRITE_STALL_MS);
+  if(rc < 0) {
+    clienterror(fd, "", "400", "Bad Request", "Tiny couldn't parse the request");
+    return;
+  }
+  printf("Request line: %.*s\n", (int)(hr.hdr_start - hr.method.off), buf + hr.method.off);
+  // method 는 뒤의 공백을 NUL 로 바꿔 그 자리에서 쓴다
+  buf[hr.method.off + hr.method.len] = '\0';
+  if(!hreq_is(buf, hr.method, "GET")) {
+    clienterror(fd, buf + hr.method.off, "501", "Not Implemented", "Tiny does bot implement this method");
     return;
   }
-  read_requesthdrs(&rio);
 
-  is_static = parse_uri(uri, filename, cgiargs);
+  is_static = parse_uri(buf, &hr.uri, filename, cgiargs);
   printf("==> Requested filename: %s\n", filename);
   // 파일이 존재하지 않으면 
   if(stat(filename, &sbuf) < 0) {
@@ -92,76 +111,65 @@ void doit(int fd)
 
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg)
 {
-  // buf -> http 응답의 헤더, body -> http 응답의 본문
-  char buf[MAXLINE], body[MAXBUF];
-
-  sprintf(body, "<html><title> Tiny Error</title>");
-  sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-  sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-  sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-  sprintf(body, "%s<hr><em>The tiny Web server</em>\r\n", body);
-
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  // o -> http 응답의 헤더 조각들, body -> http 응답의 본문
+  char body[MAXBUF];
+  outv_t o;
+  int n;
+
+  n = snprintf(body, sizeof(body), "<html><title> Tiny Error</title>"
+               "<body bgcolor=""ffffff"">\r\n%s: %s\r\n<p>%s: %s\r\n"
+               "<hr><em>The tiny Web server</em>\r\n",
+               errnum, shortmsg, longmsg, cause);
+  if (n >= (int)sizeof(body)) n = sizeof(body) - 1;
+
+  // 헤더와 본문을 writev 한 번에 - 끊긴 클라이언트면 -1 만 돌아온다
+  outv_init(&o);
+  outv_printf(&o, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\n"
+              "Content-length: %d\r\n\r\n", errnum, shortmsg, n);
+  outv_add(&o, body, n);
+  outv_flush(&o, fd, 0);
 }
 
-void read_requesthdrs(rio_t *rp)
+/*
+ * 빈 줄까지 buf 에 받으며 hreq_parse 로 그 자리에서 나눈다 - 요청이 여러 조각으로
+ * 와도 받은 만큼만 이어서 본다. 다 받았으면 1, 빈 줄 전에 연결이 끊기면 (시간 초과
+ * 포함) 0, 형식이 틀렸거나 buf 에 다 들어가지 않으면 -1
+ */
+int read_request(int fd, char *buf, size_t size, hreq_t *hr)
 {
-  char buf[MAXLINE];
-  while(1) {
-    Rio_readlineb(rp, buf, MAXLINE);
-    if(strcmp(buf, "\r\n") == 0) break;
+  size_t len = 0;
+  ssize_t n;
+  int rc;
+
+  hreq_init(hr);
+  while((rc = hreq_parse(hr, buf, len)) == HREQ_AGAIN) {
+    if(len == size) return -1;
+    if((n = read(fd, buf + len, size - len)) < 0 && errno == EINTR) continue;
+    if(n <= 0) return 0;
+    len += n;
   }
-  return;
+  return rc == HREQ_DONE ? 1 : -1;
 }
 
-int parse_uri(char *uri, char *filename, char *cgiargs)
+// 요청 대상의 경로로 파일 이름을, 쿼리로 CGI 인자를 만든다. 정적이면 1, 동적이면 0
+int parse_uri(char *buf, hreq_uri_t *u, char *filename, char *cgiargs)
 {
-  char *ptr;
-  /*
-    strstr -> string in string -> strstr 함수는 true/false 반환 안 함.
-    찾았을때 -> strstr("/cgi-bin/adder", "cgi-bin")를 실행하면, / 다음의 'c'를 가리키는 포인터를 반환.
-    못 찾았을때(없을때) -> NULL 포인터 (즉, 0)를 반환.
-  */  
-  // uri 문자열 안에 cgi-bin이 없다면 ? -> 정적
-  if(!strstr(uri, "cgi-bin")) {
-    // strcpy -> 덮어쓰기 -> char *strcpy(char *dest, const char *src);
-    //                     dest (Destination, 목적지): 복사한 문자열이 저장될 버퍼(문자 배열).
-    //                     src (Source, 원본): 복사할 원본 문자열.
-    strcpy(cgiargs, "");
-    strcpy(filename, ".");
-    // strcat -> 이어쓰기
-    strcat(filename, uri);
-    // 요청된 uri의 끝이 / 이면 -> http://localhost:8000/ 이런식으로 디렉토리를 요청한 것 -> 기본 파일 제공
-    if(uri[strlen(uri)-1] == '/') strcat(filename, "home.html");
-    return -1;
-  }
-  // uri 문자열 안에 cgi-bin이 있다면 ? -> 동적
-  else {
-    // 우선 ? 기준 잡아 -> ? 앞으론 filename, 뒤론 전달할 cgiargs (인자)
-    ptr = index(uri, '?');
-    if(ptr) {
-      // ? 바로 다음 위치부터 문자열 끝까지 cgiargs 버퍼에 복사 (? 바로 다음 위치부터 인자니까)
-      strcpy(cgiargs, ptr + 1);
-      // 그리고 물음표 \0 -> NULL 로 바꿔버림 (이제 \0 기준으로 앞은 filename 뒤론 인자)
-      *ptr = '\0';
-    }
-    // 문자열 안에 ? 가 없다면
-    else {
-	     // 인자 들어올 버퍼 초기화 
-	     strcpy(cgiargs, "");
-	   }
-    // filename 에 . 복사 -> filname = '.'
-    strcpy(filename, ".");
-    // filename 뒤에 uri 붙여 넣어 -> filename (예시로 -> ./cgi-bin/adder)
-    strcat(filename, uri);
-    return 0;
+  // path 는 쿼리까지 붙어 있다 -> '?' 앞까지만 파일 이름
+  int plen = u->query.len ? (int)(u->query.off - 1 - u->path.off) : (int)u->path.len;
+  char *path = buf + u->path.off;
+
+  // 경로가 /cgi-bin 아래가 아니면 -> 정적
+  if(plen < 8 || strncmp(path, "/cgi-bin", 8)) {
+    cgiargs[0] = '\0';
+    // 경로가 / 로 끝나면 -> http://localhost:8000/ 이런식으로 디렉토리를 요청한 것 -> 기본 파일 제공
+    if(plen == 0) snprintf(filename, MAXLINE, "./home.html");
+    else snprintf(filename, MAXLINE, ".%.*s%s", plen, path, path[plen-1] == '/' ? "home.html" : "");
+    return 1;
   }
+  // 동적 -> ? 앞으론 filename (예시로 -> ./cgi-bin/adder), 뒤론 전달할 cgiargs (인자)
+  snprintf(cgiargs, MAXLINE, "%.*s", (int)u->query.len, buf + u->query.off);
+  snprintf(filename, MAXLINE, ".%.*s", plen, path);
+  return 0;
 }
 
 void get_filetype(char *filename, char *filetype)
@@ -176,33 +184,37 @@ void get_filetype(char *filename, char *filetype)
 void serve_static(int fd, char *filename, int filesize)
 {
   int srcfd;
-  char *srcp, filetype[MAXLINE], buf[MAXBUF];
+  char *srcp = NULL, filetype[MAXLINE];
+  outv_t o;
   get_filetype(filename, filetype);
-  // send header
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);
-  sprintf(buf, "%sConnection: close\r\n", buf);
-  sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
-  sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
-  Rio_writen(fd, buf, strlen(buf));
+  // header
+  outv_init(&o);
+  outv_str(&o, "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\nConnection: close\r\n");
+  outv_printf(&o, "Content-length: %d\r\nContent-type: %s\r\n\r\n", filesize, filetype);
   printf("Response headers:\n");
-  printf("%s", buf);
-  // send body
-  srcfd = Open(filename, O_RDONLY, 0);
-  srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
-  Close(srcfd);
-  Rio_writen(fd, srcp, filesize);
-  Munmap(srcp, filesize);
+  for (int i = 0; i < o.n; i++)
+    fwrite(o.iov[i].iov_base, 1, o.iov[i].iov_len, stdout);
+  // body - mmap 한 파일을 헤더 뒤 조각으로 붙여 writev 한 번에 보낸다
+  if (filesize > 0) {
+    srcfd = Open(filename, O_RDONLY, 0);
+    srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
+    Close(srcfd);
+    outv_add(&o, srcp, filesize);
+  }
+  outv_flush(&o, fd, 0);
+  if (srcp)
+    Munmap(srcp, filesize);
 }
 
 void serve_dynamic(int fd, char *filename, char *cgiargs)
 {
-  char buf[MAXLINE], *emptylist[] = { NULL };
+  char *emptylist[] = { NULL };
+  outv_t o;
 
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Server: Tiny Web Server\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  // MSG_MORE - 상태 줄이 혼자 나가지 않고 CGI 가 쓰는 헤더와 같은 조각에 실린다
+  outv_init(&o);
+  outv_str(&o, "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\n");
+  if (outv_flush(&o, fd, MSG_MORE) < 0) return;
 
   if (Fork() == 0) {
     setenv("QUERY_STRING", cgiargs, 1);
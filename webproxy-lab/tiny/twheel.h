@@ -0,0 +1,59 @@
+/*
+ * twheel.h - 계층형 타이밍 휠 (arm/cancel O(1)) 과 그 위의 fd watchdog
+ */
+#ifndef __TWHEEL_H__
+#define __TWHEEL_H__
+
+#include <stdint.h>
+
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)    /* 단계마다 64 칸 */
+#define TW_LEVELS 5                /* 1ms 눈금, 2^30 ms (약 12 일) 까지 */
+
+typedef struct tw_timer {
+    long long expires;             /* ms */
+    int armed;                     /* 0 으로 초기화된 타이머는 걸려 있지 않다 */
+    int level, slot;
+    struct tw_timer *prev, *next;
+} tw_timer_t;
+
+typedef struct {
+    long long now;                 /* 마지막으로 처리한 눈금 (ms) */
+    int count;
+    uint64_t bitmap[TW_LEVELS];    /* 비어 있지 않은 칸 */
+    tw_timer_t *slots[TW_LEVELS][TW_SLOTS];
+} twheel_t;
+
+typedef void tw_fire_fn(tw_timer_t *t);
+
+void tw_init(twheel_t *w, long long now);
+void tw_arm(twheel_t *w, tw_timer_t *t, long long expires);
+void tw_cancel(twheel_t *w, tw_timer_t *t);
+void tw_expire(twheel_t *w, long long now, tw_fire_fn *fire);
+long long tw_timeout(twheel_t *w, long long now);
+long long tw_now(void);
+
+/*
+ * watchdog - 블로킹 I/O 를 하는 스레드용. 시간 안에 tw_unwatch 하지 않으면
+ * watchdog 스레드가 fd 를 shutdown 해서 막혀 있던 read/write 를 풀어 준다.
+ * fd 를 닫기 전에는 반드시 tw_unwatch 해야 한다 (번호 재사용).
+ * tw_call 로 건 것은 fd 를 끊는 대신 watchdog 스레드에서 fn 을 부른다 - fn 은
+ * watchdog 의 lock 안에서 불리므로 tw_watch/tw_call 을 부르면 안 되고, 다시
+ * 불리고 싶으면 몇 ms 뒤인지를 돌려준다 (-1 이면 그만).
+ */
+typedef struct tw_watch tw_watch_t;
+typedef long long tw_call_fn(tw_watch_t *wt);
+
+struct tw_watch {
+    tw_timer_t timer;              /* 첫 멤버여야 한다 */
+    int fd;
+    int fired;                     /* 시간이 다 되어 fd 를 끊었다 */
+    tw_call_fn *fn;                /* tw_call 로 걸었으면 부를 함수 */
+};
+
+void tw_watchdog_start(void);
+void tw_watch(tw_watch_t *wt, int fd, int ms);
+void tw_call(tw_watch_t *wt, int ms, tw_call_fn *fn);
+int tw_unwatch(tw_watch_t *wt);
+
+#endif /* __TWHEEL_H__ */
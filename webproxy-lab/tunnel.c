@@ -0,0 +1,266 @@
+/*
+ * tunnel.c - CONNECT 터널 스레드
+ *
+ * CONNECT 로 연 터널은 TLS 바이트를 오래 (몇 분씩) 주고받기만 하므로 워커
+ * 스레드나 코루틴이 붙잡고 있지 않고, 200 을 보낸 뒤 두 fd 를 이 스레드에
+ * 넘긴다. 스레드 하나가 epoll (edge-triggered) 로 모든 터널을 돌리고, 방향마다
+ * 파이프 하나를 두고 splice 로 소켓 -> 파이프 -> 소켓 을 옮기므로 바이트가 유저
+ * 공간에 올라오지 않는다. 받는 쪽이 느리면 파이프가 차고 그동안 보내는 쪽을
+ * 읽지 않는다.
+ *
+ * 한쪽이 EOF 를 보내면 파이프를 다 비운 뒤 반대쪽에 SHUT_WR 을 전한다 (half
+ * close) - 두 방향이 다 닫히거나 에러가 나면 터널을 정리한다. 양쪽 다 idle_ms
+ * 동안 움직이지 않으면 타이밍 휠이 터널을 닫는다.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "csapp.h"
+#include "twheel.h"
+#include "tunnel.h"
+
+#define TUNNEL_CHUNK 65536     /* splice 한 번에 옮길 최대 바이트 (파이프 기본 크기) */
+#define TUNNEL_EVENTS 64
+
+/* 한 방향 - from 에서 읽어 파이프에 담았다가 to 로 */
+typedef struct {
+    int from, to;
+    int pipe[2];
+    size_t queued;             /* 파이프에 있는 바이트 */
+    int eof;                   /* from 이 EOF 를 보냈다 */
+    int shut;                  /* to 에 SHUT_WR 을 전했다 */
+} tdir_t;
+
+typedef struct tunnel {
+    tw_timer_t timer;          /* 첫 멤버여야 한다 (idle 시간 제한) */
+    int clientfd, serverfd;
+    tdir_t dir[2];             /* 0: client -> server, 1: server -> client */
+    int dead;                  /* 정리했다 - 이번 epoll 묶음이 끝나면 해제 */
+    struct tunnel *next;       /* 넘겨받기 큐, 해제 대기 목록 */
+} tunnel_t;
+
+static int epfd = -1, wakefd = -1;
+static int idle_ms;
+static tunnel_done_fn *on_done;
+static twheel_t wheel;
+static tunnel_t *incoming;     /* tunnel_submit 이 넣고 터널 스레드가 꺼낸다 */
+static tunnel_t *graveyard;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 파이프를 못 만들면 (EMFILE 등) -1 */
+static int dir_init(tdir_t *d, int from, int to) {
+    d->from = from;
+    d->to = to;
+    d->queued = 0;
+    d->eof = d->shut = 0;
+    return pipe2(d->pipe, O_NONBLOCK | O_CLOEXEC);
+}
+
+static void dir_free(tdir_t *d) {
+    Close(d->pipe[0]);
+    Close(d->pipe[1]);
+}
+
+/*
+ * pump - 한 방향을 막힐 때까지 옮긴다. 파이프에 남은 것을 먼저 보내고, 비면
+ *     from 에서 더 읽는다. 옮긴 바이트가 있으면 1, 없으면 0, 에러면 -1.
+ */
+static int pump(tdir_t *d) {
+    ssize_t n;
+    int moved = 0;
+
+    while (1) {
+        if (d->queued > 0) {
+            n = splice(d->pipe[0], NULL, d->to, NULL, d->queued,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN)
+                    break;             /* to 가 받을 수 있게 되면 EPOLLOUT */
+                return -1;
+            }
+            d->queued -= n;
+            moved = 1;
+            continue;
+        }
+        if (d->eof)
+            break;
+        n = splice(d->from, NULL, d->pipe[1], NULL, TUNNEL_CHUNK,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+        if (n == 0) {
+            d->eof = 1;
+            break;
+        }
+        d->queued += n;
+        moved = 1;
+    }
+    if (d->eof && d->queued == 0 && !d->shut) {
+        shutdown(d->to, SHUT_WR);      /* 반대쪽에도 EOF 를 전한다 */
+        d->shut = 1;
+    }
+    return moved;
+}
+
+/* 터널을 닫는다 - 해제는 같은 묶음의 다른 이벤트가 지나간 뒤에 */
+static void tunnel_close(tunnel_t *t) {
+    if (t->dead)
+        return;
+    t->dead = 1;
+    tw_cancel(&wheel, &t->timer);
+    dir_free(&t->dir[0]);
+    dir_free(&t->dir[1]);
+    Close(t->serverfd);
+    on_done(t->clientfd);
+    t->next = graveyard;
+    graveyard = t;
+}
+
+/* 어느 쪽 fd 에 이벤트가 왔든 두 방향을 모두 돌린다 */
+static void service(tunnel_t *t) {
+    int a, b;
+
+    if (t->dead)
+        return;
+    if ((a = pump(&t->dir[0])) < 0 || (b = pump(&t->dir[1])) < 0 ||
+        (t->dir[0].shut && t->dir[1].shut)) {
+        tunnel_close(t);
+        return;
+    }
+    if (a || b)
+        tw_arm(&wheel, &t->timer, tw_now() + idle_ms);
+}
+
+static void idle_fire(tw_timer_t *timer) {
+    tunnel_close((tunnel_t *)timer);
+}
+
+/*
+ * 새로 넘어온 터널을 epoll 에 건다 - 처음 한 번은 바로 돌린다. 걸지 못한
+ * 터널은 그 터널만 닫는다 (닫힌 fd 는 epoll 에서도 빠진다).
+ */
+static void take_incoming(void) {
+    struct epoll_event ev;
+    tunnel_t *t, *next;
+    uint64_t v;
+
+    if (read(wakefd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+        unix_error("eventfd read error");
+    pthread_mutex_lock(&lock);
+    t = incoming;
+    incoming = NULL;
+    pthread_mutex_unlock(&lock);
+    for (; t; t = next) {
+        next = t->next;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = t;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->clientfd, &ev) < 0 ||
+            epoll_ctl(epfd, EPOLL_CTL_ADD, t->serverfd, &ev) < 0) {
+            tunnel_close(t);
+            continue;
+        }
+        tw_arm(&wheel, &t->timer, tw_now() + idle_ms);
+        service(t);
+    }
+}
+
+static void *tunnel_thread(void *vargp) {
+    struct epoll_event evs[TUNNEL_EVENTS];
+    long long left;
+    tunnel_t *t;
+    int n;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        left = tw_timeout(&wheel, tw_now());
+        n = epoll_wait(epfd, evs, TUNNEL_EVENTS, left < 0 ? -1 : (int)left);
+        if (n < 0 && errno != EINTR)
+            unix_error("epoll_wait error");
+        for (int i = 0; i < n; i++) {
+            if (evs[i].data.ptr == NULL)
+                take_incoming();
+            else
+                service(evs[i].data.ptr);
+        }
+        tw_expire(&wheel, tw_now(), idle_fire);
+        while ((t = graveyard) != NULL) {
+            graveyard = t->next;
+            Free(t);
+        }
+    }
+    return NULL;
+}
+
+/* 터널 스레드를 띄운다. 양쪽이 idle_ms 동안 조용하면 터널을 닫는다 */
+void tunnel_init(int ms, tunnel_done_fn *done) {
+    struct epoll_event ev;
+    pthread_t tid;
+
+    idle_ms = ms;
+    on_done = done;
+    tw_init(&wheel, tw_now());
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        unix_error("epoll_create1 error");
+    if ((wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+        unix_error("eventfd error");
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0)
+        unix_error("epoll_ctl error");
+    Pthread_create(&tid, NULL, tunnel_thread, NULL);
+}
+
+/*
+ * tunnel_submit - 연결된 두 fd 를 터널 스레드에 넘긴다 (어느 스레드에서나).
+ *     넘겼으면 0 - 이제 fd 는 터널 것이다 (serverfd 는 터널이 닫고, clientfd 는
+ *     done 콜백에 넘어간다). 파이프를 못 만들거나 터널 스레드를 깨우지 못하면
+ *     -1 이고, 두 fd 는 그대로 부른 쪽 것이다.
+ */
+int tunnel_submit(int clientfd, int serverfd) {
+    tunnel_t *t = Calloc(1, sizeof(tunnel_t)), **pp;
+    uint64_t one = 1;
+
+    fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL) | O_NONBLOCK);
+    fcntl(serverfd, F_SETFL, fcntl(serverfd, F_GETFL) | O_NONBLOCK);
+    t->clientfd = clientfd;
+    t->serverfd = serverfd;
+    if (dir_init(&t->dir[0], clientfd, serverfd) < 0) {
+        Free(t);
+        return -1;
+    }
+    if (dir_init(&t->dir[1], serverfd, clientfd) < 0) {
+        dir_free(&t->dir[0]);
+        Free(t);
+        return -1;
+    }
+    pthread_mutex_lock(&lock);
+    t->next = incoming;
+    incoming = t;
+    pthread_mutex_unlock(&lock);
+    /* EAGAIN 은 카운터가 이미 차 있다는 뜻 - 스레드는 어차피 깨어난다 */
+    if (write(wakefd, &one, sizeof(one)) == sizeof(one) || errno == EAGAIN)
+        return 0;
+
+    /* 스레드가 그새 꺼내 갔으면 넘어간 것이고, 아니면 도로 빼서 돌려준다 */
+    pthread_mutex_lock(&lock);
+    for (pp = &incoming; *pp && *pp != t; pp = &(*pp)->next)
+        ;
+    if (*pp == NULL) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    *pp = t->next;
+    pthread_mutex_unlock(&lock);
+    dir_free(&t->dir[0]);
+    dir_free(&t->dir[1]);
+    Free(t);
+    return -1;
+}
@@ -0,0 +1,13 @@
+/*
+ * tunnel.h - CONNECT 터널 스레드 (epoll + splice, 방향마다 파이프 하나)
+ */
+#ifndef __TUNNEL_H__
+#define __TUNNEL_H__
+
+/* 터널이 끝났을 때 - 터널 스레드에서 불린다. clientfd 를 닫는 것은 콜백의 몫 */
+typedef void tunnel_done_fn(int clientfd);
+
+void tunnel_init(int idle_ms, tunnel_done_fn *done);
+int tunnel_submit(int clientfd, int serverfd);
+
+#endif /* __TUNNEL_H__ */
@@ -0,0 +1,256 @@
+/*
+ * twheel.c - 계층형 타이밍 휠
+ *
+ * 눈금은 1ms, 단계마다 64 칸이다. 타이머는 만료 시각과 현재 시각이 처음으로
+ * 달라지는 6 비트 묶음의 단계에 놓이므로 (Linux 커널 timer wheel 과 같은 방식)
+ * arm/cancel 은 이중 연결 리스트에 넣고 빼는 것뿐이다. 상위 단계의 칸은
+ * 현재 시각이 그 칸의 시작에 닿을 때 아래 단계로 흩어진다 (cascade).
+ *
+ * 칸마다 비트맵이 있어서 다음에 할 일이 있는 눈금을 바로 찾는다. 그래서
+ * tw_expire 는 오래 잠들었다 깨어나도 빈 눈금을 하나씩 지나가지 않는다.
+ * 휠 자체는 잠그지 않는다 - 코루틴 스케줄러는 스레드마다 하나를, watchdog 은
+ * 자기 mutex 아래에서 하나를 쓴다.
+ */
+#include "csapp.h"
+#include "twheel.h"
+#include <time.h>
+
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_SHIFT(level) (TW_BITS * (level))
+/* 맨 위 단계 한 바퀴에서 한 칸 뺀 만큼 - 이보다 먼 타이머는 일단 여기까지 */
+#define TW_HORIZON ((1LL << TW_SHIFT(TW_LEVELS)) - (1LL << TW_SHIFT(TW_LEVELS - 1)))
+
+long long tw_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void tw_init(twheel_t *w, long long now) {
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+}
+
+/* w->now 를 기준으로 알맞은 단계와 칸에 넣는다 */
+static void place(twheel_t *w, tw_timer_t *t) {
+    long long at = t->expires;
+    int level = 0;
+
+    if (at - w->now > TW_HORIZON)
+        at = w->now + TW_HORIZON;   /* 내려오면서 다시 놓인다 */
+    while (level < TW_LEVELS - 1 &&
+           (at >> TW_SHIFT(level + 1)) != (w->now >> TW_SHIFT(level + 1)))
+        level++;
+    t->level = level;
+    t->slot = (at >> TW_SHIFT(level)) & TW_MASK;
+    t->prev = NULL;
+    t->next = w->slots[level][t->slot];
+    if (t->next)
+        t->next->prev = t;
+    w->slots[level][t->slot] = t;
+    w->bitmap[level] |= 1ULL << t->slot;
+}
+
+static void unlink_timer(twheel_t *w, tw_timer_t *t) {
+    if (t->prev)
+        t->prev->next = t->next;
+    else
+        w->slots[t->level][t->slot] = t->next;
+    if (t->next)
+        t->next->prev = t->prev;
+    if (!w->slots[t->level][t->slot])
+        w->bitmap[t->level] &= ~(1ULL << t->slot);
+}
+
+/* t 를 expires (ms) 에 건다. 이미 걸려 있으면 옮긴다 */
+void tw_arm(twheel_t *w, tw_timer_t *t, long long expires) {
+    if (t->armed)
+        unlink_timer(w, t);
+    else
+        w->count++;
+    if (expires <= w->now)
+        expires = w->now + 1;       /* 현재 눈금은 이미 처리했다 */
+    t->expires = expires;
+    t->armed = 1;
+    place(w, t);
+}
+
+void tw_cancel(twheel_t *w, tw_timer_t *t) {
+    if (!t->armed)
+        return;
+    unlink_timer(w, t);
+    t->armed = 0;
+    w->count--;
+}
+
+/* w->now 다음으로 할 일이 있는 눈금까지의 거리 (타이머가 하나 이상 있을 때) */
+static long long next_tick(twheel_t *w) {
+    long long best = -1, tick;
+    uint64_t bits;
+    int cur, rot;
+
+    for (int level = 0; level < TW_LEVELS; level++) {
+        if (!(bits = w->bitmap[level]))
+            continue;
+        cur = (w->now >> TW_SHIFT(level)) & TW_MASK;
+        rot = (cur + 1) & TW_MASK;
+        if (rot)
+            bits = (bits >> rot) | (bits << (TW_SLOTS - rot));
+        tick = ((w->now >> TW_SHIFT(level)) + __builtin_ctzll(bits) + 1) << TW_SHIFT(level);
+        if (best < 0 || tick < best)
+            best = tick;
+    }
+    return best - w->now;
+}
+
+/* 눈금 하나 - 상위 단계 칸을 흩고 0 단계 칸의 타이머를 터뜨린다 */
+static void run_tick(twheel_t *w, long long tick, tw_fire_fn *fire) {
+    tw_timer_t *t;
+    int slot;
+
+    w->now = tick;
+    for (int level = TW_LEVELS - 1; level > 0; level--) {
+        if (tick & ((1LL << TW_SHIFT(level)) - 1))
+            continue;
+        slot = (tick >> TW_SHIFT(level)) & TW_MASK;
+        while ((t = w->slots[level][slot]) != NULL) {
+            unlink_timer(w, t);
+            place(w, t);
+        }
+    }
+
+    /* 하나씩 떼어 내므로 fire 안에서 다른 타이머를 걸거나 풀어도 된다 */
+    slot = tick & TW_MASK;
+    while ((t = w->slots[0][slot]) != NULL) {
+        unlink_timer(w, t);
+        if (t->expires > tick) {    /* 휠 범위 밖이었던 타이머 */
+            place(w, t);
+            continue;
+        }
+        t->armed = 0;
+        w->count--;
+        fire(t);
+    }
+}
+
+/* now 까지 만료된 타이머마다 fire 를 부른다 */
+void tw_expire(twheel_t *w, long long now, tw_fire_fn *fire) {
+    long long tick;
+
+    while (w->now < now) {
+        if (w->count == 0) {
+            w->now = now;
+            break;
+        }
+        tick = w->now + next_tick(w);
+        if (tick > now) {
+            w->now = now;           /* 그 사이 눈금들은 모두 비어 있다 */
+            break;
+        }
+        run_tick(w, tick, fire);
+    }
+}
+
+/* now 부터 다음 tw_expire 가 필요할 때까지 ms. 타이머가 없으면 -1 */
+long long tw_timeout(twheel_t *w, long long now) {
+    long long left;
+
+    if (w->count == 0)
+        return -1;
+    left = w->now + next_tick(w) - now;
+    return left < 0 ? 0 : left;
+}
+
+/*
+ * watchdog - 스레드 하나가 휠 하나를 돌리면서 만료된 fd 를 shutdown 한다.
+ * shutdown 은 fd 를 닫지 않으므로 막혀 있던 쪽은 EOF/EPIPE 를 보고 평소
+ * 오류 경로로 정리한 뒤 tw_unwatch 하고 닫는다.
+ */
+static twheel_t wd_wheel;
+static pthread_mutex_t wd_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wd_cond;
+static long long wd_wake = -1;      /* watchdog 이 깨어나기로 한 시각, -1 = 무기한 */
+
+static void wd_fire(tw_timer_t *t) {
+    tw_watch_t *wt = (tw_watch_t *)t;
+    long long again;
+
+    wt->fired = 1;
+    if (!wt->fn) {
+        shutdown(wt->fd, SHUT_RDWR);
+        return;
+    }
+    if ((again = wt->fn(wt)) >= 0)
+        tw_arm(&wd_wheel, &wt->timer, tw_now() + again);
+}
+
+static void *wd_thread(void *vargp) {
+    struct timespec ts;
+    long long now, left;
+
+    Pthread_detach(pthread_self());
+    pthread_mutex_lock(&wd_lock);
+    while (1) {
+        now = tw_now();
+        tw_expire(&wd_wheel, now, wd_fire);
+        if ((left = tw_timeout(&wd_wheel, now)) < 0) {
+            wd_wake = -1;
+            pthread_cond_wait(&wd_cond, &wd_lock);
+            continue;
+        }
+        wd_wake = now + left;
+        ts.tv_sec = wd_wake / 1000;
+        ts.tv_nsec = (wd_wake % 1000) * 1000000;
+        pthread_cond_timedwait(&wd_cond, &wd_lock, &ts);
+    }
+    return NULL;
+}
+
+void tw_watchdog_start(void) {
+    pthread_condattr_t attr;
+    pthread_t tid;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wd_cond, &attr);
+    tw_init(&wd_wheel, tw_now());
+    Pthread_create(&tid, NULL, wd_thread, NULL);
+}
+
+/* wt 를 ms 뒤에 건다 (이미 걸려 있으면 옮긴다) */
+static void wd_arm(tw_watch_t *wt, int fd, int ms, tw_call_fn *fn) {
+    long long at = tw_now() + ms;
+
+    pthread_mutex_lock(&wd_lock);
+    wt->fd = fd;
+    wt->fired = 0;
+    wt->fn = fn;
+    tw_arm(&wd_wheel, &wt->timer, at);
+    if (wd_wake < 0 || at < wd_wake) {
+        wd_wake = at;
+        pthread_cond_signal(&wd_cond);
+    }
+    pthread_mutex_unlock(&wd_lock);
+}
+
+/* ms 안에 tw_unwatch 하지 않으면 fd 를 끊는다. 이미 걸려 있으면 다시 잰다 */
+void tw_watch(tw_watch_t *wt, int fd, int ms) {
+    wd_arm(wt, fd, ms, NULL);
+}
+
+/* ms 뒤에 watchdog 스레드에서 fn(wt) 를 부른다. 이미 걸려 있으면 다시 잰다 */
+void tw_call(tw_watch_t *wt, int ms, tw_call_fn *fn) {
+    wd_arm(wt, -1, ms, fn);
+}
+
+/* 감시를 푼다. 그 전에 시간이 다 되어 fd 가 끊겼으면 1 */
+int tw_unwatch(tw_watch_t *wt) {
+    int fired;
+
+    pthread_mutex_lock(&wd_lock);
+    tw_cancel(&wd_wheel, &wt->timer);
+    fired = wt->fired;
+    pthread_mutex_unlock(&wd_lock);
+    return fired;
+}